@@ -0,0 +1,213 @@
+#pragma once
+#include <map>
+#include <set>
+#include "LogonBackend.hpp"
+#include "Stats.hpp"
+
+
+/** Comparable view of a logon result: section -> key -> value.
+    Sections are "User", "Groups", "Privileges", "Owner", "PrimaryGroup", "DefaultDacl" and "Profile". */
+using LogonSnapshot = std::map<std::wstring, std::map<std::wstring, std::wstring>>;
+
+/** SID string with the per-logon "S-1-5-5-X-Y" logon SID masked, so that snapshots of different logons can be compared. */
+inline std::wstring SidKey(PSID sid) {
+    wchar_t* sidStr = nullptr;
+    if (!ConvertSidToStringSidW(sid, &sidStr))
+        return L"<invalid>";
+    std::wstring result = sidStr;
+    LocalFree(sidStr);
+
+    if (result.starts_with(L"S-1-5-5-"))
+        return L"S-1-5-5-*";
+    return result;
+}
+
+inline std::wstring HexString(DWORD value) {
+    wchar_t buffer[16] = {};
+    swprintf_s(buffer, L"0x%x", value);
+    return buffer;
+}
+
+/** Collect token contents through a shared query buffer. */
+inline void SnapshotToken(HANDLE token, TokenInfoBuffer& buffer, LogonSnapshot& snapshot) {
+    if (auto* user = buffer.Query<TOKEN_USER>(token, TokenUser))
+        snapshot[L"User"][L"Sid"] = SidKey(user->User.Sid);
+
+    if (auto* groups = buffer.Query<TOKEN_GROUPS>(token, TokenGroups)) {
+        for (DWORD i = 0; i < groups->GroupCount; i++)
+            snapshot[L"Groups"][SidKey(groups->Groups[i].Sid)] = HexString(groups->Groups[i].Attributes);
+    }
+
+    if (auto* privileges = buffer.Query<TOKEN_PRIVILEGES>(token, TokenPrivileges)) {
+        for (DWORD i = 0; i < privileges->PrivilegeCount; i++) {
+            LUID luid = privileges->Privileges[i].Luid;
+            wchar_t name[64] = {};
+            DWORD nameLen = (DWORD)std::size(name);
+            std::wstring key = LookupPrivilegeNameW(nullptr, &luid, name, &nameLen) ? name : HexString(luid.LowPart);
+            snapshot[L"Privileges"][key] = HexString(privileges->Privileges[i].Attributes);
+        }
+    }
+
+    if (auto* owner = buffer.Query<TOKEN_OWNER>(token, TokenOwner))
+        snapshot[L"Owner"][L"Sid"] = SidKey(owner->Owner);
+
+    if (auto* primaryGroup = buffer.Query<TOKEN_PRIMARY_GROUP>(token, TokenPrimaryGroup))
+        snapshot[L"PrimaryGroup"][L"Sid"] = SidKey(primaryGroup->PrimaryGroup);
+
+    if (auto* dacl = buffer.Query<TOKEN_DEFAULT_DACL>(token, TokenDefaultDacl)) {
+        ACL* acl = dacl->DefaultDacl;
+        for (DWORD i = 0; acl && (i < acl->AceCount); i++) {
+            ACE_HEADER* header = nullptr;
+            if (!GetAce(acl, i, (void**)&header) || (header->AceType != ACCESS_ALLOWED_ACE_TYPE))
+                continue;
+            auto* ace = (ACCESS_ALLOWED_ACE*)header;
+            snapshot[L"DefaultDacl"][SidKey(&ace->SidStart)] = HexString(ace->Mask);
+        }
+    }
+}
+
+/** Collect MSV1_0_INTERACTIVE_PROFILE fields, except the per-logon LogonTime.
+    Kerberos returns the same layout as KERB_INTERACTIVE_PROFILE. */
+inline void SnapshotProfile(const LogonResult& result, LogonSnapshot& snapshot) {
+    auto& fields = snapshot[L"Profile"];
+    fields[L"Size"] = std::to_wstring(result.Profile.size());
+    if (result.Profile.size() < sizeof(MSV1_0_INTERACTIVE_PROFILE))
+        return;
+
+    auto* p = (const MSV1_0_INTERACTIVE_PROFILE*)result.Profile.data();
+    auto string = [&](const UNICODE_STRING& str) -> std::wstring {
+        // string pointers are relative to ProfileBase
+        auto offset = (size_t)((const BYTE*)str.Buffer - result.ProfileBase);
+        if ((str.Length == 0) || (offset > result.Profile.size()) || (str.Length > result.Profile.size() - offset))
+            return L"";
+        return std::wstring((const wchar_t*)(result.Profile.data() + offset), str.Length / sizeof(wchar_t));
+    };
+    auto time = [](const LARGE_INTEGER& t) {
+        return std::to_wstring(t.QuadPart);
+    };
+
+    fields[L"MessageType"] = std::to_wstring(p->MessageType);
+    fields[L"LogonCount"] = std::to_wstring(p->LogonCount);
+    fields[L"BadPasswordCount"] = std::to_wstring(p->BadPasswordCount);
+    fields[L"LogoffTime"] = time(p->LogoffTime);
+    fields[L"KickOffTime"] = time(p->KickOffTime);
+    fields[L"PasswordLastSet"] = time(p->PasswordLastSet);
+    fields[L"PasswordCanChange"] = time(p->PasswordCanChange);
+    fields[L"PasswordMustChange"] = time(p->PasswordMustChange);
+    fields[L"LogonScript"] = string(p->LogonScript);
+    fields[L"HomeDirectory"] = string(p->HomeDirectory);
+    fields[L"FullName"] = string(p->FullName);
+    fields[L"ProfilePath"] = string(p->ProfilePath);
+    fields[L"HomeDirectoryDrive"] = string(p->HomeDirectoryDrive);
+    fields[L"LogonServer"] = string(p->LogonServer);
+    fields[L"UserFlags"] = HexString(p->UserFlags);
+}
+
+/** Print entries that are only in "a" (-), only in "b" (+) or differ (~). Returns the number of differences. */
+inline size_t PrintSnapshotDiff(const LogonSnapshot& a, const LogonSnapshot& b) {
+    static const std::map<std::wstring, std::wstring> EMPTY;
+    auto section = [](const LogonSnapshot& snapshot, const std::wstring& name) -> const std::map<std::wstring, std::wstring>& {
+        auto it = snapshot.find(name);
+        return (it != snapshot.end()) ? it->second : EMPTY;
+    };
+
+    std::set<std::wstring> names;
+    for (auto& [name, entries] : a)
+        names.insert(name);
+    for (auto& [name, entries] : b)
+        names.insert(name);
+
+    size_t differences = 0;
+    for (const std::wstring& name : names) {
+        const auto& entriesA = section(a, name);
+        const auto& entriesB = section(b, name);
+
+        std::set<std::wstring> keys;
+        for (auto& [key, value] : entriesA)
+            keys.insert(key);
+        for (auto& [key, value] : entriesB)
+            keys.insert(key);
+
+        bool printedName = false;
+        for (const std::wstring& key : keys) {
+            auto itA = entriesA.find(key);
+            auto itB = entriesB.find(key);
+            if ((itA != entriesA.end()) && (itB != entriesB.end()) && (itA->second == itB->second))
+                continue;
+
+            if (!printedName) {
+                wprintf(L"  %s:\n", name.c_str());
+                printedName = true;
+            }
+            if (itB == entriesB.end())
+                wprintf(L"    - %s: %s\n", key.c_str(), itA->second.c_str());
+            else if (itA == entriesA.end())
+                wprintf(L"    + %s: %s\n", key.c_str(), itB->second.c_str());
+            else
+                wprintf(L"    ~ %s: %s -> %s\n", key.c_str(), itA->second.c_str(), itB->second.c_str());
+            differences++;
+        }
+    }
+    return differences;
+}
+
+
+/** Log the same user on through two packages in alternating order.
+    Prints latency distributions and differences between the resulting tokens & profiles. Returns non-zero if any logon failed. */
+int RunCompareTest(const BackendFactory& factory, const wchar_t* authPkgNames[2], const std::vector<BYTE> authInfos[2], unsigned runs) {
+    using namespace std::chrono;
+
+    std::unique_ptr<LogonBackend> backend = factory();
+    ULONG authPkgs[2] = {};
+    for (size_t pkg = 0; pkg < 2; pkg++) {
+        NTSTATUS status = backend->LookupPackage(authPkgNames[pkg], &authPkgs[pkg]);
+        if (status != STATUS_SUCCESS)
+            return 1;
+    }
+
+    TokenInfoBuffer tokenInfo; // shared by all token queries
+    std::vector<double> latencies[2];
+    LogonSnapshot snapshots[2];
+    bool haveSnapshot[2] = {};
+    unsigned failures = 0;
+
+    for (unsigned run = 0; run < runs; run++) {
+        for (size_t pkg = 0; pkg < 2; pkg++) {
+            LogonResult result;
+            auto before = steady_clock::now();
+            NTSTATUS ret = backend->Logon(authPkgs[pkg], authInfos[pkg], /*keepProfile*/true, result);
+            auto after = steady_clock::now();
+            if (ret != STATUS_SUCCESS) {
+                wprintf(L"ERROR: %s logon failed (%s)\n", authPkgNames[pkg], ToString(ret).c_str());
+                failures++;
+                continue;
+            }
+            latencies[pkg].push_back(duration<double, std::milli>(after - before).count());
+
+            if (!haveSnapshot[pkg]) {
+                SnapshotToken(result.Token, tokenInfo, snapshots[pkg]);
+                SnapshotProfile(result, snapshots[pkg]);
+                haveSnapshot[pkg] = true;
+            }
+        }
+    }
+
+    wprintf(L"%-24s %8s %10s %10s %10s %10s %10s\n", L"Latency [ms]", L"logons", L"min", L"p50", L"p90", L"p99", L"max");
+    Summary summaries[2];
+    for (size_t pkg = 0; pkg < 2; pkg++) {
+        Summary& s = summaries[pkg] = Summarize(latencies[pkg]);
+        wprintf(L"%-24s %8zu %10.3f %10.3f %10.3f %10.3f %10.3f\n", authPkgNames[pkg], s.Count, s.Min, s.P50, s.P90, s.P99, s.Max);
+    }
+    if ((summaries[0].P50 > 0) && (summaries[1].P50 > 0))
+        wprintf(L"Median ratio %s/%s: %.2f\n", authPkgNames[1], authPkgNames[0], summaries[1].P50 / summaries[0].P50);
+
+    if (haveSnapshot[0] && haveSnapshot[1]) {
+        wprintf(L"\nDifferences from %s to %s:\n", authPkgNames[0], authPkgNames[1]);
+        if (PrintSnapshotDiff(snapshots[0], snapshots[1]) == 0)
+            wprintf(L"  none\n");
+    }
+
+    if (failures > 0)
+        fwprintf(stderr, L"WARNING: %u logons failed\n", failures);
+    return (failures > 0) ? 1 : 0;
+}
@@ -0,0 +1,100 @@
+#pragma once
+#include <atomic>
+#include "LogonBackend.hpp"
+#include "Stats.hpp"
+
+
+enum class ReportFormat {
+    Json,
+    Csv,
+};
+
+struct LoadOptions {
+    unsigned     Threads = 1;
+    double       DurationSec = 10; // test duration if "Count" is zero
+    unsigned     Count = 0;        // total number of logons across all threads
+    ReportFormat Format = ReportFormat::Json;
+};
+
+
+/** Drive repeated logons from multiple threads without starting any processes.
+    Prints throughput & latency percentiles. Returns non-zero if any logon failed. */
+int RunLoadTest(const BackendFactory& factory, const wchar_t* authPkgName, const std::vector<BYTE>& authInfo, const LoadOptions& options) {
+    using namespace std::chrono;
+
+    std::atomic<unsigned> claimed = 0; // logons claimed in "Count" mode
+    std::mutex            mutex;       // protect merged results below
+    std::vector<double>   latencies;   // successful logons [ms]
+    unsigned              failures = 0;
+    NTSTATUS              lastError = STATUS_SUCCESS;
+
+    auto start = steady_clock::now();
+    auto deadline = start + duration_cast<steady_clock::duration>(duration<double>(options.DurationSec));
+
+    auto worker = [&]() {
+        std::unique_ptr<LogonBackend> backend = factory(); // one LSA connection per thread
+        std::vector<double> local;
+        unsigned localFailures = 0;
+        NTSTATUS localError = STATUS_SUCCESS;
+
+        ULONG authPkg = 0;
+        NTSTATUS status = backend->LookupPackage(authPkgName, &authPkg);
+        if (status != STATUS_SUCCESS) {
+            localFailures++;
+            localError = status;
+        } else {
+            for (;;) {
+                if (options.Count ? (claimed++ >= options.Count) : (steady_clock::now() >= deadline))
+                    break;
+
+                LogonResult result;
+                auto before = steady_clock::now();
+                NTSTATUS ret = backend->Logon(authPkg, authInfo, /*keepProfile*/false, result);
+                auto after = steady_clock::now();
+                if (ret == STATUS_SUCCESS) {
+                    local.push_back(duration<double, std::milli>(after - before).count());
+                } else {
+                    localFailures++;
+                    localError = ret;
+                }
+            } // token & logon session closed by LogonResult
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        latencies.insert(latencies.end(), local.begin(), local.end());
+        failures += localFailures;
+        if (localError != STATUS_SUCCESS)
+            lastError = localError;
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < options.Threads; i++)
+        threads.emplace_back(worker);
+    for (std::thread& thread : threads)
+        thread.join();
+
+    double elapsedSec = duration<double>(steady_clock::now() - start).count();
+    Summary latency = Summarize(latencies);
+    double throughput = latency.Count / elapsedSec;
+
+    if (options.Format == ReportFormat::Csv) {
+        wprintf(L"package,threads,logons,failures,duration_s,throughput_per_s,p50_ms,p90_ms,p99_ms,p999_ms,max_ms\n");
+        wprintf(L"%s,%u,%zu,%u,%.3f,%.1f,%.3f,%.3f,%.3f,%.3f,%.3f\n", authPkgName, options.Threads, latency.Count, failures, elapsedSec, throughput,
+            latency.P50, latency.P90, latency.P99, latency.P999, latency.Max);
+    } else {
+        wprintf(L"{\n");
+        wprintf(L"  \"package\": \"%s\",\n", authPkgName);
+        wprintf(L"  \"threads\": %u,\n", options.Threads);
+        wprintf(L"  \"logons\": %zu,\n", latency.Count);
+        wprintf(L"  \"failures\": %u,\n", failures);
+        wprintf(L"  \"last_error\": \"0x%08x\",\n", lastError);
+        wprintf(L"  \"duration_s\": %.3f,\n", elapsedSec);
+        wprintf(L"  \"throughput_per_s\": %.1f,\n", throughput);
+        wprintf(L"  \"latency_ms\": { \"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"p999\": %.3f, \"max\": %.3f }\n", latency.P50, latency.P90, latency.P99, latency.P999, latency.Max);
+        wprintf(L"}\n");
+    }
+
+    if (failures > 0)
+        fwprintf(stderr, L"WARNING: %u logons failed (%s)\n", failures, ToString(lastError).c_str());
+    return (failures > 0) ? 1 : 0;
+}
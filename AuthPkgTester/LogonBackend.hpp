@@ -0,0 +1,142 @@
+#pragma once
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <span>
+#include <thread>
+#include "LogonUser.hpp"
+
+
+/** RAII wrapper of an untrusted LSA connection. */
+class LsaHandle {
+public:
+    LsaHandle() {
+        // establish LSA connection
+        NTSTATUS status = LsaConnectUntrusted(&m_lsa);
+        assert(status == STATUS_SUCCESS);
+    }
+    ~LsaHandle() {
+        // close LSA handle
+        NTSTATUS status = LsaDeregisterLogonProcess(m_lsa);
+        assert(status == STATUS_SUCCESS);
+    }
+
+    operator HANDLE() {
+        return m_lsa;
+    }
+private:
+    HANDLE m_lsa = 0;
+};
+
+
+/** Outcome of a single logon. Closes the token, and thereby the logon session, when destroyed. */
+struct LogonResult {
+    NTSTATUS          SubStatus = 0;
+    LUID              LogonId = {};
+    HANDLE            Token = nullptr;
+    std::vector<BYTE> Profile; // only filled if requested
+    const BYTE*       ProfileBase = nullptr; // address that string pointers in "Profile" are relative to
+
+    LogonResult() = default;
+    LogonResult(const LogonResult&) = delete;
+    LogonResult& operator = (const LogonResult&) = delete;
+
+    ~LogonResult() {
+        if (Token)
+            CloseHandle(Token);
+    }
+};
+
+/** Performs logons for load & comparison tests. Each instance is used by one thread at a time.
+    Swappable for an in-process mock, so that test modes can be exercised without involving LSA. */
+class LogonBackend {
+public:
+    virtual ~LogonBackend() = default;
+
+    virtual NTSTATUS LookupPackage(const wchar_t* authPkgName, ULONG* authPkg) = 0;
+
+    /** Perform an interactive logon. Copies the profile buffer to "result" if "keepProfile" is set. */
+    virtual NTSTATUS Logon(ULONG authPkg, std::span<const BYTE> authInfo, bool keepProfile, LogonResult& result) = 0;
+};
+
+/** Create one backend instance per worker thread. */
+using BackendFactory = std::function<std::unique_ptr<LogonBackend>()>;
+
+
+/** Logon through LsaLogonUser on a dedicated LSA connection. */
+class LsaBackend : public LogonBackend {
+public:
+    NTSTATUS LookupPackage(const wchar_t* authPkgName, ULONG* authPkg) override {
+        return GetAuthPackage(m_lsa, authPkgName, authPkg);
+    }
+
+    NTSTATUS Logon(ULONG authPkg, std::span<const BYTE> authInfo, bool keepProfile, LogonResult& result) override {
+        void* profileBuffer = nullptr;
+        ULONG profileBufferLen = 0;
+        QUOTA_LIMITS quotas{};
+        NTSTATUS ret = CallLsaLogonUser(m_lsa, authPkg, authInfo, &profileBuffer, &profileBufferLen, &result.LogonId, &result.Token, &quotas, &result.SubStatus);
+        if (profileBuffer) {
+            if (keepProfile) {
+                result.Profile.assign((BYTE*)profileBuffer, (BYTE*)profileBuffer + profileBufferLen);
+                result.ProfileBase = (BYTE*)profileBuffer; // pointers still refer to the LSA-allocated copy
+            }
+            LsaFreeReturnBuffer(profileBuffer);
+        }
+        return ret;
+    }
+
+private:
+    LsaHandle m_lsa;
+};
+
+
+/** In-process stand-in for LSA with log-normal logon latency.
+    Returns a duplicate of the current process token and a profile buffer built from the submit buffer. */
+class MockBackend : public LogonBackend {
+public:
+    MockBackend(double medianMs, unsigned seed) : m_medianMs(medianMs), m_random(seed) {
+    }
+
+    NTSTATUS LookupPackage(const wchar_t* /*authPkgName*/, ULONG* authPkg) override {
+        *authPkg = 0;
+        return STATUS_SUCCESS;
+    }
+
+    NTSTATUS Logon(ULONG /*authPkg*/, std::span<const BYTE> authInfo, bool keepProfile, LogonResult& result) override {
+        std::lognormal_distribution<double> latency(std::log(m_medianMs), 0.5);
+        std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(latency(m_random)));
+
+        std::vector<BYTE> submitBuffer(authInfo.begin(), authInfo.end()); // unpacked in-place
+        MSV1_0_INTERACTIVE_LOGON* logon = UnpackInteractiveLogon(submitBuffer.data(), (ULONG)submitBuffer.size());
+        if (!logon)
+            return STATUS_INVALID_PARAMETER;
+
+        if (!OpenProcessToken(GetCurrentProcess(), TOKEN_QUERY | TOKEN_DUPLICATE, &result.Token))
+            return STATUS_ACCESS_DENIED;
+        AllocateLocallyUniqueId(&result.LogonId);
+
+        if (keepProfile) {
+            InteractiveProfileLayout::Strings strings = { ToView(logon->UserName), L"MOCK" };
+            result.Profile.assign(InteractiveProfileLayout::Size(strings), (BYTE)0);
+            auto* profile = InteractiveProfileLayout::Pack(result.Profile.data(), strings, /*base*/nullptr);
+            profile->MessageType = MsV1_0InteractiveProfile;
+        }
+        return STATUS_SUCCESS;
+    }
+
+private:
+    double       m_medianMs = 1.0;
+    std::mt19937 m_random;
+};
+
+
+/** Select LSA or mock backend. A positive "mockMedianMs" selects the mock. */
+inline BackendFactory MakeBackendFactory(double mockMedianMs) {
+    if (mockMedianMs <= 0)
+        return []() -> std::unique_ptr<LogonBackend> { return std::make_unique<LsaBackend>(); };
+
+    auto seed = std::make_shared<std::atomic<unsigned>>(1);
+    return [mockMedianMs, seed]() -> std::unique_ptr<LogonBackend> { return std::make_unique<MockBackend>(mockMedianMs, (*seed)++); };
+}
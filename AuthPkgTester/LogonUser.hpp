@@ -13,8 +13,10 @@
 #include <sddl.h>
 #include <cassert>
 #include <iostream>
+#include <span>
 #include <tuple>
 #include "PrintInfo.hpp"
+#include "Profiler.hpp"
 #include "TokenUtils.hpp"
 #include "MSV1_0Utils.hpp"
 
@@ -29,11 +31,8 @@
 
 /** Converts unicode string to ASCII */
 inline std::string ToAscii(const std::wstring& w_str) {
-    std::string s_str(w_str.size(), '\0');
-    size_t charsConverted = 0;
-    auto err = wcstombs_s(&charsConverted, s_str.data(), s_str.size() + 1, w_str.c_str(), s_str.size());
-    assert(!err); (void)err; // mute unreferenced variable warning
-    return s_str;
+    assert(Utf16::IsAscii(w_str));
+    return Utf16::ToUtf8(w_str);
 }
 
 
@@ -59,7 +58,44 @@ NTSTATUS GetAuthPackage(HANDLE lsa, const wchar_t* name, /*out*/ULONG* authPkg)
 }
 
 
-DWORD CreateCmdProcessWithTokenW(HANDLE token, const std::wstring& username, PSID logonSid) {
+/** Call "pack" with an instance of the submit buffer layout expected by "authPkgName". */
+template <class FUNC>
+auto WithSubmitLayout(const std::wstring& authPkgName, FUNC pack) {
+    if ((authPkgName == MICROSOFT_KERBEROS_NAME_W) || (authPkgName == NEGOSSP_NAME_W))
+        return pack(KerbInteractiveLogonLayout{});
+    if (authPkgName == L"NoPasswordAuthPkg")
+        return pack(NoPasswordLogonLayout{});
+
+    return pack(InteractiveLogonLayout{}); // MSV1_0 and subauthentication packages
+}
+
+/** Prepare LsaLogonUser submit buffer in the format expected by "authPkgName". */
+std::vector<BYTE> PrepareLogon(const std::wstring& authPkgName, const std::wstring& domain, const std::wstring& username, const std::wstring& password) {
+    return WithSubmitLayout(authPkgName, [&](auto layout) {
+        return PackSubmitBuffer<decltype(layout)>({ domain, username, password });
+    });
+}
+
+/** Arena bytes needed by PrepareLogon for "authPkgName", to size an arena for a batch of accounts. */
+size_t SubmitBufferFootprint(const std::wstring& authPkgName, std::wstring_view domain, std::wstring_view username, std::wstring_view password) {
+    return WithSubmitLayout(authPkgName, [&](auto layout) {
+        return SubmitBufferArena::Footprint<decltype(layout)>({ domain, username, password });
+    });
+}
+
+/** Prepare LsaLogonUser submit buffer for "authPkgName" in "arena".
+    Returns an empty span if the arena is full or a field is too long for a UNICODE_STRING. */
+std::span<const BYTE> PrepareLogon(SubmitBufferArena& arena, const std::wstring& authPkgName, std::wstring_view domain, std::wstring_view username, std::wstring_view password) {
+    return WithSubmitLayout(authPkgName, [&](auto layout) {
+        ULONG size = 0;
+        auto* header = arena.Pack<decltype(layout)>({ domain, username, password }, &size);
+        return std::span<const BYTE>((const BYTE*)header, header ? size : 0);
+    });
+}
+
+/** Start cmd.exe through the logged-in user and wait for it to terminate.
+    cmd.exe exits immediately if "profiler" is set, so that repeated runs can be timed. */
+DWORD CreateCmdProcessWithTokenW(HANDLE token, const std::wstring& username, PSID logonSid, PhaseProfiler* profiler = nullptr) {
     wprintf(L"\n");
     wprintf(L"Attempting to start cmd.exe through the logged-in user...\n");
 
@@ -80,7 +116,10 @@ DWORD CreateCmdProcessWithTokenW(HANDLE token, const std::wstring& username, PSI
 #endif
     }
 
-    GrantWindowStationDesktopAccess(logonSid);
+    {
+        PhaseProfiler::Scope scope(profiler, L"GrantWindowStationDesktopAccess");
+        GrantWindowStationDesktopAccess(logonSid);
+    }
 
     STARTUPINFOW si = {
         .cb = sizeof(si),
@@ -94,6 +133,8 @@ DWORD CreateCmdProcessWithTokenW(HANDLE token, const std::wstring& username, PSI
     PROCESS_INFORMATION pi = {};
 
     std::wstring cmdLine = L"C:\\Windows\\System32\\cmd.exe";
+    if (profiler)
+        cmdLine += L" /c exit";
     const wchar_t* appName = cmdLine.c_str();
     DWORD creationFlags = CREATE_DEFAULT_ERROR_MODE | CREATE_NEW_PROCESS_GROUP;
 #ifdef START_SEPARATE_WINDOW
@@ -104,15 +145,23 @@ DWORD CreateCmdProcessWithTokenW(HANDLE token, const std::wstring& username, PSI
     const wchar_t* curDir = L"C:\\";
     DWORD logonFlags = LOGON_WITH_PROFILE; // confirmed to populate HKEY_CURRENT_USER
     // CreateProcessWithTokenW require SE_IMPERSONATE_NAME privilege
-    BOOL ok = CreateProcessWithTokenW(token, logonFlags, appName, cmdLine.data(), creationFlags, /*env*/nullptr, curDir, &si, &pi);
+    BOOL ok = FALSE;
+    {
+        PhaseProfiler::Scope scope(profiler, L"CreateProcessWithTokenW");
+        ok = CreateProcessWithTokenW(token, logonFlags, appName, cmdLine.data(), creationFlags, /*env*/nullptr, curDir, &si, &pi);
+    }
     if (!ok) {
         DWORD err = GetLastError();
         wprintf(L"ERROR: Unable to start cmd.exe through the logged in user (%s).\n", ToString(err).c_str());
+        RevokeWindowStationDesktopAccess(logonSid);
         return err;
     }
 
     wprintf(L"Waiting for process to terminate...\n");
-    WaitForSingleObject(pi.hProcess, INFINITE);
+    {
+        PhaseProfiler::Scope scope(profiler, L"Process lifetime");
+        WaitForSingleObject(pi.hProcess, INFINITE);
+    }
 
     DWORD exitCode = 0;
     ok = GetExitCodeProcess(pi.hProcess, &exitCode);
@@ -121,11 +170,37 @@ DWORD CreateCmdProcessWithTokenW(HANDLE token, const std::wstring& username, PSI
     CloseHandle(pi.hProcess);
     CloseHandle(pi.hThread);
 
+    {
+        PhaseProfiler::Scope scope(profiler, L"RevokeWindowStationDesktopAccess");
+        RevokeWindowStationDesktopAccess(logonSid);
+    }
+
     return exitCode;
 }
 
 
-NTSTATUS LsaLogonUserInteractive(HANDLE lsa, const wchar_t* authPkgName, const std::vector<BYTE>& authInfo, const std::wstring& username, const std::wstring& password) {
+/** Interactive LsaLogonUser call with an "AuthPkgTester" origin. */
+NTSTATUS CallLsaLogonUser(HANDLE lsa, ULONG authPkg, std::span<const BYTE> authInfo, void** profileBuffer, ULONG* profileBufferLen, LUID* logonId, HANDLE* token, QUOTA_LIMITS* quotas, NTSTATUS* subStatus) {
+    const char ORIGIN[] = "AuthPkgTester"; // "Advapi32 Logon";
+    LSA_STRING origin{
+        .Length = (USHORT)strlen(ORIGIN),
+        .MaximumLength = (USHORT)strlen(ORIGIN),
+        .Buffer = (char*)ORIGIN,
+    };
+
+    TOKEN_SOURCE sourceContext{
+        .SourceName = "APtest",
+        .SourceIdentifier{},
+    };
+    AllocateLocallyUniqueId(&sourceContext.SourceIdentifier);
+
+    // "LocalGroups" argument not set because it require SeTcbPrivilege
+    return LsaLogonUser(lsa, &origin, SECURITY_LOGON_TYPE::Interactive, authPkg, (void*)authInfo.data(), (ULONG)authInfo.size(), /*LocalGroups*/nullptr, &sourceContext, profileBuffer, profileBufferLen, logonId, token, quotas, subStatus);
+}
+
+
+/** Log on and start cmd.exe through the user. Per-phase timings are added to "profiler" if set. */
+NTSTATUS LsaLogonUserInteractive(HANDLE lsa, const wchar_t* authPkgName, const std::vector<BYTE>& authInfo, const std::wstring& username, const std::wstring& password, PhaseProfiler* profiler = nullptr) {
     //wprintf(L"INFO: AuthenticationInformationLength: %u\n", (uint32_t)authInfo.size());
 
     // output arguments
@@ -146,7 +221,11 @@ NTSTATUS LsaLogonUserInteractive(HANDLE lsa, const wchar_t* authPkgName, const s
         wchar_t* domain = nullptr;
         DWORD logonProvider = LOGON32_PROVIDER_DEFAULT; // default logon (seem to work better for local accounts)
 #endif
-        BOOL ok = LogonUserExW(username.c_str(), domain, password.c_str(), SECURITY_LOGON_TYPE::Interactive, logonProvider, &token, &logonSid, &profileBuffer, &profileBufferLen, &quotas);
+        BOOL ok = FALSE;
+        {
+            PhaseProfiler::Scope scope(profiler, L"LogonUserExW");
+            ok = LogonUserExW(username.c_str(), domain, password.c_str(), SECURITY_LOGON_TYPE::Interactive, logonProvider, &token, &logonSid, &profileBuffer, &profileBufferLen, &quotas);
+        }
         if (!ok) {
             DWORD err = GetLastError();
             wprintf(L"LogonUserExW failed (%s)\n", ToString(err).c_str());
@@ -156,34 +235,29 @@ NTSTATUS LsaLogonUserInteractive(HANDLE lsa, const wchar_t* authPkgName, const s
     }
 #else
     {
-        const char ORIGIN[] = "AuthPkgTester"; // "Advapi32 Logon";
-        LSA_STRING origin{
-            .Length = (USHORT)strlen(ORIGIN),
-            .MaximumLength = (USHORT)strlen(ORIGIN),
-            .Buffer = (char*)ORIGIN,
-        };
-
         ULONG authPkg = 0;
-        NTSTATUS status = GetAuthPackage(lsa, authPkgName, &authPkg);
+        NTSTATUS status = STATUS_SUCCESS;
+        {
+            PhaseProfiler::Scope scope(profiler, L"GetAuthPackage");
+            status = GetAuthPackage(lsa, authPkgName, &authPkg);
+        }
         if (status != STATUS_SUCCESS)
             return status;
 
-        TOKEN_SOURCE sourceContext{
-            .SourceName = "APtest",
-            .SourceIdentifier{},
-        };
-        AllocateLocallyUniqueId(&sourceContext.SourceIdentifier);
-
         NTSTATUS subStatus = 0;
         LUID logonId{};
-        // "LocalGroups" argument not set because it require SeTcbPrivilege
-        NTSTATUS ret = LsaLogonUser(lsa, &origin, SECURITY_LOGON_TYPE::Interactive, authPkg, (void*)authInfo.data(), (ULONG)authInfo.size(), /*LocalGroups*/nullptr, &sourceContext, &profileBuffer, &profileBufferLen, &logonId, &token, &quotas, &subStatus);
+        NTSTATUS ret = STATUS_SUCCESS;
+        {
+            PhaseProfiler::Scope scope(profiler, L"LsaLogonUser");
+            ret = CallLsaLogonUser(lsa, authPkg, authInfo, &profileBuffer, &profileBufferLen, &logonId, &token, &quotas, &subStatus);
+        }
         if (ret != STATUS_SUCCESS) {
             wprintf(L"LsaLogonUser failed (%s)\n", ToString(ret).c_str());
             abort();
         }
         wprintf(L"SUCCESS: LsaLogonUser succeeded.\n");
 
+        PhaseProfiler::Scope scope(profiler, L"GetLogonSID");
         logonSid = GetLogonSID(token);
     }
 #endif
@@ -203,8 +277,9 @@ NTSTATUS LsaLogonUserInteractive(HANDLE lsa, const wchar_t* authPkgName, const s
         Print(*profile);
     }
 
-    DWORD ret = CreateCmdProcessWithTokenW(token, username, logonSid);
+    DWORD ret = CreateCmdProcessWithTokenW(token, username, logonSid, profiler);
 
+    PhaseProfiler::Scope scope(profiler, L"Cleanup");
     LsaFreeReturnBuffer(profileBuffer);
     CloseHandle(token);
     FreeSid(logonSid);
@@ -1,31 +1,126 @@
-#include "LogonUser.hpp"
+#include "CompareTest.hpp"
+#include "LoadTest.hpp"
+#include "Manifest.hpp"
+#include "SoakTest.hpp"
 
 
-class LsaHandle {
-public:
-    LsaHandle() {
-        // establish LSA connection
-        NTSTATUS status = LsaConnectUntrusted(&m_lsa);
-        assert(status == STATUS_SUCCESS);
-    }
-    ~LsaHandle() {
-        // close LSA handle
-        NTSTATUS status = LsaDeregisterLogonProcess(m_lsa);
-        assert(status == STATUS_SUCCESS);
-    }
+int wmain(int argc, wchar_t* argv[]) {
+    // separate "--option [value]" arguments from positional arguments
+    std::vector<std::wstring> args;
+    bool loadMode = false;
+    LoadOptions load;
+    double mockMedianMs = 0; // use LSA unless set
+    unsigned profileRuns = 0; // per-phase timing runs
+    unsigned compareRuns = 0; // logons per package in comparison mode
+    std::wstring manifestPath; // accounts to log on in manifest mode
+    std::wstring reportPath;   // manifest report, stdout if empty
+    bool soakMode = false;
+    SoakOptions soak;
+    double mockLeakBytes = 0; // simulated lsass leak per logon
+    double mockLeakHandles = 0;
+    double mockLeakSessions = 0;
+    bool soakSelfTest = false;
+    for (int i = 1; i < argc; i++) {
+        std::wstring arg = argv[i];
+        auto value = [&]() -> const wchar_t* {
+            return (i + 1 < argc) ? argv[++i] : L"";
+        };
 
-    operator HANDLE() {
-        return m_lsa;
+        if (arg == L"--load") {
+            loadMode = true;
+        } else if (arg == L"--threads") {
+            load.Threads = std::max<int>(1, _wtoi(value()));
+        } else if (arg == L"--duration") {
+            load.DurationSec = _wtof(value());
+        } else if (arg == L"--count") {
+            load.Count = (unsigned)_wtoi(value());
+        } else if (arg == L"--format") {
+            load.Format = (std::wstring(value()) == L"csv") ? ReportFormat::Csv : ReportFormat::Json;
+        } else if (arg == L"--profile") {
+            profileRuns = std::max<int>(1, _wtoi(value()));
+        } else if (arg == L"--compare") {
+            compareRuns = std::max<int>(1, _wtoi(value()));
+        } else if (arg == L"--manifest") {
+            manifestPath = value();
+        } else if (arg == L"--report") {
+            reportPath = value();
+        } else if (arg == L"--soak") {
+            soakMode = true;
+            soak.Hours = _wtof(value());
+        } else if (arg == L"--rate") {
+            soak.RatePerSec = std::max<double>(0.01, _wtof(value()));
+        } else if (arg == L"--interval") {
+            soak.SampleIntervalSec = _wtof(value());
+        } else if (arg == L"--max-growth") {
+            soak.MaxBytesPerLogon = _wtof(value());
+        } else if (arg == L"--mock-leak") {
+            mockLeakBytes = _wtof(value());
+        } else if (arg == L"--mock-leak-handles") {
+            mockLeakHandles = _wtof(value());
+        } else if (arg == L"--mock-leak-sessions") {
+            mockLeakSessions = _wtof(value());
+        } else if (arg == L"--soak-selftest") {
+            soakSelfTest = true;
+        } else if (arg == L"--mock") {
+            mockMedianMs = _wtof(value());
+        } else {
+            args.push_back(arg);
+        }
     }
-private:
-    HANDLE m_lsa = 0;
-};
 
-
-int wmain(int argc, wchar_t* argv[]) {
     LsaHandle lsa;
 
-    if (argc == 1) {
+    if (soakSelfTest) {
+        return RunSoakSelfTest();
+    } else if (loadMode && (args.size() >= 2)) {
+        size_t argIdx = 0;
+        const wchar_t* authPkgName = (args.size() >= 3) ? args[argIdx++].c_str() : MSV1_0_PACKAGE_NAMEW;
+        std::wstring username = args[argIdx++];
+        std::wstring password = args[argIdx++];
+
+        std::vector<BYTE> authInfo = PrepareLogon(authPkgName, L"", username, password);
+        return RunLoadTest(MakeBackendFactory(mockMedianMs), authPkgName, authInfo, load);
+    } else if (soakMode && (args.size() >= 2)) {
+        size_t argIdx = 0;
+        const wchar_t* authPkgName = (args.size() >= 3) ? args[argIdx++].c_str() : MSV1_0_PACKAGE_NAMEW;
+        std::wstring username = args[argIdx++];
+        std::wstring password = args[argIdx++];
+
+        std::vector<BYTE> authInfo = PrepareLogon(authPkgName, L"", username, password);
+        std::unique_ptr<ResourceSampler> sampler;
+        if (mockMedianMs > 0)
+            sampler = std::make_unique<MockSampler>(mockLeakBytes, mockLeakHandles, mockLeakSessions);
+        else
+            sampler = std::make_unique<LsassSampler>();
+        return RunSoakTest(MakeBackendFactory(mockMedianMs), *sampler, authPkgName, authInfo, soak);
+    } else if (!manifestPath.empty()) {
+        const wchar_t* authPkgName = !args.empty() ? args[0].c_str() : MSV1_0_PACKAGE_NAMEW;
+        std::vector<ManifestAccount> accounts;
+        if (!ReadManifest(manifestPath, authPkgName, accounts)) {
+            wprintf(L"ERROR: Unable to read %s\n", manifestPath.c_str());
+            return -1;
+        }
+
+        FILE* report = stdout;
+        if (!reportPath.empty() && (_wfopen_s(&report, reportPath.c_str(), L"w") != 0)) {
+            wprintf(L"ERROR: Unable to create %s\n", reportPath.c_str());
+            return -1;
+        }
+        int ret = RunManifest(MakeBackendFactory(mockMedianMs), accounts, report);
+        if (report != stdout)
+            fclose(report);
+        return ret;
+    } else if (compareRuns && (args.size() >= 4)) {
+        const wchar_t* authPkgNames[2] = { args[0].c_str(), args[1].c_str() };
+        const std::wstring& username = args[2];
+        const std::wstring& password = args[3];
+
+        std::vector<BYTE> authInfos[2] = {
+            PrepareLogon(authPkgNames[0], L"", username, password),
+            PrepareLogon(authPkgNames[1], L"", username, password),
+        };
+        return RunCompareTest(MakeBackendFactory(mockMedianMs), authPkgNames, authInfos, compareRuns);
+    } else if (args.empty()) {
         // query installed security packages
         {
             // NOTE: EnumerateSecurityPackages doesn't seem to detect MSV1_0
@@ -60,34 +155,41 @@ int wmain(int argc, wchar_t* argv[]) {
             if (GetAuthPackage(lsa, package, &authPkg) == STATUS_SUCCESS)
                 wprintf(L"  AuthPkgID: %u\n", authPkg);
         }
-    } else if (argc >= 3) {
-        size_t argIdx = 1;
+    } else if (args.size() >= 2) {
+        size_t argIdx = 0;
         const wchar_t* authPkgName = MSV1_0_PACKAGE_NAMEW; // default to MSV1_0
-        if (argc >= 4)
-            authPkgName = argv[argIdx++];
+        if (args.size() >= 3)
+            authPkgName = args[argIdx++].c_str();
 
         // try to login with username & password
         std::wstring domain = L"";
-        std::wstring username = argv[argIdx++];
-        std::wstring password = argv[argIdx++];
+        std::wstring username = args[argIdx++];
+        std::wstring password = args[argIdx++];
 
         wprintf(L"\n");
         wprintf(L"Attempting local interactive logon against the %s authentication package...\n", authPkgName);
-        std::vector<BYTE> authInfo;
-        if (std::wstring(authPkgName) == MSV1_0_PACKAGE_NAMEW)
-            authInfo = PrepareLogon_MSV1_0(domain, username, password);
-        else
-            authInfo = PrepareLogon_MSV1_0(domain, username, password); // TODO: Replace with suitable authInfo for the selected authPkg
+        std::vector<BYTE> authInfo = PrepareLogon(authPkgName, domain, username, password);
 
-        NTSTATUS ret = LsaLogonUserInteractive(lsa, authPkgName, authInfo, username, password);
-        if (ret != STATUS_SUCCESS) {
-            wprintf(L"ERROR: LsaLogonUser failed (%s)\n", ToString(ret).c_str());
-        } else {
-            wprintf(L"SUCCESS: User logon succeeded.\n");
+        PhaseProfiler profiler;
+        for (unsigned run = 0; run < std::max<unsigned>(1, profileRuns); run++) {
+            NTSTATUS ret = LsaLogonUserInteractive(lsa, authPkgName, authInfo, username, password, profileRuns ? &profiler : nullptr);
+            if (ret != STATUS_SUCCESS) {
+                wprintf(L"ERROR: LsaLogonUser failed (%s)\n", ToString(ret).c_str());
+                break;
+            } else {
+                wprintf(L"SUCCESS: User logon succeeded.\n");
+            }
         }
+        if (profileRuns)
+            profiler.Print();
     } else {
         wprintf(L"USAGE:\n");
         wprintf(L"  List security packages: AuthPkgTester.exe\n");
-        wprintf(L"  Attempt MSV1_0 login: AuthPkgTester.exe [auth-package] <username> <password>\n");
+        wprintf(L"  Attempt MSV1_0 login: AuthPkgTester.exe [--profile runs] [auth-package] <username> <password>\n");
+        wprintf(L"  Compare packages: AuthPkgTester.exe --compare runs [--mock median-ms] <package-a> <package-b> <username> <password>\n");
+        wprintf(L"  Soak test: AuthPkgTester.exe --soak hours [--rate logons/s] [--interval sec] [--max-growth bytes-per-logon] [--mock median-ms [--mock-leak bytes-per-logon] [--mock-leak-handles per-logon] [--mock-leak-sessions per-logon]] [auth-package] <username> <password>\n");
+        wprintf(L"  Soak trend analysis self-test: AuthPkgTester.exe --soak-selftest\n");
+        wprintf(L"  Log on accounts from file: AuthPkgTester.exe --manifest <file> [--report <file>] [--mock median-ms] [auth-package]\n");
+        wprintf(L"  Logon load test: AuthPkgTester.exe --load [--threads N] [--duration sec | --count N] [--format json|csv] [--mock median-ms] [auth-package] <username> <password>\n");
     }
 }
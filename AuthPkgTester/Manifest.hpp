@@ -0,0 +1,208 @@
+#pragma once
+#include <fstream>
+#include <future>
+#include <map>
+#include "LogonBackend.hpp"
+#include "Stats.hpp"
+
+
+/** Account to log on in manifest mode. */
+struct ManifestAccount {
+    std::wstring Package;
+    std::wstring Domain;   // empty for local accounts
+    std::wstring Username;
+    std::wstring Password;
+};
+
+inline std::wstring FromUtf8(std::string_view str) {
+    if (str.empty())
+        return L"";
+    int len = MultiByteToWideChar(CP_UTF8, 0, str.data(), (int)str.size(), nullptr, 0);
+    std::wstring result(len, L'\0');
+    MultiByteToWideChar(CP_UTF8, 0, str.data(), (int)str.size(), result.data(), len);
+    return result;
+}
+
+/** Overwrite all characters of "str", including unused capacity, e.g. before releasing a password. */
+template <class Char>
+inline void SecureClear(std::basic_string<Char>& str) {
+    str.resize(str.capacity());
+    SecureZeroMemory(str.data(), str.size() * sizeof(Char));
+    str.clear();
+}
+
+/** Quote a CSV field if it contains a separator, quote or line break (RFC 4180). */
+inline std::wstring CsvField(const std::wstring& str) {
+    if (str.find_first_of(L",\"\r\n") == std::wstring::npos)
+        return str;
+    std::wstring result = L"\"";
+    for (wchar_t c : str) {
+        if (c == L'"')
+            result += L'"';
+        result += c;
+    }
+    return result + L"\"";
+}
+
+/** Parse UTF-8 manifest with one "[DOMAIN\]username<TAB>password[<TAB>package]" line per account.
+    Empty lines and lines starting with '#' are skipped. Returns false if the file cannot be read.
+    Temporary copies of the passwords are scrubbed before returning. */
+inline bool ReadManifest(const std::wstring& path, const wchar_t* defaultPackage, std::vector<ManifestAccount>& accounts) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+
+    std::string line;
+    line.reserve(1024); // avoid reallocations that would leave unscrubbed copies behind
+    std::vector<std::wstring> fields;
+    fields.reserve(3);
+    while (std::getline(file, line)) {
+        if (!line.empty() && (line.back() == '\r'))
+            line.pop_back();
+        if (line.empty() || (line[0] == '#'))
+            continue;
+
+        for (std::wstring& field : fields)
+            SecureClear(field);
+        fields.clear();
+        std::string_view view = line;
+        size_t start = 0;
+        for (size_t tab = view.find('\t'); tab != std::string_view::npos; tab = view.find('\t', start)) {
+            fields.push_back(FromUtf8(view.substr(start, tab - start)));
+            start = tab + 1;
+        }
+        fields.push_back(FromUtf8(view.substr(start)));
+
+        ManifestAccount account;
+        account.Username = fields[0];
+        account.Password = (fields.size() > 1) ? fields[1] : L"";
+        account.Package = (fields.size() > 2) ? fields[2] : defaultPackage;
+        size_t separator = account.Username.find(L'\\');
+        if (separator != std::wstring::npos) {
+            account.Domain = account.Username.substr(0, separator);
+            account.Username.erase(0, separator + 1);
+        }
+        if (accounts.size() == accounts.capacity()) {
+            // grow manually, so that passwords left in the old storage can be scrubbed
+            std::vector<ManifestAccount> grown;
+            grown.reserve(std::max<size_t>(64, 2 * accounts.capacity()));
+            for (ManifestAccount& old : accounts) {
+                grown.push_back(std::move(old));
+                SecureClear(old.Password);
+            }
+            accounts.swap(grown);
+        }
+        accounts.push_back(std::move(account));
+        SecureClear(account.Password);
+    }
+
+    for (std::wstring& field : fields)
+        SecureClear(field);
+    SecureClear(line);
+    return true;
+}
+
+
+/** Log on every account in "accounts" through one backend and write one CSV line per account to "report".
+    Submit buffers are packed in batches on a background thread while the previous batch is being logged on.
+    Returns non-zero if any logon failed. */
+int RunManifest(const BackendFactory& factory, std::vector<ManifestAccount>& accounts, FILE* report) {
+    using namespace std::chrono;
+
+    std::unique_ptr<LogonBackend> backend = factory(); // one LSA connection for all logons
+
+    // resolve each package once
+    std::map<std::wstring, ULONG> packageIds;
+    std::map<std::wstring, NTSTATUS> packageErrors;
+    for (const ManifestAccount& account : accounts) {
+        if (packageIds.contains(account.Package) || packageErrors.contains(account.Package))
+            continue;
+        ULONG authPkg = 0;
+        NTSTATUS status = backend->LookupPackage(account.Package.c_str(), &authPkg);
+        if (status == STATUS_SUCCESS)
+            packageIds[account.Package] = authPkg;
+        else
+            packageErrors[account.Package] = status;
+    }
+
+    // double-buffered submit buffer arenas, so that packing the next batch overlaps with logons
+    constexpr size_t BATCH_SIZE = 256;
+    std::vector<void*> arenaBuffers[2]; // pointer aligned, grown to fit the largest batch
+
+    struct Batch {
+        size_t Begin = 0;
+        std::vector<std::span<const BYTE>> Buffers; // empty span if not packed
+    };
+    auto prepare = [&](size_t begin) {
+        Batch batch;
+        batch.Begin = begin;
+        size_t end = std::min<size_t>(begin + BATCH_SIZE, accounts.size());
+
+        // size the arena for this batch, so that long names elsewhere in the batch can't crowd out short ones
+        size_t arenaSize = 0;
+        for (size_t i = begin; i < end; i++) {
+            const ManifestAccount& a = accounts[i];
+            arenaSize += SubmitBufferFootprint(a.Package, a.Domain, a.Username, a.Password);
+        }
+        std::vector<void*>& buffer = arenaBuffers[(begin / BATCH_SIZE) % 2];
+        if (arenaSize > buffer.size() * sizeof(void*)) {
+            SecureZeroMemory(buffer.data(), buffer.size() * sizeof(void*)); // don't leave passwords behind in released memory
+            buffer = std::vector<void*>(arenaSize / sizeof(void*));
+        }
+
+        SubmitBufferArena arena((BYTE*)buffer.data(), buffer.size() * sizeof(void*));
+        for (size_t i = begin; i < end; i++) {
+            const ManifestAccount& a = accounts[i];
+            batch.Buffers.push_back(PrepareLogon(arena, a.Package, a.Domain, a.Username, a.Password));
+        }
+        return batch;
+    };
+
+    fwprintf(report, L"account,package,status,substatus,ms\n");
+    std::vector<double> latencies;
+    unsigned failures = 0;
+
+    std::future<Batch> next = std::async(std::launch::async, prepare, 0);
+    for (size_t begin = 0; begin < accounts.size(); begin += BATCH_SIZE) {
+        Batch batch = next.get();
+        if (begin + BATCH_SIZE < accounts.size())
+            next = std::async(std::launch::async, prepare, begin + BATCH_SIZE);
+
+        for (size_t i = 0; i < batch.Buffers.size(); i++) {
+            const ManifestAccount& account = accounts[batch.Begin + i];
+            NTSTATUS ret = STATUS_SUCCESS;
+            LogonResult result;
+            double ms = 0;
+
+            auto pkg = packageIds.find(account.Package);
+            if (pkg == packageIds.end()) {
+                ret = packageErrors[account.Package];
+            } else if (batch.Buffers[i].empty()) {
+                ret = STATUS_NAME_TOO_LONG; // a field exceeds the UNICODE_STRING limit
+            } else {
+                auto before = steady_clock::now();
+                ret = backend->Logon(pkg->second, batch.Buffers[i], /*keepProfile*/false, result);
+                ms = duration<double, std::milli>(steady_clock::now() - before).count();
+            }
+
+            if (ret == STATUS_SUCCESS)
+                latencies.push_back(ms);
+            else
+                failures++;
+
+            std::wstring name = account.Domain.empty() ? account.Username : account.Domain + L"\\" + account.Username;
+            fwprintf(report, L"%s,%s,0x%08x,0x%08x,%.3f\n", CsvField(name).c_str(), CsvField(account.Package).c_str(), ret, result.SubStatus, ms);
+        }
+    }
+
+    // don't leave passwords behind in memory
+    for (std::vector<void*>& buffer : arenaBuffers)
+        SecureZeroMemory(buffer.data(), buffer.size() * sizeof(void*));
+    for (ManifestAccount& account : accounts)
+        SecureClear(account.Password);
+
+    Summary latency = Summarize(latencies);
+    fwprintf(stderr, L"%zu accounts: %zu succeeded, %u failed. Latency [ms] p50 %.3f, p99 %.3f, max %.3f\n",
+        accounts.size(), latency.Count, failures, latency.P50, latency.P99, latency.Max);
+    return (failures > 0) ? 1 : 0;
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <chrono>
+#include <string>
+#include <vector>
+#include "Stats.hpp"
+
+
+/** Collects high-resolution timings per phase across repeated runs. */
+class PhaseProfiler {
+public:
+    /** Times the enclosing scope. No-op if "profiler" is nullptr. */
+    class Scope {
+    public:
+        Scope(PhaseProfiler* profiler, const wchar_t* phase) : m_profiler(profiler), m_phase(phase), m_start(std::chrono::steady_clock::now()) {
+        }
+        ~Scope() {
+            if (m_profiler)
+                m_profiler->Record(m_phase, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_start).count());
+        }
+
+    private:
+        PhaseProfiler*                        m_profiler = nullptr;
+        const wchar_t*                        m_phase = nullptr;
+        std::chrono::steady_clock::time_point m_start;
+    };
+
+    void Record(const wchar_t* phase, double ms) {
+        for (auto& [name, samples] : m_phases) {
+            if (name == phase) {
+                samples.push_back(ms);
+                return;
+            }
+        }
+        m_phases.push_back({ phase, { ms } }); // keep phases in order of first occurrence
+    }
+
+    /** Print min/median/max table of all phases. */
+    void Print() const {
+        wprintf(L"\n");
+        wprintf(L"%-36s %6s %10s %10s %10s\n", L"Phase", L"runs", L"min[ms]", L"median[ms]", L"max[ms]");
+        for (const auto& [name, samples] : m_phases) {
+            Summary s = Summarize(samples);
+            wprintf(L"%-36s %6zu %10.3f %10.3f %10.3f\n", name.c_str(), s.Count, s.Min, s.P50, s.Max);
+        }
+    }
+
+private:
+    std::vector<std::pair<std::wstring, std::vector<double>>> m_phases;
+};
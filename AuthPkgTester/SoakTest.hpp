@@ -0,0 +1,298 @@
+#pragma once
+#include <Psapi.h>    // for GetProcessMemoryInfo
+#include <TlHelp32.h> // for CreateToolhelp32Snapshot
+#include "LogonBackend.hpp"
+#include "Stats.hpp"
+
+
+struct SoakOptions {
+    double Hours = 1;
+    double RatePerSec = 10;          // logons per second
+    double SampleIntervalSec = 60;
+    double WarmupFraction = 0.1;     // initial fraction of samples excluded from the trend, e.g. cache fill
+    double MaxBytesPerLogon = 64;    // lsass private bytes
+    double MaxHandlesPerLogon = 0.01;
+    double MaxSessionsPerLogon = 0.01;
+    double MinR2 = 0.5;              // ignore slopes that don't explain the samples, e.g. heap fluctuations
+};
+
+/** LSA resource usage at a point in time. */
+struct ResourceSample {
+    double ElapsedSec = 0;
+    size_t Logons = 0;       // logons attempted so far
+    double PrivateBytes = 0;
+    double Handles = 0;
+    double Sessions = 0;     // logon sessions
+};
+
+/** Source of LSA resource usage. Swappable for a mock, so that the trend analysis can be exercised without lsass. */
+class ResourceSampler {
+public:
+    virtual ~ResourceSampler() = default;
+
+    /** Fill in resource fields of "sample". "Logons" is already set by the caller. */
+    virtual bool Sample(ResourceSample& sample) = 0;
+};
+
+
+/** Sample lsass.exe through a limited-information process handle. Requires administrator privileges. */
+class LsassSampler : public ResourceSampler {
+public:
+    LsassSampler() {
+        HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
+        PROCESSENTRY32W entry{ .dwSize = sizeof(entry) };
+        for (BOOL ok = Process32FirstW(snapshot, &entry); ok; ok = Process32NextW(snapshot, &entry)) {
+            if (_wcsicmp(entry.szExeFile, L"lsass.exe") == 0) {
+                m_process = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, /*inherit*/false, entry.th32ProcessID);
+                break;
+            }
+        }
+        CloseHandle(snapshot);
+    }
+    ~LsassSampler() override {
+        if (m_process)
+            CloseHandle(m_process);
+    }
+
+    bool Sample(ResourceSample& sample) override {
+        if (!m_process)
+            return false;
+
+        PROCESS_MEMORY_COUNTERS_EX memory{};
+        if (!GetProcessMemoryInfo(m_process, (PROCESS_MEMORY_COUNTERS*)&memory, sizeof(memory)))
+            return false;
+        sample.PrivateBytes = (double)memory.PrivateUsage;
+
+        DWORD handles = 0;
+        if (!GetProcessHandleCount(m_process, &handles))
+            return false;
+        sample.Handles = handles;
+
+        ULONG sessionCount = 0;
+        LUID* sessions = nullptr;
+        if (LsaEnumerateLogonSessions(&sessionCount, &sessions) != STATUS_SUCCESS)
+            return false;
+        LsaFreeReturnBuffer(sessions);
+        sample.Sessions = sessionCount;
+        return true;
+    }
+
+private:
+    HANDLE m_process = nullptr;
+};
+
+
+/** Simulated lsass with fixed per-logon leaks on top of noisy baseline usage. */
+class MockSampler : public ResourceSampler {
+public:
+    MockSampler(double bytesPerLogon, double handlesPerLogon, double sessionsPerLogon, unsigned seed = 1)
+        : m_bytesPerLogon(bytesPerLogon), m_handlesPerLogon(handlesPerLogon), m_sessionsPerLogon(sessionsPerLogon), m_random(seed) {
+    }
+
+    bool Sample(ResourceSample& sample) override {
+        std::normal_distribution<double> heapNoise(0, 256 * 1024);
+        std::uniform_int_distribution<int> handleNoise(-20, 20);
+        sample.PrivateBytes = 40e6 + heapNoise(m_random) + m_bytesPerLogon * sample.Logons;
+        sample.Handles = std::floor(2000 + handleNoise(m_random) + m_handlesPerLogon * sample.Logons);
+        sample.Sessions = std::floor(12 + m_sessionsPerLogon * sample.Logons);
+        return true;
+    }
+
+private:
+    double       m_bytesPerLogon = 0;
+    double       m_handlesPerLogon = 0;
+    double       m_sessionsPerLogon = 0;
+    std::mt19937 m_random;
+};
+
+
+/** Per-logon growth of one resource. */
+struct GrowthTrend {
+    const wchar_t* Name = nullptr;
+    LinearFit      Fit;
+    double         Limit = 0;
+    bool           Exceeded = false; // slope above limit with a trend that explains the samples
+};
+
+/** Fit per-logon growth trends to samples after the warm-up phase. Returns false if there are too few samples to judge. */
+inline bool AnalyzeSoak(const std::vector<ResourceSample>& samples, const SoakOptions& options, std::vector<GrowthTrend>& trends) {
+    auto first = (size_t)(options.WarmupFraction * samples.size());
+    if (samples.size() < first + 3)
+        return false;
+
+    std::vector<double> logons, privateBytes, handles, sessions;
+    for (size_t i = first; i < samples.size(); i++) {
+        logons.push_back((double)samples[i].Logons);
+        privateBytes.push_back(samples[i].PrivateBytes);
+        handles.push_back(samples[i].Handles);
+        sessions.push_back(samples[i].Sessions);
+    }
+
+    trends = {
+        { .Name = L"private_bytes", .Fit = FitLine(logons, privateBytes), .Limit = options.MaxBytesPerLogon },
+        { .Name = L"handles", .Fit = FitLine(logons, handles), .Limit = options.MaxHandlesPerLogon },
+        { .Name = L"sessions", .Fit = FitLine(logons, sessions), .Limit = options.MaxSessionsPerLogon },
+    };
+    for (GrowthTrend& trend : trends)
+        trend.Exceeded = (trend.Fit.Slope > trend.Limit) && (trend.Fit.R2 >= options.MinR2);
+    return true;
+}
+
+
+/** Perform logons at a fixed rate for hours while sampling LSA resource usage.
+    Prints samples as CSV followed by per-logon growth trends. Returns non-zero if any trend exceeds its limit. */
+int RunSoakTest(const BackendFactory& factory, ResourceSampler& sampler, const wchar_t* authPkgName, std::span<const BYTE> authInfo, const SoakOptions& options) {
+    using namespace std::chrono;
+
+    std::unique_ptr<LogonBackend> backend = factory();
+    ULONG authPkg = 0;
+    if (backend->LookupPackage(authPkgName, &authPkg) != STATUS_SUCCESS)
+        return 1;
+
+    // fail now instead of after hours of logons without a single sample
+    ResourceSample probe;
+    if (!sampler.Sample(probe)) {
+        wprintf(L"ERROR: Unable to sample LSA resource usage. Sampling lsass.exe requires administrator privileges.\n");
+        return 1;
+    }
+
+    auto start = steady_clock::now();
+    auto end = start + duration_cast<steady_clock::duration>(duration<double>(options.Hours * 3600));
+    auto interval = duration_cast<steady_clock::duration>(duration<double>(options.SampleIntervalSec));
+    auto nextSample = start;
+
+    std::vector<ResourceSample> samples;
+    size_t logons = 0;
+    unsigned failures = 0;
+    NTSTATUS lastError = STATUS_SUCCESS;
+
+    auto takeSample = [&](steady_clock::time_point now) {
+        ResourceSample sample;
+        sample.ElapsedSec = duration<double>(now - start).count();
+        sample.Logons = logons;
+        if (!sampler.Sample(sample)) {
+            fwprintf(stderr, L"WARNING: Unable to sample LSA resource usage\n");
+            return;
+        }
+        wprintf(L"%.1f,%zu,%u,%.0f,%.0f,%.0f\n", sample.ElapsedSec, sample.Logons, failures, sample.PrivateBytes, sample.Handles, sample.Sessions);
+        fflush(stdout); // keep progress visible when redirected during multi-hour runs
+        samples.push_back(sample);
+    };
+
+    wprintf(L"elapsed_s,logons,failures,private_bytes,handles,sessions\n");
+    for (auto now = start; now < end; now = steady_clock::now()) {
+        if (now >= nextSample) {
+            takeSample(now);
+            nextSample += interval;
+        }
+
+        {
+            LogonResult result;
+            NTSTATUS ret = backend->Logon(authPkg, authInfo, /*keepProfile*/false, result);
+            if (ret != STATUS_SUCCESS) {
+                failures++;
+                lastError = ret;
+            }
+        } // token & logon session closed by LogonResult
+        logons++;
+
+        std::this_thread::sleep_until(start + duration_cast<steady_clock::duration>(duration<double>(logons / options.RatePerSec)));
+    }
+    takeSample(steady_clock::now());
+
+    if (failures > 0)
+        fwprintf(stderr, L"WARNING: %u logons failed (%s)\n", failures, ToString(lastError).c_str());
+
+    std::vector<GrowthTrend> trends;
+    if (!AnalyzeSoak(samples, options, trends)) {
+        wprintf(L"ERROR: Too few samples to fit growth trends. Increase the duration or reduce the sample interval.\n");
+        return 1;
+    }
+
+    int ret = 0;
+    wprintf(L"\n%-14s %14s %10s %14s\n", L"resource", L"per-logon", L"R2", L"limit");
+    for (const GrowthTrend& trend : trends) {
+        wprintf(L"%-14s %14.4f %10.3f %14.4f%s\n", trend.Name, trend.Fit.Slope, trend.Fit.R2, trend.Limit, trend.Exceeded ? L"  EXCEEDED" : L"");
+        if (trend.Exceeded)
+            ret = 1;
+    }
+    return ret;
+}
+
+
+/** Check the trend analysis against simulated leaks, and that a soak test without samples fails right away.
+    Returns non-zero if any check fails. */
+int RunSoakSelfTest() {
+    using namespace std::chrono;
+
+    unsigned failures = 0;
+    auto check = [&](const wchar_t* name, bool ok) {
+        wprintf(L"%-28s %s\n", name, ok ? L"OK" : L"FAILED");
+        if (!ok)
+            failures++;
+    };
+
+    SoakOptions options;
+    struct LeakCase {
+        const wchar_t* Name;
+        double         BytesPerLogon;
+        double         HandlesPerLogon;
+        double         SessionsPerLogon;
+        bool           Exceeded[3]; // private_bytes, handles, sessions
+    };
+    const LeakCase leakCases[] = {
+        { L"no leak",               0,    0,    0,    { false, false, false } },
+        { L"heap leak below limit", 32,   0,    0,    { false, false, false } },
+        { L"heap leak",             1024, 0,    0,    { true,  false, false } },
+        { L"handle leak",           0,    0.05, 0,    { false, true,  false } },
+        { L"session leak",          0,    0,    0.05, { false, false, true } },
+    };
+    for (const LeakCase& leak : leakCases) {
+        MockSampler sampler(leak.BytesPerLogon, leak.HandlesPerLogon, leak.SessionsPerLogon);
+        std::vector<ResourceSample> samples(100);
+        for (size_t i = 0; i < samples.size(); i++) {
+            samples[i].Logons = i * 1000; // ~3 hours at 10 logons/s
+            sampler.Sample(samples[i]);
+        }
+        std::vector<GrowthTrend> trends;
+        bool ok = AnalyzeSoak(samples, options, trends);
+        for (size_t t = 0; ok && (t < trends.size()); t++)
+            ok = (trends[t].Exceeded == leak.Exceeded[t]);
+        check(leak.Name, ok);
+    }
+
+    {
+        // growth that levels off during warm-up, e.g. cache fill, isn't a leak
+        std::vector<ResourceSample> samples(100);
+        for (size_t i = 0; i < samples.size(); i++) {
+            samples[i].Logons = i * 1000;
+            samples[i].PrivateBytes = 40e6 + std::min<size_t>(i, 5) * 1e6;
+            samples[i].Handles = 2000;
+            samples[i].Sessions = 12;
+        }
+        std::vector<GrowthTrend> trends;
+        bool ok = AnalyzeSoak(samples, options, trends);
+        for (const GrowthTrend& trend : trends)
+            ok = ok && !trend.Exceeded;
+        check(L"warm-up growth", ok);
+    }
+    {
+        std::vector<ResourceSample> samples(2);
+        std::vector<GrowthTrend> trends;
+        check(L"too few samples", !AnalyzeSoak(samples, options, trends));
+    }
+    {
+        class UnavailableSampler : public ResourceSampler {
+        public:
+            bool Sample(ResourceSample&) override {
+                return false;
+            }
+        } sampler;
+        auto before = steady_clock::now();
+        int ret = RunSoakTest(MakeBackendFactory(/*mockMedianMs*/1), sampler, L"mock", {}, options);
+        check(L"unavailable sampler", (ret != 0) && (steady_clock::now() - before < seconds(1)));
+    }
+
+    wprintf(L"%u check(s) failed\n", failures);
+    return (failures > 0) ? 1 : 0;
+}
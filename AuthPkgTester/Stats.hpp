@@ -0,0 +1,81 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+
+/** Order statistics of a set of samples. */
+struct Summary {
+    size_t Count = 0;
+    double Min = 0;
+    double P50 = 0;
+    double P90 = 0;
+    double P99 = 0;
+    double P999 = 0;
+    double Max = 0;
+    double Mean = 0;
+};
+
+/** Nearest-rank percentile of sorted samples. */
+inline double Percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty())
+        return 0;
+    auto idx = (size_t)std::ceil(p * sorted.size());
+    return sorted[std::clamp<size_t>(idx, 1, sorted.size()) - 1];
+}
+
+inline Summary Summarize(std::vector<double> samples) {
+    Summary s;
+    if (samples.empty())
+        return s;
+
+    std::sort(samples.begin(), samples.end());
+    s.Count = samples.size();
+    s.Min = samples.front();
+    s.P50 = Percentile(samples, 0.50);
+    s.P90 = Percentile(samples, 0.90);
+    s.P99 = Percentile(samples, 0.99);
+    s.P999 = Percentile(samples, 0.999);
+    s.Max = samples.back();
+    for (double v : samples)
+        s.Mean += v;
+    s.Mean /= samples.size();
+    return s;
+}
+
+
+/** Least-squares line y = Slope*x + Intercept, with coefficient of determination R2. */
+struct LinearFit {
+    double Slope = 0;
+    double Intercept = 0;
+    double R2 = 0;
+};
+
+inline LinearFit FitLine(const std::vector<double>& x, const std::vector<double>& y) {
+    LinearFit fit;
+    size_t n = std::min<size_t>(x.size(), y.size());
+    if (n < 2)
+        return fit;
+
+    double meanX = 0, meanY = 0;
+    for (size_t i = 0; i < n; i++) {
+        meanX += x[i];
+        meanY += y[i];
+    }
+    meanX /= n;
+    meanY /= n;
+
+    double sxx = 0, sxy = 0, syy = 0;
+    for (size_t i = 0; i < n; i++) {
+        sxx += (x[i] - meanX) * (x[i] - meanX);
+        sxy += (x[i] - meanX) * (y[i] - meanY);
+        syy += (y[i] - meanY) * (y[i] - meanY);
+    }
+    if (sxx == 0)
+        return fit;
+
+    fit.Slope = sxy / sxx;
+    fit.Intercept = meanY - fit.Slope * meanX;
+    fit.R2 = (syy > 0) ? (sxy * sxy) / (sxx * syy) : 1.0; // constant y is perfectly explained
+    return fit;
+}
@@ -26,24 +26,82 @@ const std::wstring ToString(DWORD err) {
 }
 
 
-/** Add a DACL entry to the window station or desktop security descriptor. */
-void AddWindowDaclRight(HANDLE ws, EXPLICIT_ACCESS_W& ea) {
+/** Grant or revoke "access" for "sid" in the DACL of a window station or desktop.
+    Existing ACEs for "sid" are merged into one, so repeated grants don't grow the DACL, and the DACL is only written if changed.
+    Prints the DACL size before and after. */
+void UpdateWindowDacl(HANDLE obj, const wchar_t* name, PSID sid, ACCESS_MASK access, bool grant) {
     PSID owner = nullptr;
     PSID group = nullptr;
     ACL* dacl = nullptr;
     ACL* sacl = nullptr;
     PSECURITY_DESCRIPTOR sd = nullptr;
-    DWORD ret = GetSecurityInfo(ws, SE_WINDOW_OBJECT, DACL_SECURITY_INFORMATION, &owner, &group, &dacl, &sacl, &sd);
+    DWORD ret = GetSecurityInfo(obj, SE_WINDOW_OBJECT, DACL_SECURITY_INFORMATION, &owner, &group, &dacl, &sacl, &sd);
     assert(ret == ERROR_SUCCESS);
+    if (!dacl) {
+        LocalFree(sd);
+        return; // NULL DACL grants everyone full access
+    }
 
-    ACL* newDacl = nullptr;
-    ret = SetEntriesInAclW(1, &ea, /*oldAcl*/dacl, &newDacl);
-    assert(ret == ERROR_SUCCESS);
+    // ACEs explicitly allowing access for "sid" on this object only
+    auto matches = [&](const ACE_HEADER* header) {
+        return (header->AceType == ACCESS_ALLOWED_ACE_TYPE) && (header->AceFlags == 0) && EqualSid(&((ACCESS_ALLOWED_ACE*)header)->SidStart, sid);
+    };
+
+    // first pass: size of ACEs to keep and access already granted to "sid"
+    DWORD keptSize = sizeof(ACL);
+    DWORD matchCount = 0;
+    ACCESS_MASK granted = 0;
+    for (DWORD i = 0; i < dacl->AceCount; i++) {
+        ACE_HEADER* header = nullptr;
+        GetAce(dacl, i, (void**)&header);
+        if (matches(header)) {
+            matchCount++;
+            granted |= ((ACCESS_ALLOWED_ACE*)header)->Mask;
+        } else {
+            keptSize += header->AceSize;
+        }
+    }
+
+    bool covered = (granted & GENERIC_ALL) || ((granted & access) == access);
+    if (grant ? ((matchCount == 1) && covered) : (matchCount == 0)) {
+        wprintf(L"%s DACL unchanged: %u ACEs, %u bytes\n", name, dacl->AceCount, dacl->AclSize);
+        LocalFree(sd);
+        return; // nothing to do
+    }
+
+    // second pass: copy other ACEs and add one merged ACE for "sid" behind the explicit ACEs,
+    // i.e. before the first inherited ACE, so that the DACL stays in canonical order
+    DWORD newSize = keptSize;
+    if (grant)
+        newSize += sizeof(ACCESS_ALLOWED_ACE) - sizeof(DWORD) + GetLengthSid(sid);
+    std::vector<BYTE> newDaclBuf(newSize, (BYTE)0);
+    auto* newDacl = (ACL*)newDaclBuf.data();
+    BOOL ok = InitializeAcl(newDacl, newSize, dacl->AclRevision);
+    assert(ok);
+    bool pending = grant; // merged ACE not added yet
+    for (DWORD i = 0; i < dacl->AceCount; i++) {
+        ACE_HEADER* header = nullptr;
+        GetAce(dacl, i, (void**)&header);
+        if (pending && (header->AceFlags & INHERITED_ACE)) {
+            ok = AddAccessAllowedAce(newDacl, dacl->AclRevision, granted | access, sid); // appends
+            assert(ok);
+            pending = false;
+        }
+        if (!matches(header)) {
+            ok = AddAce(newDacl, dacl->AclRevision, MAXDWORD, header, header->AceSize);
+            assert(ok);
+        }
+    }
+    if (pending) {
+        ok = AddAccessAllowedAce(newDacl, dacl->AclRevision, granted | access, sid); // no inherited ACEs
+        assert(ok);
+    }
+
+    wprintf(L"%s DACL: %u ACEs, %u bytes -> %u ACEs, %u bytes\n", name, dacl->AceCount, dacl->AclSize, newDacl->AceCount, newDacl->AclSize);
 
-    ret = SetSecurityInfo(ws, SE_WINDOW_OBJECT, DACL_SECURITY_INFORMATION, owner, group, newDacl, sacl);
+    ret = SetSecurityInfo(obj, SE_WINDOW_OBJECT, DACL_SECURITY_INFORMATION, owner, group, newDacl, sacl);
     assert(ret == ERROR_SUCCESS);
 
-    LocalFree(newDacl);
     LocalFree(sd);
 }
 
@@ -122,75 +180,74 @@ bool AddTokenDaclRight(HANDLE token, EXPLICIT_ACCESS_W& ea) {
 }
 
 
-/** Grant "logonSid" access to the current window station and desktop. */
-void GrantWindowStationDesktopAccess(PSID logonSid) {
+/** Grant or revoke "logonSid" access to the current window station and desktop. */
+void UpdateWindowStationDesktopAccess(PSID logonSid, bool grant) {
     {
         // https://learn.microsoft.com/en-us/windows/win32/winstation/window-station-security-and-access-rights
         HWINSTA ws = OpenWindowStationW(L"winsta0", /*inherit*/false, READ_CONTROL | WRITE_DAC);
         assert(ws);
-        {
-            // Grant GENERIC_ALL to "logonSid" which grants:
-            //   STANDARD_RIGHTS_REQUIRED WINSTA_ACCESSCLIPBOARD WINSTA_ACCESSGLOBALATOMS WINSTA_CREATEDESKTOP WINSTA_ENUMDESKTOPS
-            //   WINSTA_ENUMERATE WINSTA_EXITWINDOWS WINSTA_READATTRIBUTES WINSTA_READSCREEN WINSTA_WRITEATTRIBUTES
-            EXPLICIT_ACCESS_W ea {
-                .grfAccessPermissions = GENERIC_ALL,
-                .grfAccessMode = GRANT_ACCESS,
-                .grfInheritance = false,
-            };
-            ea.Trustee = {
-                .pMultipleTrustee = NULL,
-                .MultipleTrusteeOperation = NO_MULTIPLE_TRUSTEE,
-                .TrusteeForm = TRUSTEE_IS_SID,
-                .TrusteeType = TRUSTEE_IS_WELL_KNOWN_GROUP,
-                .ptstrName = (wchar_t*)logonSid,
-            };
-            AddWindowDaclRight(ws, ea);
-        }
+        // Grant all rights, equivalent to GENERIC_ALL:
+        //   STANDARD_RIGHTS_REQUIRED WINSTA_ACCESSCLIPBOARD WINSTA_ACCESSGLOBALATOMS WINSTA_CREATEDESKTOP WINSTA_ENUMDESKTOPS
+        //   WINSTA_ENUMERATE WINSTA_EXITWINDOWS WINSTA_READATTRIBUTES WINSTA_READSCREEN WINSTA_WRITEATTRIBUTES
+        ACCESS_MASK access = STANDARD_RIGHTS_REQUIRED | WINSTA_ALL_ACCESS;
+        UpdateWindowDacl(ws, L"winsta0", logonSid, access, grant);
         CloseWindowStation(ws);
     }
     {
         // https://learn.microsoft.com/en-us/windows/win32/winstation/desktop-security-and-access-rights
         HDESK desk = OpenDesktopW(L"default", 0, /*inherit*/false, READ_CONTROL | WRITE_DAC);
         assert(desk);
-        {
-            // Grant GENERIC_ALL to "logonSid" which grants:
-            //   DESKTOP_CREATEMENU DESKTOP_CREATEWINDOW DESKTOP_ENUMERATE DESKTOP_HOOKCONTROL DESKTOP_JOURNALPLAYBACK
-            //   DESKTOP_JOURNALRECORD DESKTOP_READOBJECTS DESKTOP_SWITCHDESKTOP DESKTOP_WRITEOBJECTS STANDARD_RIGHTS_REQUIRED
-            EXPLICIT_ACCESS_W ea {
-                .grfAccessPermissions = GENERIC_ALL,
-                .grfAccessMode = GRANT_ACCESS,
-                .grfInheritance = false,
-            };
-            ea.Trustee = {
-                .pMultipleTrustee = NULL,
-                .MultipleTrusteeOperation = NO_MULTIPLE_TRUSTEE,
-                .TrusteeForm = TRUSTEE_IS_SID,
-                .TrusteeType = TRUSTEE_IS_WELL_KNOWN_GROUP,
-                .ptstrName = (wchar_t*)logonSid,
-            };
-            AddWindowDaclRight(desk, ea);
-        }
+        // Grant all rights, equivalent to GENERIC_ALL:
+        //   DESKTOP_CREATEMENU DESKTOP_CREATEWINDOW DESKTOP_ENUMERATE DESKTOP_HOOKCONTROL DESKTOP_JOURNALPLAYBACK
+        //   DESKTOP_JOURNALRECORD DESKTOP_READOBJECTS DESKTOP_SWITCHDESKTOP DESKTOP_WRITEOBJECTS STANDARD_RIGHTS_REQUIRED
+        ACCESS_MASK access = STANDARD_RIGHTS_REQUIRED | DESKTOP_CREATEMENU | DESKTOP_CREATEWINDOW | DESKTOP_ENUMERATE | DESKTOP_HOOKCONTROL
+            | DESKTOP_JOURNALPLAYBACK | DESKTOP_JOURNALRECORD | DESKTOP_READOBJECTS | DESKTOP_SWITCHDESKTOP | DESKTOP_WRITEOBJECTS;
+        UpdateWindowDacl(desk, L"default desktop", logonSid, access, grant);
         CloseDesktop(desk);
     }
 }
 
-/** Based on https://learn.microsoft.com/en-us/previous-versions/aa446670(v=vs.85) */
-PSID GetLogonSID (HANDLE hToken) {
-    std::vector<BYTE> tokenGroupsBuf;
-    {
-        // Get TOKEN_GROUPS size
-        DWORD bufSize = 0;
-        if (GetTokenInformation(hToken, TokenGroups, nullptr, 0, &bufSize))
-            abort(); // call is supposed to fail
-        assert(GetLastError() == ERROR_INSUFFICIENT_BUFFER);
-
-        // Get the token group information from the access token
-        tokenGroupsBuf.resize(bufSize, (BYTE)0);
-        if (!GetTokenInformation(hToken, TokenGroups, (LPVOID)tokenGroupsBuf.data(), bufSize, &bufSize)) {
-            abort();
+/** Grant "logonSid" access to the current window station and desktop. Idempotent. */
+void GrantWindowStationDesktopAccess(PSID logonSid) {
+    UpdateWindowStationDesktopAccess(logonSid, /*grant*/true);
+}
+
+/** Remove "logonSid" access again, so that the DACLs don't grow with every logon. */
+void RevokeWindowStationDesktopAccess(PSID logonSid) {
+    UpdateWindowStationDesktopAccess(logonSid, /*grant*/false);
+}
+
+/** Growable buffer for GetTokenInformation queries.
+    Reused across queries, so that the usual size-then-fetch pair of calls is only needed when the buffer is too small. */
+class TokenInfoBuffer {
+public:
+    /** Query "infoClass" from "token". Returns nullptr on failure.
+        The result is valid until the next query through the same buffer. */
+    template <class T>
+    const T* Query(HANDLE token, TOKEN_INFORMATION_CLASS infoClass) {
+        DWORD size = 0;
+        if (!GetTokenInformation(token, infoClass, m_buffer.data(), (DWORD)m_buffer.size(), &size)) {
+            if (GetLastError() != ERROR_INSUFFICIENT_BUFFER)
+                return nullptr;
+
+            m_buffer.resize(size);
+            if (!GetTokenInformation(token, infoClass, m_buffer.data(), (DWORD)m_buffer.size(), &size))
+                return nullptr;
         }
+        return (const T*)m_buffer.data();
     }
-    auto* tg = (TOKEN_GROUPS*)tokenGroupsBuf.data();
+
+private:
+    std::vector<BYTE> m_buffer = std::vector<BYTE>(1024); // fits groups of typical accounts
+};
+
+
+/** Based on https://learn.microsoft.com/en-us/previous-versions/aa446670(v=vs.85) */
+PSID GetLogonSID (HANDLE hToken) {
+    TokenInfoBuffer tokenGroupsBuf;
+    auto* tg = tokenGroupsBuf.Query<TOKEN_GROUPS>(hToken, TokenGroups);
+    if (!tg)
+        abort();
 
     // Loop through the groups to find the logon SID.
     for (DWORD i = 0; i < tg->GroupCount; i++) {
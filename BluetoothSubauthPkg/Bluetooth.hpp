@@ -1,69 +1,237 @@
 #pragma once
 #include <Windows.h>
+#include <initguid.h>       // define the interface class GUIDs of <bthdef.h> & <bthledef.h> in this translation unit
 #include <BluetoothAPIs.h>  
+#include <bthledef.h>       // for GUID_BLUETOOTHLE_DEVICE_INTERFACE
+#include <cfgmgr32.h> // for CM_Register_Notification
+#include "BluetoothMonitor.hpp"
+#include "BluetoothProbe.hpp"
+#include "SubAuthMetrics.hpp"
+#include <chrono>
 #ifndef _WINDLL
   #include <stdio.h>
 #endif
 
 #pragma comment(lib, "Bthprops.lib")
+#pragma comment(lib, "Cfgmgr32.lib")
 
 
-void GetRadio(HANDLE* radio, HBLUETOOTH_RADIO_FIND* radioFind) {
-    BLUETOOTH_FIND_RADIO_PARAMS parFinder{};
-    parFinder.dwSize = sizeof(BLUETOOTH_FIND_RADIO_PARAMS);
+static const wchar_t CONFIG_KEY[] = L"SYSTEM\\CurrentControlSet\\Control\\Lsa\\BluetoothSubauthPkg";
 
-    *radioFind = BluetoothFindFirstRadio(&parFinder, radio);
+static constexpr std::chrono::milliseconds BACKGROUND_PROBE_BUDGET(5000); // room for a 3.84 s inquiry, since no logon waits
 
-    BLUETOOTH_RADIO_INFO bri{};
-    bri.dwSize = sizeof(BLUETOOTH_RADIO_INFO);
+/** Load probe limits from the "ProbeBudgetMs" and "FailOpen" REG_DWORD values under CONFIG_KEY. Missing values keep their defaults. */
+ProbeOptions LoadProbeOptions() {
+    ProbeOptions options;
 
-    if (BluetoothGetRadioInfo(*radio, &bri) != ERROR_SUCCESS) {
-        CloseHandle(*radio);
-        BluetoothFindRadioClose(*radioFind);
-        *radio = NULL;
-        *radioFind = NULL;
-    }
+    DWORD value = 0;
+    DWORD size = sizeof(value);
+    if (RegGetValueW(HKEY_LOCAL_MACHINE, CONFIG_KEY, L"ProbeBudgetMs", RRF_RT_REG_DWORD, nullptr, &value, &size) == ERROR_SUCCESS)
+        options.Budget = std::chrono::milliseconds(value);
+
+    size = sizeof(value);
+    if (RegGetValueW(HKEY_LOCAL_MACHINE, CONFIG_KEY, L"FailOpen", RRF_RT_REG_DWORD, nullptr, &value, &size) == ERROR_SUCCESS)
+        options.FailClosed = (value == 0);
+    return options;
 }
 
-bool HasBlueTooth() {
-    HANDLE radio = 0;
-    HBLUETOOTH_RADIO_FIND radioFinder = 0;
-    GetRadio(&radio, &radioFinder);
-    if (!radio)
+/** Read the REG_MULTI_SZ value "name" under CONFIG_KEY into "lines". Returns false if missing. */
+bool ReadConfigLines(const wchar_t* name, std::vector<std::wstring>& lines) {
+    DWORD size = 0;
+    if (RegGetValueW(HKEY_LOCAL_MACHINE, CONFIG_KEY, name, RRF_RT_REG_MULTI_SZ, nullptr, nullptr, &size) != ERROR_SUCCESS)
         return false;
+    std::vector<wchar_t> buffer(size / sizeof(wchar_t) + 1, L'\0');
+    if (RegGetValueW(HKEY_LOCAL_MACHINE, CONFIG_KEY, name, RRF_RT_REG_MULTI_SZ, nullptr, buffer.data(), &size) != ERROR_SUCCESS)
+        return false;
+
+    for (const wchar_t* line = buffer.data(); *line; line += wcslen(line) + 1)
+        lines.push_back(line);
+    return true;
+}
+
+/** Upper bound for how long a logon waits for the result of a probe in progress, which may be a background probe.
+    Only expires if the probe hangs, since probes are bounded by their own budget. */
+std::chrono::steady_clock::duration ProbeWaitBudget(const ProbeOptions& options) {
+    return std::max<std::chrono::steady_clock::duration>(options.Budget, BACKGROUND_PROBE_BUDGET) + std::chrono::seconds(1);
+}
+
+/** Load policy rules from the "Rules" REG_MULTI_SZ value under CONFIG_KEY.
+    Falls back to denying any device if the value is missing or malformed. */
+BluetoothPolicy LoadPolicy() {
+    BluetoothPolicy policy;
+    std::vector<std::wstring> rules;
+    if (!ReadConfigLines(L"Rules", rules))
+        return policy;
+
+    std::wstring error;
+    if (!policy.Compile(rules, &error)) {
+#ifndef _WINDLL
+        wprintf(L"ERROR: %s\n", error.c_str());
+#endif
+    }
+    return policy;
+}
+
+/** Load per-logon-type checks from the "LogonChecks" REG_MULTI_SZ value under CONFIG_KEY.
+    Falls back to the defaults of LogonCheckTable if the value is missing or malformed. */
+LogonCheckTable LoadLogonChecks() {
+    LogonCheckTable checks;
+    std::vector<std::wstring> rules;
+    if (!ReadConfigLines(L"LogonChecks", rules))
+        return checks;
+
+    std::wstring error;
+    if (!checks.Compile(rules, &error)) {
+#ifndef _WINDLL
+        wprintf(L"ERROR: %s\n", error.c_str());
+#endif
+    }
+    return checks;
+}
+
+DeviceInfo ToDeviceInfo(const BLUETOOTH_DEVICE_INFO& info) {
+    return DeviceInfo{
+        .Address = info.Address.ullLong & 0xFFFFFFFFFFFF,
+        .ClassOfDevice = info.ulClassofDevice,
+        .Connected = info.fConnected != FALSE,
+        .Remembered = info.fRemembered != FALSE,
+        .Paired = info.fAuthenticated != FALSE,
+        .Name = info.szName,
+    };
+}
+
+
+/** Radio accessed through the Win32 Bluetooth APIs. */
+class Win32Radio : public Radio {
+public:
+    explicit Win32Radio(HANDLE radio) : m_radio(radio) {
+    }
+    ~Win32Radio() override {
+        CloseHandle(m_radio);
+    }
 
-    BLUETOOTH_DEVICE_SEARCH_PARAMS par{};
-    par.dwSize = sizeof(BLUETOOTH_DEVICE_SEARCH_PARAMS);
-    par.hRadio = radio;
-    par.fReturnAuthenticated = TRUE;
-    par.fReturnConnected = TRUE;
-    par.fReturnRemembered = TRUE;
-    par.fReturnUnknown = TRUE;
-    par.fIssueInquiry = TRUE;
-    par.cTimeoutMultiplier = 3;
-
-    BLUETOOTH_DEVICE_INFO_STRUCT info{};
-    info.dwSize = sizeof(info);
-
-    bool found = false;
-    {
+    bool IsEnabled() override {
+        return BluetoothIsConnectable(m_radio) || BluetoothIsDiscoverable(m_radio);
+    }
+
+    bool EnumerateDevices(unsigned inquiryUnits, const std::function<bool(const DeviceInfo&)>& visit) override {
+        BLUETOOTH_DEVICE_SEARCH_PARAMS par{};
+        par.dwSize = sizeof(BLUETOOTH_DEVICE_SEARCH_PARAMS);
+        par.hRadio = m_radio;
+        par.fReturnAuthenticated = TRUE;
+        par.fReturnConnected = TRUE;
+        par.fReturnRemembered = TRUE;
+        par.fReturnUnknown = (inquiryUnits > 0);
+        par.fIssueInquiry = (inquiryUnits > 0);
+        par.cTimeoutMultiplier = (UCHAR)inquiryUnits;
+
+        BLUETOOTH_DEVICE_INFO_STRUCT info{};
+        info.dwSize = sizeof(info);
+
+        bool completed = true;
         HBLUETOOTH_DEVICE_FIND deviceFind = BluetoothFindFirstDevice(&par, &info);
         BOOL cont = (deviceFind != 0);
         while (cont) {
+            completed = visit(ToDeviceInfo(info));
 #ifndef _WINDLL
-            wprintf(L"BlueTooth device: %s\n", info.szName);
+            wprintf(L"BlueTooth device: %s (%s)\n", info.szName, completed ? L"allowed" : L"denied");
 #endif
-
-            // TODO: Add BlueTooth device check based on "info" struct
-            found = true;
+            if (!completed)
+                break;
 
             cont = BluetoothFindNextDevice(deviceFind, &info);
         }
 
-        BluetoothFindDeviceClose(deviceFind);
+        if (deviceFind)
+            BluetoothFindDeviceClose(deviceFind);
+        return completed;
+    }
+
+private:
+    HANDLE m_radio = 0;
+};
+
+/** Radios accessed through the Win32 Bluetooth APIs, e.g. a built-in radio plus a USB dongle. */
+class Win32RadioBackend : public RadioBackend {
+public:
+    std::vector<std::unique_ptr<Radio>> OpenRadios() override {
+        std::vector<std::unique_ptr<Radio>> radios;
+
+        BLUETOOTH_FIND_RADIO_PARAMS params{ .dwSize = sizeof(params) };
+        HANDLE radio = 0;
+        HBLUETOOTH_RADIO_FIND radioFinder = BluetoothFindFirstRadio(&params, &radio);
+        if (!radioFinder)
+            return radios; // no radios
+
+        do {
+            BLUETOOTH_RADIO_INFO info{ .dwSize = sizeof(info) };
+            if (BluetoothGetRadioInfo(radio, &info) == ERROR_SUCCESS)
+                radios.push_back(std::make_unique<Win32Radio>(radio)); // takes ownership of handle
+            else
+                CloseHandle(radio);
+        } while (BluetoothFindNextRadio(radioFinder, &radio));
+
+        BluetoothFindRadioClose(radioFinder);
+        return radios;
+    }
+
+    std::chrono::steady_clock::duration InquiryUnit() const override {
+        return std::chrono::milliseconds(1280);
     }
 
-    CloseHandle(radio);
-    BluetoothFindRadioClose(radioFinder);
-    return found;
+    unsigned MaxInquiryUnits() const override {
+        return 48; // ~61 s
+    }
+};
+
+
+/** Refresh "monitor" whenever a Bluetooth radio or device interface arrives or is removed, e.g. when pairing devices or plugging in a radio dongle.
+    Other device changes in the system, e.g. USB drives, don't trigger probes. Returns one registration per interface class that could be registered.
+    Close them with UnregisterDeviceChangeNotifications. */
+std::vector<HCMNOTIFICATION> RegisterDeviceChangeNotifications(BluetoothMonitor& monitor) {
+    static const GUID INTERFACE_CLASSES[] = {
+        GUID_BTHPORT_DEVICE_INTERFACE,             // radios (bthport)
+        GUID_BLUETOOTH_RADIO_INTERFACE,            // radios (Bluetooth stack), also toggled when switching a radio on or off
+        GUID_BTH_RFCOMM_SERVICE_DEVICE_INTERFACE,  // paired classic devices with serial port services, e.g. phones
+        GUID_BLUETOOTHLE_DEVICE_INTERFACE,         // paired Bluetooth LE devices
+    };
+
+    auto callback = [](HCMNOTIFICATION, void* context, CM_NOTIFY_ACTION action, CM_NOTIFY_EVENT_DATA*, DWORD) -> DWORD {
+        if ((action == CM_NOTIFY_ACTION_DEVICEINTERFACEARRIVAL) || (action == CM_NOTIFY_ACTION_DEVICEINTERFACEREMOVAL))
+            ((BluetoothMonitor*)context)->Notify();
+        return ERROR_SUCCESS;
+    };
+
+    std::vector<HCMNOTIFICATION> notifications;
+    for (const GUID& interfaceClass : INTERFACE_CLASSES) {
+        CM_NOTIFY_FILTER filter{};
+        filter.cbSize = sizeof(filter);
+        filter.FilterType = CM_NOTIFY_FILTER_TYPE_DEVICEINTERFACE;
+        filter.u.DeviceInterface.ClassGuid = interfaceClass;
+
+        HCMNOTIFICATION notification = nullptr;
+        if (CM_Register_Notification(&filter, &monitor, callback, &notification) == CR_SUCCESS)
+            notifications.push_back(notification);
+    }
+    return notifications;
+}
+
+void UnregisterDeviceChangeNotifications(std::vector<HCMNOTIFICATION>& notifications) {
+    for (HCMNOTIFICATION notification : notifications)
+        CM_Unregister_Notification(notification);
+    notifications.clear();
+}
+
+/** Probe for denied devices with the current policy & limits. These are reloaded on every probe, so that changes apply without a restart.
+    Background probes get at least BACKGROUND_PROBE_BUDGET, so that the cached verdict covers a full inquiry. Counts the probe in "metrics". */
+bool ProbeBluetooth(bool background, SubAuthMetrics& metrics) {
+    ProbeOptions options = LoadProbeOptions();
+    if (background)
+        options.Budget = std::max<std::chrono::steady_clock::duration>(options.Budget, BACKGROUND_PROBE_BUDGET);
+
+    auto start = std::chrono::steady_clock::now();
+    Win32RadioBackend backend;
+    ProbeResult result = ProbeDevices(backend, LoadPolicy(), options);
+    metrics.RecordProbe(background, result, std::chrono::steady_clock::now() - start);
+    return result.Deny;
 }
@@ -0,0 +1,188 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+
+/** Keeps a cached Bluetooth verdict up to date on a background thread, so that logons don't wait for radio inquiries.
+    Refreshes periodically and soon after device change notifications.
+    Only depends on the standard library, so that it can be exercised with a simulated radio. */
+class BluetoothMonitor {
+public:
+    using Clock = std::chrono::steady_clock;
+    using Probe = std::function<bool(bool background)>; // returns true if logon shall be denied. Foreground probes block a logon.
+
+    /** "maxAge" is the staleness bound for full checks, and "maxCachedAge" the hard age limit for cached checks.
+        "waitBudget" bounds how long a logon waits for the result of a probe already in progress, e.g. a background inquiry.
+        It shall cover the longest probe budget, since it only guards against hung probes. If it expires, Verdict returns "failClosed".
+        Cached checks without a usable verdict also get "failClosed". */
+    BluetoothMonitor(Probe probe, Clock::duration refreshInterval, Clock::duration maxAge, Clock::duration maxCachedAge, Clock::duration waitBudget, bool failClosed)
+        : m_probe(std::move(probe)), m_refreshInterval(refreshInterval), m_maxAge(maxAge), m_maxCachedAge(maxCachedAge), m_waitBudget(waitBudget), m_failClosed(failClosed) {
+    }
+
+    ~BluetoothMonitor() {
+        Stop();
+    }
+
+    /** Start background refresh. Does nothing if already started. */
+    void Start() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_thread.joinable())
+            return;
+        m_stop = false;
+        m_thread = std::thread(&BluetoothMonitor::Run, this);
+    }
+
+    void Stop() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_wakeup.notify_all();
+        if (m_thread.joinable())
+            m_thread.join();
+    }
+
+    /** Request a refresh, e.g. on device arrival or removal. Safe to call from notification callbacks. */
+    void Notify() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_notified = true;
+        }
+        m_wakeup.notify_all();
+    }
+
+    /** Lock-free read of the cached verdict. Returns false if there is none younger than the staleness bound. */
+    bool TryGetVerdict(bool* deny, Clock::duration* age = nullptr) const {
+        uint64_t state = m_state.load(std::memory_order_acquire);
+        if (state == 0)
+            return false; // no probe completed yet
+
+        Clock::duration elapsed = Clock::now() - Published(state);
+        if (age)
+            *age = elapsed;
+        if (elapsed > m_maxAge)
+            return false;
+
+        *deny = (state & 1) != 0;
+        return true;
+    }
+
+    /** Lock-free read of the last verdict regardless of its age. Returns false if no probe has completed yet. */
+    bool TryGetLastVerdict(bool* deny) const {
+        uint64_t state = m_state.load(std::memory_order_acquire);
+        if (state == 0)
+            return false;
+        *deny = (state & 1) != 0;
+        return true;
+    }
+
+    /** Lock-free read of the cached verdict for cached checks, which accept verdicts up to the hard age limit instead of the staleness bound.
+        Returns false if no probe has completed yet, or if the verdict is older than the hard limit, e.g. because the monitor has stalled.
+        Sets "expired" in the latter case. */
+    bool TryGetCachedVerdict(bool* deny, bool* expired) const {
+        *expired = false;
+        uint64_t state = m_state.load(std::memory_order_acquire);
+        if (state == 0)
+            return false;
+        if (Clock::now() - Published(state) > m_maxCachedAge) {
+            *expired = true;
+            return false;
+        }
+        *deny = (state & 1) != 0;
+        return true;
+    }
+
+    /** Verdict if no probe result is available, e.g. for cached checks before the first probe. */
+    bool FailClosed() const {
+        return m_failClosed;
+    }
+
+    /** Cached verdict if fresh, otherwise probe synchronously.
+        If a probe is already in progress, e.g. the first probe after Start, its result is shared instead of failing or probing again.
+        Waits at most the wait budget for it, and then denies if failing closed. */
+    bool Verdict() {
+        bool deny = false;
+        if (TryGetVerdict(&deny))
+            return deny;
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_probing) {
+            uint64_t generation = m_probeGeneration;
+            if (!m_probeDone.wait_for(lock, m_waitBudget, [&] { return m_probeGeneration != generation; }))
+                return m_failClosed; // probe hangs
+            return m_lastDeny;
+        }
+        if (TryGetVerdict(&deny))
+            return deny; // refreshed by another thread meanwhile
+
+        m_probing = true;
+        lock.unlock();
+        deny = m_probe(/*background*/false);
+        lock.lock();
+        Complete(deny);
+        return deny;
+    }
+
+private:
+    void Run() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (!m_stop) {
+            m_notified = false;
+            m_probeDone.wait(lock, [this] { return !m_probing; }); // logon probe in progress
+            if (m_stop)
+                break;
+            m_probing = true;
+            // the first probe is likely awaited by a logon, so it gets the logon budget instead of a full background inquiry
+            bool background = (m_state.load(std::memory_order_relaxed) != 0);
+            lock.unlock();
+            bool deny = m_probe(background);
+            lock.lock();
+            Complete(deny);
+
+            // notifications during the probe trigger another refresh right away
+            m_wakeup.wait_for(lock, m_refreshInterval, [this] { return m_stop || m_notified; });
+        }
+    }
+
+    static Clock::time_point Published(uint64_t state) {
+        return Clock::time_point(Clock::duration((int64_t)(state >> 1) - 1));
+    }
+
+    /** Publish the result of a probe & wake up threads waiting for it. Requires m_mutex. */
+    void Complete(bool deny) {
+        Publish(deny);
+        m_lastDeny = deny;
+        m_probing = false;
+        m_probeGeneration++;
+        m_probeDone.notify_all();
+    }
+
+    void Publish(bool deny) {
+        // pack timestamp & verdict into one word, so that readers never see a torn update
+        auto ticks = (uint64_t)Clock::now().time_since_epoch().count();
+        m_state.store(((ticks + 1) << 1) | (deny ? 1 : 0), std::memory_order_release);
+    }
+
+    Probe                   m_probe;
+    Clock::duration         m_refreshInterval;
+    Clock::duration         m_maxAge;          // staleness bound for cached verdicts
+    Clock::duration         m_maxCachedAge;    // hard age limit for cached checks
+    Clock::duration         m_waitBudget;      // max wait for a probe in progress
+    bool                    m_failClosed;      // verdict if the wait budget expires
+    std::atomic<uint64_t>   m_state = 0;       // ((timestamp + 1) << 1) | deny, 0 if not probed yet
+
+    std::mutex              m_mutex;           // protect members below
+    std::condition_variable m_wakeup;
+    std::condition_variable m_probeDone;       // signaled when a probe completes
+    std::thread             m_thread;
+    bool                    m_stop = false;
+    bool                    m_notified = false;
+    bool                    m_probing = false; // one probe at a time, since radios are shared
+    uint64_t                m_probeGeneration = 0; // completed probes
+    bool                    m_lastDeny = false;    // result of the last completed probe
+};
@@ -0,0 +1,315 @@
+#pragma once
+#include <cstdint>
+#include <cwchar>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+
+/** Bluetooth device properties that policy rules can refer to.
+    Platform independent subset of BLUETOOTH_DEVICE_INFO, so that policies can be evaluated against simulated devices. */
+struct DeviceInfo {
+    uint64_t          Address = 0;       // 48-bit address, first displayed byte most significant
+    uint32_t          ClassOfDevice = 0; // 24-bit class of device
+    bool              Connected = false;
+    bool              Remembered = false;
+    bool              Paired = false;    // authenticated
+    std::wstring_view Name;              // not owned
+};
+
+enum class PolicyAction : uint8_t {
+    Allow,
+    Deny,
+};
+
+
+/** Ordered list of allow/deny rules compiled into a matcher. The first matching rule decides, otherwise the default action applies.
+
+    One rule per line: "<allow|deny> <condition>...", where all conditions must match:
+      address=AA:BB:CC:DD:EE:FF    device address
+      class=0x240404[/0xFFFFFC]    class of device bits, with optional mask
+      major=audio                  major device class (name or number)
+      name=Contoso*                case-insensitive name pattern with '*' and '?' wildcards
+      paired | connected | remembered
+    A rule without conditions matches every device. "default <allow|deny>" sets the default action. Lines starting with '#' are comments.
+
+    Rules with just an address condition are looked up in a hash table. The remaining rules are checked with flag, class and
+    character-set bitmasks before matching name patterns. */
+class BluetoothPolicy {
+public:
+    /** Policy that denies any device, i.e. logon is only allowed without Bluetooth devices. */
+    BluetoothPolicy() = default;
+
+    /** Compile "rules". Returns false with a description in "error" if a rule is malformed. */
+    bool Compile(const std::vector<std::wstring>& rules, std::wstring* error = nullptr) {
+        *this = BluetoothPolicy();
+        for (size_t line = 0; line < rules.size(); line++) {
+            if (!CompileRule(rules[line])) {
+                if (error)
+                    *error = L"Invalid rule " + std::to_wstring(line + 1) + L": " + rules[line];
+                *this = BluetoothPolicy();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /** Action for a single device. */
+    PolicyAction Evaluate(const DeviceInfo& device) const {
+        size_t limit = m_rules.size(); // only rules before a matching address rule can take precedence
+        PolicyAction action = m_default;
+        auto it = m_addresses.find(device.Address);
+        if (it != m_addresses.end()) {
+            limit = it->second.Index;
+            action = it->second.Action;
+        }
+
+        uint64_t nameBits = CharBits(device.Name);
+        for (size_t i = 0; i < limit; i++) {
+            if (Matches(m_rules[i], device, nameBits))
+                return m_rules[i].Action;
+        }
+        return action;
+    }
+
+    /** True if any device is denied. Stops at the first denied device. */
+    template <class DEVICES>
+    bool DeniesAny(const DEVICES& devices) const {
+        for (const DeviceInfo& device : devices) {
+            if (Evaluate(device) == PolicyAction::Deny)
+                return true;
+        }
+        return false;
+    }
+
+    /** True if a device that is neither paired, connected nor remembered can be denied, i.e. if it's worth searching for nearby devices.
+        Only the default action and rules without flag conditions can match such devices. */
+    bool MayDenyUnknown() const {
+        if (m_default == PolicyAction::Deny)
+            return true;
+        for (const Rule& rule : m_all) {
+            if ((rule.Action == PolicyAction::Deny) && (rule.Flags == 0))
+                return true;
+        }
+        return false;
+    }
+
+    /** Reference evaluation of all rules in order without the address table. For verifying the compiled matcher. */
+    PolicyAction EvaluateLinear(const DeviceInfo& device) const {
+        for (const Rule& rule : m_all) {
+            if (Matches(rule, device, ~0ull))
+                return rule.Action;
+        }
+        return m_default;
+    }
+
+private:
+    enum Flags : uint8_t {
+        FLAG_PAIRED     = 1,
+        FLAG_CONNECTED  = 2,
+        FLAG_REMEMBERED = 4,
+    };
+
+    struct Rule {
+        PolicyAction Action = PolicyAction::Deny;
+        uint8_t      Flags = 0;        // required device flags
+        bool         HasAddress = false;
+        uint64_t     Address = 0;
+        uint32_t     ClassMask = 0;
+        uint32_t     ClassValue = 0;
+        std::wstring NamePattern;      // lower-case, empty if any name
+        uint64_t     NameBits = 0;     // CharBits of literal pattern characters
+    };
+
+    struct AddressRule {
+        size_t       Index = 0;        // position in rule order, i.e. number of general rules before it
+        PolicyAction Action = PolicyAction::Deny;
+    };
+
+    /** Set of characters in "str", folded into 64 bits. A name can only match a pattern if it has all bits of the pattern's literals. */
+    static uint64_t CharBits(std::wstring_view str) {
+        uint64_t bits = 0;
+        for (wchar_t c : str)
+            bits |= 1ull << (AsciiLower(c) & 63);
+        return bits;
+    }
+
+    static bool Matches(const Rule& rule, const DeviceInfo& device, uint64_t nameBits) {
+        // cheapest checks first
+        uint8_t flags = (device.Paired ? FLAG_PAIRED : 0) | (device.Connected ? FLAG_CONNECTED : 0) | (device.Remembered ? FLAG_REMEMBERED : 0);
+        if ((flags & rule.Flags) != rule.Flags)
+            return false;
+        if ((device.ClassOfDevice & rule.ClassMask) != rule.ClassValue)
+            return false;
+        if (rule.HasAddress && (device.Address != rule.Address))
+            return false;
+        if ((rule.NameBits & ~nameBits) != 0)
+            return false; // name lacks characters required by pattern
+        if (!rule.NamePattern.empty() && !MatchPattern(rule.NamePattern, device.Name))
+            return false;
+        return true;
+    }
+
+    static wchar_t AsciiLower(wchar_t c) {
+        return ((c >= L'A') && (c <= L'Z')) ? (wchar_t)(c + (L'a' - L'A')) : c;
+    }
+
+    /** Case-insensitive wildcard match of a lower-case pattern. Linear time through backtracking to the last '*'. */
+    static bool MatchPattern(std::wstring_view pattern, std::wstring_view name) {
+        size_t p = 0, n = 0;
+        size_t star = std::wstring_view::npos, starName = 0;
+        while (n < name.size()) {
+            if ((p < pattern.size()) && (pattern[p] == L'*')) {
+                star = p++;
+                starName = n;
+            } else if ((p < pattern.size()) && ((pattern[p] == L'?') || (pattern[p] == AsciiLower(name[n])))) {
+                p++;
+                n++;
+            } else if (star != std::wstring_view::npos) {
+                p = star + 1;
+                n = ++starName;
+            } else {
+                return false;
+            }
+        }
+        while ((p < pattern.size()) && (pattern[p] == L'*'))
+            p++;
+        return p == pattern.size();
+    }
+
+    static bool ParseNumber(std::wstring_view str, uint32_t* value) {
+        if (str.empty())
+            return false;
+        std::wstring copy(str);
+        wchar_t* end = nullptr;
+        unsigned long result = wcstoul(copy.c_str(), &end, 0);
+        if ((*end != L'\0') || (result > 0xFFFFFF))
+            return false;
+        *value = (uint32_t)result;
+        return true;
+    }
+
+    static bool ParseAddress(std::wstring_view str, uint64_t* address) {
+        // "AA:BB:CC:DD:EE:FF" or with '-' separators
+        if (str.size() != 17)
+            return false;
+        uint64_t result = 0;
+        for (size_t i = 0; i < 17; i++) {
+            wchar_t c = str[i];
+            if (i % 3 == 2) {
+                if ((c != L':') && (c != L'-'))
+                    return false;
+                continue;
+            }
+            int digit = ((c >= L'0') && (c <= L'9')) ? (c - L'0') : ((AsciiLower(c) >= L'a') && (AsciiLower(c) <= L'f')) ? (AsciiLower(c) - L'a' + 10) : -1;
+            if (digit < 0)
+                return false;
+            result = (result << 4) | (uint64_t)digit;
+        }
+        *address = result;
+        return true;
+    }
+
+    static bool ParseMajorClass(std::wstring_view str, uint32_t* major) {
+        static const wchar_t* NAMES[] = { L"misc", L"computer", L"phone", L"network", L"audio", L"peripheral", L"imaging", L"wearable", L"toy", L"health" };
+        for (uint32_t i = 0; i < std::size(NAMES); i++) {
+            if (str == NAMES[i]) {
+                *major = i;
+                return true;
+            }
+        }
+        return ParseNumber(str, major) && (*major <= 0x1F);
+    }
+
+    bool CompileRule(std::wstring_view line) {
+        // split into whitespace-separated tokens
+        std::vector<std::wstring_view> tokens;
+        for (size_t pos = 0; pos < line.size();) {
+            size_t start = line.find_first_not_of(L" \t", pos);
+            if (start == std::wstring_view::npos)
+                break;
+            size_t end = line.find_first_of(L" \t", start);
+            if (end == std::wstring_view::npos)
+                end = line.size();
+            tokens.push_back(line.substr(start, end - start));
+            pos = end;
+        }
+        if (tokens.empty() || (tokens[0][0] == L'#'))
+            return true;
+
+        PolicyAction action = PolicyAction::Deny;
+        if (tokens[0] == L"allow")
+            action = PolicyAction::Allow;
+        else if (tokens[0] != L"deny" && tokens[0] != L"default")
+            return false;
+
+        if (tokens[0] == L"default") {
+            if ((tokens.size() != 2) || ((tokens[1] != L"allow") && (tokens[1] != L"deny")))
+                return false;
+            m_default = (tokens[1] == L"allow") ? PolicyAction::Allow : PolicyAction::Deny;
+            return true;
+        }
+
+        Rule rule;
+        rule.Action = action;
+        for (size_t i = 1; i < tokens.size(); i++) {
+            std::wstring_view token = tokens[i];
+            size_t eq = token.find(L'=');
+            std::wstring_view key = token.substr(0, eq);
+            std::wstring_view value = (eq != std::wstring_view::npos) ? token.substr(eq + 1) : std::wstring_view();
+
+            if (token == L"paired") {
+                rule.Flags |= FLAG_PAIRED;
+            } else if (token == L"connected") {
+                rule.Flags |= FLAG_CONNECTED;
+            } else if (token == L"remembered") {
+                rule.Flags |= FLAG_REMEMBERED;
+            } else if (key == L"address") {
+                if (!ParseAddress(value, &rule.Address))
+                    return false;
+                rule.HasAddress = true;
+            } else if (key == L"class") {
+                size_t slash = value.find(L'/');
+                uint32_t mask = 0xFFFFFF;
+                if ((slash != std::wstring_view::npos) && !ParseNumber(value.substr(slash + 1), &mask))
+                    return false;
+                uint32_t bits = 0;
+                if (!ParseNumber(value.substr(0, slash), &bits))
+                    return false;
+                rule.ClassMask |= mask;
+                rule.ClassValue = (rule.ClassValue & ~mask) | (bits & mask);
+            } else if (key == L"major") {
+                uint32_t major = 0;
+                if (!ParseMajorClass(value, &major))
+                    return false;
+                rule.ClassMask |= 0x1F00; // bits 8-12
+                rule.ClassValue = (rule.ClassValue & ~0x1F00u) | (major << 8);
+            } else if (key == L"name") {
+                if (value.empty())
+                    return false;
+                for (wchar_t c : value) {
+                    rule.NamePattern += AsciiLower(c);
+                    if ((c != L'*') && (c != L'?'))
+                        rule.NameBits |= CharBits(std::wstring_view(&c, 1));
+                }
+            } else {
+                return false;
+            }
+        }
+
+        m_all.push_back(rule);
+        bool addressOnly = rule.HasAddress && (rule.Flags == 0) && (rule.ClassMask == 0) && rule.NamePattern.empty();
+        if (addressOnly)
+            m_addresses.try_emplace(rule.Address, AddressRule{ .Index = m_rules.size(), .Action = rule.Action }); // earlier rule for same address wins
+        else
+            m_rules.push_back(std::move(rule));
+        return true;
+    }
+
+    PolicyAction                              m_default = PolicyAction::Deny;
+    std::vector<Rule>                         m_rules;     // rules checked in order
+    std::unordered_map<uint64_t, AddressRule> m_addresses; // address-only rules
+    std::vector<Rule>                         m_all;       // all rules in order, for EvaluateLinear
+};
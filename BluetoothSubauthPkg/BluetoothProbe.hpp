@@ -0,0 +1,125 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <system_error>
+#include <thread>
+#include <vector>
+#include "BluetoothPolicy.hpp"
+
+
+/** Bluetooth radio, abstracted so that probes can run against simulated radios. Different radios are used from different threads concurrently. */
+class Radio {
+public:
+    virtual ~Radio() = default;
+
+    /** False if the radio is switched off. */
+    virtual bool IsEnabled() = 0;
+
+    /** Pass devices to "visit" until it returns false. Returns false if stopped by "visit".
+        With "inquiryUnits" 0, only connected & remembered devices known to the Bluetooth stack are enumerated, which doesn't involve radio traffic.
+        Otherwise, nearby devices found during an inquiry of "inquiryUnits" * RadioBackend::InquiryUnit() are included. */
+    virtual bool EnumerateDevices(unsigned inquiryUnits, const std::function<bool(const DeviceInfo&)>& visit) = 0;
+};
+
+/** Source of radios. */
+class RadioBackend {
+public:
+    virtual ~RadioBackend() = default;
+
+    /** Open all radios present. Empty if there are none. */
+    virtual std::vector<std::unique_ptr<Radio>> OpenRadios() = 0;
+
+    /** Granularity of inquiry lengths. */
+    virtual std::chrono::steady_clock::duration InquiryUnit() const = 0;
+
+    virtual unsigned MaxInquiryUnits() const = 0;
+};
+
+
+/** Time limits for a probe. */
+struct ProbeOptions {
+    std::chrono::steady_clock::duration Budget = std::chrono::milliseconds(2000); // upper bound for probes that block a logon
+    bool                                FailClosed = true; // deny if the budget expires before the probe is decisive
+};
+
+/** Probe stage that decided the verdict. */
+enum class ProbeTier : uint8_t {
+    Radio,    // no enabled radio
+    Cached,   // connected & remembered devices, without radio traffic
+    Inquiry,  // nearby devices
+    Budget,   // budget expired, so FailClosed decided
+};
+
+struct ProbeResult {
+    bool      Deny = false;
+    ProbeTier DecidedBy = ProbeTier::Radio;
+};
+
+/** Call "func" with 0 to count-1 on separate threads, with the calling thread taking 0. Returns once all calls have completed. */
+template <class FUNC>
+void ForEachConcurrently(size_t count, const FUNC& func) {
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < count; i++) {
+        try {
+            threads.emplace_back(func, i);
+        } catch (const std::system_error&) {
+            func(i); // out of threads, so run sequentially rather than let exceptions escape into lsass
+        }
+    }
+    if (count > 0)
+        func(0);
+    for (std::thread& thread : threads)
+        thread.join();
+}
+
+/** Probe for devices denied by "policy" in tiers of increasing cost, stopping at the first decisive tier:
+    1. Allow if there's no radio, or all are switched off.
+    2. Deny if a connected or remembered device is denied.
+    3. Search for nearby devices if the policy can deny unknown devices. The inquiry is shortened to whole inquiry units that fit
+       into the remaining budget. If not even one fits, "options.FailClosed" decides.
+    Each tier probes all radios concurrently, so that latency is that of the slowest radio rather than the sum. The first denied device
+    stops enumeration on the other radios. Latency is bounded by "options.Budget" plus the time to enumerate cached devices. */
+inline ProbeResult ProbeDevices(RadioBackend& backend, const BluetoothPolicy& policy, const ProbeOptions& options) {
+    using Clock = std::chrono::steady_clock;
+    auto deadline = Clock::now() + options.Budget;
+
+    std::vector<std::unique_ptr<Radio>> radios = backend.OpenRadios();
+    std::vector<bool> enabled(radios.size());
+    for (size_t i = 0; i < radios.size(); i++)
+        enabled[i] = radios[i]->IsEnabled();
+    if (std::find(enabled.begin(), enabled.end(), true) == enabled.end())
+        return ProbeResult{ .Deny = false, .DecidedBy = ProbeTier::Radio };
+
+    std::atomic<bool> denied = false;
+    auto probe = [&](unsigned inquiryUnits) {
+        ForEachConcurrently(radios.size(), [&](size_t i) {
+            if (!enabled[i])
+                return;
+            radios[i]->EnumerateDevices(inquiryUnits, [&](const DeviceInfo& device) {
+                if (denied.load(std::memory_order_relaxed))
+                    return false; // decided by another radio
+                if (policy.Evaluate(device) != PolicyAction::Deny)
+                    return true;
+                denied.store(true, std::memory_order_relaxed);
+                return false; // no need to look further
+            });
+        });
+    };
+
+    probe(/*inquiryUnits*/0);
+    if (denied)
+        return ProbeResult{ .Deny = true, .DecidedBy = ProbeTier::Cached };
+    if (!policy.MayDenyUnknown())
+        return ProbeResult{ .Deny = false, .DecidedBy = ProbeTier::Cached }; // inquiry can't change the verdict
+
+    Clock::duration remaining = std::max<Clock::duration>(deadline - Clock::now(), Clock::duration::zero());
+    auto units = (unsigned)std::min<long long>(remaining / backend.InquiryUnit(), backend.MaxInquiryUnits());
+    if (units == 0)
+        return ProbeResult{ .Deny = options.FailClosed, .DecidedBy = ProbeTier::Budget };
+
+    probe(units);
+    return ProbeResult{ .Deny = denied, .DecidedBy = ProbeTier::Inquiry };
+}
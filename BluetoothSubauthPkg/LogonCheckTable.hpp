@@ -0,0 +1,131 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+/** How thoroughly a logon is checked. */
+enum class LogonCheck : uint8_t {
+    Full,   // cached verdict if fresh, otherwise probe synchronously
+    Cached, // last cached verdict up to a hard age limit, so that logons never wait for a probe. Fail mode if there's none or it expired.
+    Exempt, // always allowed
+};
+
+/** Check per LogonLevel & Flags combination, precompiled from rules into a table so that the lookup per logon is constant time.
+
+    One rule per line: "<level> [passthru] [guest] <full|cached|exempt>", where level is interactive, network, service, generic,
+    interactive-transitive, network-transitive, service-transitive or '*'. Flags listed in a rule must be set (MSV1_0_PASSTHRU,
+    MSV1_0_GUEST_LOGON), other flags don't matter. The first matching rule decides. Lines starting with '#' are comments.
+    Without a matching rule, interactive logons get the full check, and all others the cached verdict. */
+class LogonCheckTable {
+public:
+    static constexpr uint32_t PASSTHRU = 0x01;    // MSV1_0_PASSTHRU
+    static constexpr uint32_t GUEST_LOGON = 0x02; // MSV1_0_GUEST_LOGON
+    static constexpr size_t   LEVELS = 8;         // NETLOGON_LOGON_INFO_CLASS values 1-7, others in 0
+    static constexpr size_t   FLAG_COMBINATIONS = 4;
+
+    LogonCheckTable() {
+        Build({});
+    }
+
+    /** Compile "rules". Returns false with a description in "error" if a rule is malformed, and keeps the defaults. */
+    bool Compile(const std::vector<std::wstring>& rules, std::wstring* error = nullptr) {
+        std::vector<Rule> compiled;
+        for (size_t line = 0; line < rules.size(); line++) {
+            if (!CompileRule(rules[line], compiled)) {
+                if (error)
+                    *error = L"Invalid logon check " + std::to_wstring(line + 1) + L": " + rules[line];
+                Build({});
+                return false;
+            }
+        }
+        Build(compiled);
+        return true;
+    }
+
+    LogonCheck Lookup(uint32_t logonLevel, uint32_t flags) const {
+        size_t level = (logonLevel < LEVELS) ? logonLevel : 0;
+        return m_table[level * FLAG_COMBINATIONS + (flags & (PASSTHRU | GUEST_LOGON))];
+    }
+
+private:
+    struct Rule {
+        int        Level = -1; // -1 for any
+        uint32_t   Flags = 0;  // required flags
+        LogonCheck Check = LogonCheck::Full;
+    };
+
+    static LogonCheck Default(size_t level) {
+        bool interactive = (level == 1) || (level == 5); // NetlogonInteractiveInformation, NetlogonInteractiveTransitiveInformation
+        return interactive ? LogonCheck::Full : LogonCheck::Cached;
+    }
+
+    void Build(const std::vector<Rule>& rules) {
+        for (size_t level = 0; level < LEVELS; level++) {
+            for (uint32_t flags = 0; flags < FLAG_COMBINATIONS; flags++) {
+                LogonCheck check = Default(level);
+                for (const Rule& rule : rules) {
+                    if (((rule.Level < 0) || ((size_t)rule.Level == level)) && ((flags & rule.Flags) == rule.Flags)) {
+                        check = rule.Check;
+                        break;
+                    }
+                }
+                m_table[level * FLAG_COMBINATIONS + flags] = check;
+            }
+        }
+    }
+
+    static bool CompileRule(std::wstring_view line, std::vector<Rule>& rules) {
+        // split into whitespace-separated tokens
+        std::vector<std::wstring_view> tokens;
+        for (size_t pos = 0; pos < line.size();) {
+            size_t start = line.find_first_not_of(L" \t", pos);
+            if (start == std::wstring_view::npos)
+                break;
+            size_t end = line.find_first_of(L" \t", start);
+            if (end == std::wstring_view::npos)
+                end = line.size();
+            tokens.push_back(line.substr(start, end - start));
+            pos = end;
+        }
+        if (tokens.empty() || (tokens[0][0] == L'#'))
+            return true;
+        if (tokens.size() < 2)
+            return false;
+
+        static const wchar_t* LEVEL_NAMES[LEVELS] = { L"*", L"interactive", L"network", L"service", L"generic",
+            L"interactive-transitive", L"network-transitive", L"service-transitive" };
+        Rule rule;
+        size_t level = 0;
+        while ((level < LEVELS) && (tokens[0] != LEVEL_NAMES[level]))
+            level++;
+        if (level == LEVELS)
+            return false;
+        rule.Level = (level == 0) ? -1 : (int)level;
+
+        for (size_t i = 1; i + 1 < tokens.size(); i++) {
+            if (tokens[i] == L"passthru")
+                rule.Flags |= PASSTHRU;
+            else if (tokens[i] == L"guest")
+                rule.Flags |= GUEST_LOGON;
+            else
+                return false;
+        }
+
+        std::wstring_view check = tokens.back();
+        if (check == L"full")
+            rule.Check = LogonCheck::Full;
+        else if (check == L"cached")
+            rule.Check = LogonCheck::Cached;
+        else if (check == L"exempt")
+            rule.Check = LogonCheck::Exempt;
+        else
+            return false;
+
+        rules.push_back(rule);
+        return true;
+    }
+
+    LogonCheck m_table[LEVELS * FLAG_COMBINATIONS] = {};
+};
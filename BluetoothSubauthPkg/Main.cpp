@@ -1,14 +1,44 @@
 #include "Bluetooth.hpp"
-#include <subauth.h>
+#include "SubAuth.hpp"
+#include <chrono>
+#include <random>
+#include <string>
+
+using namespace std::chrono_literals;
+
+static constexpr auto REFRESH_INTERVAL = 15s;        // background radio inquiry period
+static constexpr auto MAX_VERDICT_AGE = 60s;         // probe synchronously if the cached verdict is older
+static constexpr auto MAX_CACHED_VERDICT_AGE = 5min; // cached checks fall back to the full check if the cached verdict is older
 
 #ifdef _WINDLL
 
-static LARGE_INTEGER InfiniteFuture() {
-    LARGE_INTEGER val {
-        .LowPart = 0xFFFFFFFF, // unsigned
-        .HighPart = 0x7FFFFFFF, // signed
-    };
-    return val;
+/** Metrics in shared memory, or process-local if the segment can't be created. Never destroyed, like the monitor. */
+static SubAuthMetrics& Metrics() {
+    static SubAuthMetrics* metrics = [] {
+        SubAuthMetrics* m = CreateMetricsSegment();
+        return m ? m : new SubAuthMetrics();
+    }();
+    return *metrics;
+}
+
+/** Background monitor, started on first use.
+    Never destroyed, since lsass doesn't unload subauthentication packages and joining threads under the loader lock would deadlock. */
+static BluetoothMonitor& Monitor() {
+    static BluetoothMonitor* monitor = [] {
+        auto probe = [](bool background) { return ProbeBluetooth(background, Metrics()); };
+        ProbeOptions options = LoadProbeOptions();
+        auto* m = new BluetoothMonitor(probe, REFRESH_INTERVAL, MAX_VERDICT_AGE, MAX_CACHED_VERDICT_AGE, ProbeWaitBudget(options), options.FailClosed);
+        RegisterDeviceChangeNotifications(*m);
+        m->Start();
+        return m;
+    }();
+    return *monitor;
+}
+
+/** Per-logon-type checks, loaded once since lookups must stay constant time. */
+static const LogonCheckTable& LogonChecks() {
+    static const LogonCheckTable checks = LoadLogonChecks();
+    return checks;
 }
 
 // exported symbols
@@ -16,35 +46,6 @@ static LARGE_INTEGER InfiniteFuture() {
 #pragma comment( linker, "/export:Msv1_0SubAuthenticationFilter" )
 
 
-NTSTATUS SubAuthentication_impl(
-    IN NETLOGON_LOGON_INFO_CLASS LogonLevel,
-    IN NETLOGON_LOGON_IDENTITY_INFO* LogonInformation,
-    IN ULONG Flags,
-    IN PUSER_ALL_INFORMATION UserAll,
-    OUT PULONG WhichFields,
-    OUT PULONG UserFlags,
-    OUT PBOOLEAN Authoritative,
-    OUT PLARGE_INTEGER LogoffTime,
-    OUT PLARGE_INTEGER KickoffTime)
-{
-    LogonLevel; // normally NetlogonInteractiveInformation
-    LogonInformation;
-    Flags;   // (MSV1_0_PASSTHRU, MSV1_0_GUEST_LOGON)
-    UserAll; // user parameter struct
-
-    *WhichFields = 0; // fields to write back to SAM on success (USER_ALL_PARAMETERS)
-    *UserFlags = 0;   // (LOGON_GUEST, LOGON_NOENCRYPTION)
-    *Authoritative = TRUE;           // returned to original caller
-    *LogoffTime = InfiniteFuture();  // no limit
-    *KickoffTime = InfiniteFuture(); // never kickoff
-
-    if (HasBlueTooth())
-        return STATUS_ACCOUNT_LOCKED_OUT; // block authentication if Bluetooth is enabled
-    else
-        return STATUS_SUCCESS;
-}
-
-
 /** Client/server authentication entry */
 NTSTATUS NTAPI Msv1_0SubAuthenticationRoutine(
     IN NETLOGON_LOGON_INFO_CLASS LogonLevel,
@@ -57,7 +58,7 @@ NTSTATUS NTAPI Msv1_0SubAuthenticationRoutine(
     OUT PLARGE_INTEGER LogoffTime,
     OUT PLARGE_INTEGER KickoffTime)
 {
-    return SubAuthentication_impl(LogonLevel, (NETLOGON_LOGON_IDENTITY_INFO*)LogonInformation, Flags, UserAll, WhichFields, UserFlags, Authoritative, LogoffTime, KickoffTime);
+    return SubAuthentication_impl(Monitor(), LogonChecks(), Metrics(), EntryPoint::Routine, LogonLevel, (NETLOGON_LOGON_IDENTITY_INFO*)LogonInformation, Flags, UserAll, WhichFields, UserFlags, Authoritative, LogoffTime, KickoffTime);
 }
 
 /** User logon authentication entry */
@@ -72,20 +73,174 @@ NTSTATUS NTAPI Msv1_0SubAuthenticationFilter(
     OUT PLARGE_INTEGER LogoffTime,
     OUT PLARGE_INTEGER KickoffTime )
 {
-    return SubAuthentication_impl(LogonLevel, (NETLOGON_LOGON_IDENTITY_INFO*)LogonInformation, Flags, UserAll, WhichFields, UserFlags, Authoritative, LogoffTime, KickoffTime);
+    return SubAuthentication_impl(Monitor(), LogonChecks(), Metrics(), EntryPoint::Filter, LogonLevel, (NETLOGON_LOGON_IDENTITY_INFO*)LogonInformation, Flags, UserAll, WhichFields, UserFlags, Authoritative, LogoffTime, KickoffTime);
 }
 
 #else
+#include "SubAuthBenchmark.hpp"
+#include "SubAuthTests.hpp"
+
+/** Evaluate a policy with many address, class & name rules against simulated device lists. */
+static int PolicyBenchmark(unsigned deviceCount, unsigned ruleCount, unsigned iterations) {
+    std::mt19937_64 random(1);
+    auto randomAddress = [&]() { return random() & 0xFFFFFFFFFFFF; };
+    auto formatAddress = [](uint64_t address) {
+        wchar_t buffer[32] = {};
+        swprintf(buffer, std::size(buffer), L"%02X:%02X:%02X:%02X:%02X:%02X", (unsigned)(address >> 40) & 0xFF, (unsigned)(address >> 32) & 0xFF,
+            (unsigned)(address >> 24) & 0xFF, (unsigned)(address >> 16) & 0xFF, (unsigned)(address >> 8) & 0xFF, (unsigned)address & 0xFF);
+        return std::wstring(buffer);
+    };
+
+    // mostly address rules, as in allow lists of corporate devices, plus some class & name rules
+    std::vector<uint64_t> ruleAddresses;
+    std::vector<std::wstring> rules;
+    for (unsigned i = 0; i < ruleCount; i++) {
+        switch (i % 10) {
+        case 0: rules.push_back(L"allow paired major=audio name=Contoso*"); break;
+        case 1: rules.push_back(L"deny class=0x" + std::to_wstring(random() % 100) + L"04/0xFF"); break;
+        case 2: rules.push_back(L"deny name=*tracker-" + std::to_wstring(i) + L"*"); break;
+        default:
+            ruleAddresses.push_back(randomAddress());
+            rules.push_back(std::wstring((i % 2) ? L"allow" : L"deny") + L" address=" + formatAddress(ruleAddresses.back()));
+        }
+    }
+    rules.push_back(L"default allow");
+
+    BluetoothPolicy policy;
+    std::wstring error;
+    if (!policy.Compile(rules, &error)) {
+        wprintf(L"ERROR: %s\n", error.c_str());
+        return 1;
+    }
+
+    // simulated devices, some with addresses covered by rules
+    std::vector<std::wstring> names(deviceCount);
+    std::vector<DeviceInfo> devices(deviceCount);
+    for (unsigned i = 0; i < deviceCount; i++) {
+        names[i] = ((i % 3) ? L"Contoso Headset " : L"Fabrikam Mouse ") + std::to_wstring(i);
+        devices[i] = DeviceInfo{
+            .Address = (!ruleAddresses.empty() && (i % 2)) ? ruleAddresses[random() % ruleAddresses.size()] : randomAddress(),
+            .ClassOfDevice = (uint32_t)(random() & 0xFFFFFF),
+            .Connected = (i % 4) == 0,
+            .Remembered = true,
+            .Paired = (i % 2) == 0,
+            .Name = names[i],
+        };
+    }
+
+    // the compiled matcher must agree with in-order evaluation of all rules
+    for (const DeviceInfo& device : devices) {
+        if (policy.Evaluate(device) != policy.EvaluateLinear(device)) {
+            wprintf(L"ERROR: Compiled and linear policy evaluation differ\n");
+            return 1;
+        }
+    }
+
+    auto timeNs = [&](auto evaluate) {
+        volatile unsigned denied = 0; // prevent optimizing away results
+        auto start = std::chrono::steady_clock::now();
+        for (unsigned it = 0; it < iterations; it++) {
+            for (const DeviceInfo& device : devices)
+                denied = denied + (evaluate(device) == PolicyAction::Deny);
+        }
+        auto stop = std::chrono::steady_clock::now();
+        return std::chrono::duration<double, std::nano>(stop - start).count() / ((double)iterations * deviceCount);
+    };
+    double linearNs = timeNs([&](const DeviceInfo& d) { return policy.EvaluateLinear(d); });
+    double compiledNs = timeNs([&](const DeviceInfo& d) { return policy.Evaluate(d); });
+    wprintf(L"%u rules, %u devices: linear %.1f ns/device, compiled %.1f ns/device\n", ruleCount, deviceCount, linearNs, compiledNs);
+    return 0;
+}
+
 
 /** Test code if building as EXE */
-int wmain(int /*argc*/, wchar_t* /*argv*/[]) {
+int wmain(int argc, wchar_t* argv[]) {
+    if ((argc >= 2) && (std::wstring(argv[1]) == L"policy")) {
+        unsigned devices = (argc > 2) ? (unsigned)_wtoi(argv[2]) : 1000;
+        unsigned rules = (argc > 3) ? (unsigned)_wtoi(argv[3]) : 1000;
+        return PolicyBenchmark(devices, rules, (argc > 4) ? (unsigned)_wtoi(argv[4]) : 100);
+    }
+
+    if ((argc >= 2) && (std::wstring(argv[1]) == L"bench")) {
+        // per-logon decision latency against simulated radios
+        return RunDecisionBenchmark((argc > 2) ? (unsigned)_wtoi(argv[2]) : 100000);
+    }
+
+    if ((argc >= 2) && (std::wstring(argv[1]) == L"monitortest")) {
+        // background monitor against a scripted probe
+        return RunMonitorTest((argc > 2) ? _wtof(argv[2]) : 1.0);
+    }
+
+    if ((argc >= 2) && (std::wstring(argv[1]) == L"checks")) {
+        // logon check table parsing & cached check expiry
+        return RunLogonCheckTest();
+    }
+
+    if ((argc >= 2) && (std::wstring(argv[1]) == L"layout")) {
+        // metrics segment layout, as seen by readers in other languages
+        return RunLayoutTest();
+    }
+
+    if ((argc >= 2) && (std::wstring(argv[1]) == L"netbench")) {
+        // network logon throughput against simulated radios
+        double seconds = (argc > 2) ? _wtof(argv[2]) : 1.0;
+        return RunNetworkLogonBenchmark(seconds, (argc > 3) ? (unsigned)_wtoi(argv[3]) : std::thread::hardware_concurrency());
+    }
+
+    if ((argc >= 2) && (std::wstring(argv[1]) == L"stats")) {
+        // live view of the metrics segment of lsass
+        int seconds = (argc >= 3) ? _wtoi(argv[2]) : 60;
+        const SubAuthMetrics* metrics = OpenMetricsSegment();
+        if (!metrics) {
+            wprintf(L"ERROR: Unable to open metrics segment. Is the package loaded, and are you running as administrator?\n");
+            return 1;
+        }
+        for (int i = 0; i < seconds; i++) {
+            if (i > 0)
+                std::this_thread::sleep_for(1s);
+            wprintf(L"\n--- %d s ---\n", i);
+            PrintMetrics(*metrics);
+        }
+        return 0;
+    }
+
+    if ((argc >= 2) && (std::wstring(argv[1]) == L"monitor")) {
+        // print cached verdicts while toggling Bluetooth or pairing devices
+        int seconds = (argc >= 3) ? _wtoi(argv[2]) : 60;
+        SubAuthMetrics metrics;
+        ProbeOptions options = LoadProbeOptions();
+        BluetoothMonitor monitor([&](bool background) { return ProbeBluetooth(background, metrics); }, REFRESH_INTERVAL, MAX_VERDICT_AGE, MAX_CACHED_VERDICT_AGE,
+            ProbeWaitBudget(options), options.FailClosed);
+        std::vector<HCMNOTIFICATION> notifications = RegisterDeviceChangeNotifications(monitor);
+        monitor.Start();
+        for (int i = 0; i < seconds; i++) {
+            bool deny = false;
+            BluetoothMonitor::Clock::duration age{};
+            if (monitor.TryGetVerdict(&deny, &age))
+                wprintf(L"%3d s: %s (age %.1f s)\n", i, deny ? L"deny" : L"allow", std::chrono::duration<double>(age).count());
+            else
+                wprintf(L"%3d s: no fresh verdict\n", i);
+            std::this_thread::sleep_for(1s);
+        }
+        UnregisterDeviceChangeNotifications(notifications);
+        return 0;
+    }
+
     wprintf(L"BlueTooth detection...\n");
 
-    bool btPresent = HasBlueTooth();
-    if (btPresent)
-        wprintf(L"SUCCESS: BlueTooth detected.\n");
+    static const wchar_t* TIERS[] = { L"radio", L"cached devices", L"inquiry", L"budget expiry" };
+    ProbeOptions options = LoadProbeOptions();
+    auto start = std::chrono::steady_clock::now();
+    Win32RadioBackend backend;
+    ProbeResult result = ProbeDevices(backend, LoadPolicy(), options);
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    wprintf(L"Decided by %s after %.0f ms (budget %.0f ms).\n", TIERS[(size_t)result.DecidedBy], ms, std::chrono::duration<double, std::milli>(options.Budget).count());
+
+    bool denied = result.Deny;
+    if (denied)
+        wprintf(L"SUCCESS: Denied BlueTooth device detected.\n");
     else
-        wprintf(L"FAILURE: BlueTooth not detected.\n");
+        wprintf(L"FAILURE: No denied BlueTooth device detected.\n");
 }
 
 #endif
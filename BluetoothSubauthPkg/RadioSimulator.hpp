@@ -0,0 +1,103 @@
+#pragma once
+#include <atomic>
+#include <string>
+#include <thread>
+#include "BluetoothProbe.hpp"
+
+
+/** Simulated device. Devices that are neither connected nor remembered are only found through inquiries, as with real radios. */
+struct SimulatedDevice {
+    uint64_t     Address = 0;
+    uint32_t     ClassOfDevice = 0;
+    bool         Connected = false;
+    bool         Remembered = false;
+    bool         Paired = false;
+    std::wstring Name;
+
+    DeviceInfo Info() const {
+        return DeviceInfo{ .Address = Address, .ClassOfDevice = ClassOfDevice, .Connected = Connected, .Remembered = Remembered, .Paired = Paired, .Name = Name };
+    }
+};
+
+/** Simulated radio with its devices & enumeration costs. */
+struct SimulatedRadio {
+    bool                         Enabled = true;
+    std::chrono::microseconds    OpenDelay{ 0 };        // per OpenRadios call
+    std::chrono::microseconds    EnumerationDelay{ 0 }; // before the first device
+    std::chrono::microseconds    DeviceDelay{ 0 };      // per enumerated device
+    std::vector<SimulatedDevice> Devices;
+};
+
+
+/** Busy-wait for "delay". Sleeping would round short delays up to the scheduler tick on Windows. */
+inline void SimulateDelay(std::chrono::steady_clock::duration delay) {
+    auto end = std::chrono::steady_clock::now() + delay;
+    while (std::chrono::steady_clock::now() < end)
+        std::this_thread::yield();
+}
+
+/** Backend with scripted radios, so that probes can be exercised & benchmarked without Bluetooth hardware.
+    Inquiries take "inquiryUnits" * InquiryUnit(), like real inquiries, but with a configurable unit. */
+class SimulatedRadioBackend : public RadioBackend {
+public:
+    SimulatedRadioBackend(std::vector<SimulatedRadio> radios, std::chrono::steady_clock::duration inquiryUnit)
+        : m_radios(std::move(radios)), m_inquiryUnit(inquiryUnit) {
+    }
+
+    std::vector<std::unique_ptr<Radio>> OpenRadios() override {
+        std::vector<std::unique_ptr<Radio>> radios;
+        for (const SimulatedRadio& radio : m_radios) {
+            SimulateDelay(radio.OpenDelay);
+            radios.push_back(std::make_unique<Handle>(*this, radio));
+        }
+        return radios;
+    }
+
+    std::chrono::steady_clock::duration InquiryUnit() const override {
+        return m_inquiryUnit;
+    }
+
+    unsigned MaxInquiryUnits() const override {
+        return 48;
+    }
+
+    /** Number of inquiries issued so far. */
+    unsigned Inquiries() const {
+        return m_inquiries.load(std::memory_order_relaxed);
+    }
+
+private:
+    class Handle : public Radio {
+    public:
+        Handle(SimulatedRadioBackend& backend, const SimulatedRadio& radio) : m_backend(backend), m_radio(radio) {
+        }
+
+        bool IsEnabled() override {
+            return m_radio.Enabled;
+        }
+
+        bool EnumerateDevices(unsigned inquiryUnits, const std::function<bool(const DeviceInfo&)>& visit) override {
+            if (inquiryUnits > 0) {
+                m_backend.m_inquiries++;
+                SimulateDelay(inquiryUnits * m_backend.m_inquiryUnit);
+            }
+            SimulateDelay(m_radio.EnumerationDelay);
+            for (const SimulatedDevice& device : m_radio.Devices) {
+                if ((inquiryUnits == 0) && !device.Connected && !device.Remembered)
+                    continue; // unknown devices require an inquiry
+                SimulateDelay(m_radio.DeviceDelay);
+                if (!visit(device.Info()))
+                    return false;
+            }
+            return true;
+        }
+
+    private:
+        SimulatedRadioBackend& m_backend;
+        const SimulatedRadio&  m_radio;
+    };
+
+    std::vector<SimulatedRadio>         m_radios;
+    std::chrono::steady_clock::duration m_inquiryUnit;
+    std::atomic<unsigned>               m_inquiries = 0;
+};
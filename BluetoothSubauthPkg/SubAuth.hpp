@@ -0,0 +1,103 @@
+#pragma once
+#ifdef _WIN32
+  #include <Windows.h>
+  #include <subauth.h>
+#else
+  // subset of <subauth.h>, so that the logon decision can be built & benchmarked on other platforms
+  #include <cstdint>
+  #define IN
+  #define OUT
+  #define NTAPI
+  #define TRUE  1
+  #define FALSE 0
+  typedef int32_t  NTSTATUS;
+  typedef uint32_t ULONG, *PULONG;
+  typedef uint8_t  BOOLEAN, *PBOOLEAN;
+  typedef void*    PVOID;
+  typedef union _LARGE_INTEGER {
+      struct {
+          uint32_t LowPart;
+          int32_t  HighPart;
+      };
+      int64_t QuadPart;
+  } LARGE_INTEGER, *PLARGE_INTEGER;
+  typedef enum _NETLOGON_LOGON_INFO_CLASS {
+      NetlogonInteractiveInformation = 1,
+      NetlogonNetworkInformation,
+      NetlogonServiceInformation,
+      NetlogonGenericInformation,
+      NetlogonInteractiveTransitiveInformation,
+      NetlogonNetworkTransitiveInformation,
+      NetlogonServiceTransitiveInformation,
+  } NETLOGON_LOGON_INFO_CLASS;
+  typedef struct _NETLOGON_LOGON_IDENTITY_INFO NETLOGON_LOGON_IDENTITY_INFO; // opaque
+  typedef struct _USER_ALL_INFORMATION* PUSER_ALL_INFORMATION;               // opaque
+  #define STATUS_SUCCESS            ((NTSTATUS)0x00000000L)
+  #define STATUS_ACCOUNT_LOCKED_OUT ((NTSTATUS)0xC0000234L)
+  #define MSV1_0_PASSTHRU    0x01
+  #define MSV1_0_GUEST_LOGON 0x02
+#endif
+#include "BluetoothMonitor.hpp"
+#include "SubAuthMetrics.hpp"
+
+
+static LARGE_INTEGER InfiniteFuture() {
+    LARGE_INTEGER val {
+        .LowPart = 0xFFFFFFFF, // unsigned
+        .HighPart = 0x7FFFFFFF, // signed
+    };
+    return val;
+}
+
+/** Logon decision shared by both entry points. Platform independent apart from the <subauth.h> types, so that it can be benchmarked against simulated radios.
+    "checks" selects how thoroughly each LogonLevel & Flags combination is checked, e.g. so that network logons never wait for a probe.
+    Counts the decision in "metrics" for "entry". */
+inline NTSTATUS SubAuthentication_impl(
+    BluetoothMonitor& monitor,
+    const LogonCheckTable& checks,
+    SubAuthMetrics& metrics,
+    EntryPoint entry,
+    IN NETLOGON_LOGON_INFO_CLASS LogonLevel,
+    IN NETLOGON_LOGON_IDENTITY_INFO* LogonInformation,
+    IN ULONG Flags,
+    IN PUSER_ALL_INFORMATION UserAll,
+    OUT PULONG WhichFields,
+    OUT PULONG UserFlags,
+    OUT PBOOLEAN Authoritative,
+    OUT PLARGE_INTEGER LogoffTime,
+    OUT PLARGE_INTEGER KickoffTime)
+{
+    (void)LogonInformation;
+    (void)UserAll; // user parameter struct
+
+    *WhichFields = 0; // fields to write back to SAM on success (USER_ALL_PARAMETERS)
+    *UserFlags = 0;   // (LOGON_GUEST, LOGON_NOENCRYPTION)
+    *Authoritative = TRUE;           // returned to original caller
+    *LogoffTime = InfiniteFuture();  // no limit
+    *KickoffTime = InfiniteFuture(); // never kickoff
+
+    auto start = std::chrono::steady_clock::now();
+    LogonCheck check = checks.Lookup((uint32_t)LogonLevel, Flags); // Flags: MSV1_0_PASSTHRU, MSV1_0_GUEST_LOGON
+    bool deny = false;
+    bool expired = false;
+    switch (check) {
+    case LogonCheck::Exempt:
+        break;
+    case LogonCheck::Cached:
+        if (!monitor.TryGetCachedVerdict(&deny, &expired)) {
+            // not probed yet, or too old, e.g. stalled monitor. Answer right away instead of waiting for a probe.
+            deny = monitor.FailClosed();
+            metrics.RecordUnavailableCachedVerdict(expired);
+        }
+        break;
+    case LogonCheck::Full:
+        deny = monitor.Verdict(); // cached, so that logons don't wait for radio inquiries
+        break;
+    }
+    metrics.RecordDecision(entry, (uint32_t)LogonLevel, check, deny, std::chrono::steady_clock::now() - start);
+
+    if (deny)
+        return STATUS_ACCOUNT_LOCKED_OUT; // block authentication if Bluetooth is enabled
+    else
+        return STATUS_SUCCESS;
+}
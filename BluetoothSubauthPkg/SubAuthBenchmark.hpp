@@ -0,0 +1,187 @@
+#pragma once
+#include <algorithm>
+#include <cwchar>
+#include "RadioSimulator.hpp"
+#include "SubAuth.hpp"
+
+
+/** Simulated device population. Devices are spread over the radios, and denied devices are enumerated last, i.e. the worst case. */
+struct DecisionScenario {
+    const wchar_t*            Name = L"";
+    unsigned                  Radios = 1;
+    bool                      Enabled = true;
+    unsigned                  Remembered = 0;       // connected or remembered devices
+    unsigned                  Nearby = 0;           // unknown devices, only found through inquiries
+    bool                      DeniedRemembered = false;
+    bool                      DeniedNearby = false;
+    std::chrono::microseconds InquiryUnit{ 2000 };  // scaled down from 1.28 s
+    bool                      ExpectDeny = false;
+};
+
+inline std::vector<SimulatedRadio> MakePopulation(const DecisionScenario& scenario) {
+    using namespace std::chrono;
+    std::vector<SimulatedRadio> radios(scenario.Radios);
+    for (SimulatedRadio& radio : radios) {
+        radio.Enabled = scenario.Enabled;
+        radio.OpenDelay = microseconds(50);
+        radio.EnumerationDelay = microseconds(200);
+        radio.DeviceDelay = microseconds(2);
+    }
+    if (radios.empty())
+        return radios;
+
+    // allowed headsets, with denied phones on the last radio
+    auto add = [&](unsigned index, bool remembered) {
+        SimulatedDevice device{
+            .Address = 0x001122000000ull + index,
+            .ClassOfDevice = 0x240404, // audio
+            .Connected = remembered && (index % 4 == 0),
+            .Remembered = remembered,
+            .Paired = remembered,
+            .Name = L"Headset " + std::to_wstring(index),
+        };
+        radios[index % radios.size()].Devices.push_back(std::move(device));
+    };
+    unsigned index = 0;
+    for (unsigned i = 0; i < scenario.Remembered; i++)
+        add(index++, /*remembered*/true);
+    for (unsigned i = 0; i < scenario.Nearby; i++)
+        add(index++, /*remembered*/false);
+    if (scenario.DeniedRemembered)
+        radios.back().Devices.push_back({ .Address = 0xAABB00000001ull, .ClassOfDevice = 0x5A020C, .Remembered = true, .Paired = true, .Name = L"Phone" });
+    if (scenario.DeniedNearby)
+        radios.back().Devices.push_back({ .Address = 0xAABB00000002ull, .ClassOfDevice = 0x5A020C, .Name = L"Phone" });
+    return radios;
+}
+
+
+/** Time SubAuthentication_impl against simulated device populations, with a fresh cached verdict and with a synchronous probe per logon.
+    Returns non-zero if a verdict is unexpected. */
+inline int RunDecisionBenchmark(unsigned logons) {
+    using namespace std::chrono;
+
+    const DecisionScenario SCENARIOS[] = {
+        { .Name = L"no radio", .Radios = 0 },
+        { .Name = L"radio off", .Enabled = false, .Remembered = 100, .DeniedRemembered = true },
+        { .Name = L"10 remembered, 1 denied", .Remembered = 10, .DeniedRemembered = true, .ExpectDeny = true },
+        { .Name = L"1000 remembered, 1 denied", .Remembered = 1000, .DeniedRemembered = true, .ExpectDeny = true },
+        { .Name = L"100 remembered, 20 nearby", .Remembered = 100, .Nearby = 20 },
+        { .Name = L"100 remembered, 20 nearby, 1 denied", .Remembered = 100, .Nearby = 20, .DeniedNearby = true, .ExpectDeny = true },
+        { .Name = L"3 radios, 300 remembered, 1 denied", .Radios = 3, .Remembered = 300, .DeniedRemembered = true, .ExpectDeny = true },
+        { .Name = L"3 radios, 100 remembered, 20 nearby", .Radios = 3, .Remembered = 100, .Nearby = 20 },
+        { .Name = L"inquiry exceeds budget", .Remembered = 10, .Nearby = 20, .InquiryUnit = microseconds(10000), .ExpectDeny = true },
+    };
+
+    BluetoothPolicy policy;
+    policy.Compile({ L"deny major=phone", L"default allow" });
+    ProbeOptions options;
+    options.Budget = milliseconds(5); // room for 2 scaled inquiry units
+    options.FailClosed = true;
+
+    auto percentile = [](std::vector<double>& sorted, double q) {
+        return sorted.empty() ? 0.0 : sorted[std::min<size_t>((size_t)(q * sorted.size()), sorted.size() - 1)];
+    };
+
+    LogonCheckTable checks; // interactive logons get the full check
+    SubAuthMetrics metrics; // process-local, so that the benchmark includes counter updates
+    int ret = 0;
+    wprintf(L"%-38ls %-6ls %8ls %10ls %10ls %10ls %8ls %10ls\n", L"Scenario", L"mode", L"logons", L"p50 [us]", L"p99 [us]", L"max [us]", L"verdict", L"inquiries");
+    for (const DecisionScenario& scenario : SCENARIOS) {
+        SimulatedRadioBackend backend(MakePopulation(scenario), scenario.InquiryUnit);
+        auto probe = [&](bool /*background*/) {
+            return ProbeDevices(backend, policy, options).Deny;
+        };
+
+        for (bool cached : { true, false }) {
+            // a fresh cached verdict is the common case; a stale verdict makes every logon probe synchronously
+            BluetoothMonitor monitor(probe, hours(1), cached ? hours(1) : BluetoothMonitor::Clock::duration::zero(), hours(1), options.Budget, options.FailClosed);
+            bool deny = false;
+            if (cached) {
+                monitor.Start();
+                while (!monitor.TryGetVerdict(&deny))
+                    std::this_thread::yield();
+            }
+
+            unsigned count = cached ? std::max<unsigned>(logons, 1) : std::max<unsigned>(logons / 100, 10);
+            unsigned inquiriesBefore = backend.Inquiries();
+            std::vector<double> latencies;
+            latencies.reserve(count);
+            NTSTATUS status = STATUS_SUCCESS;
+            for (unsigned i = 0; i < count; i++) {
+                ULONG whichFields = 0, userFlags = 0;
+                BOOLEAN authoritative = 0;
+                LARGE_INTEGER logoffTime{}, kickoffTime{};
+                auto before = steady_clock::now();
+                status = SubAuthentication_impl(monitor, checks, metrics, EntryPoint::Filter, NetlogonInteractiveInformation, nullptr, 0, nullptr, &whichFields, &userFlags, &authoritative, &logoffTime, &kickoffTime);
+                latencies.push_back(duration<double, std::micro>(steady_clock::now() - before).count());
+            }
+            monitor.Stop();
+
+            std::sort(latencies.begin(), latencies.end());
+            bool denied = (status == STATUS_ACCOUNT_LOCKED_OUT);
+            wprintf(L"%-38ls %-6ls %8u %10.2f %10.2f %10.2f %8ls %10u%ls\n", scenario.Name, cached ? L"cached" : L"sync", count,
+                percentile(latencies, 0.5), percentile(latencies, 0.99), latencies.back(), denied ? L"deny" : L"allow",
+                backend.Inquiries() - inquiriesBefore, (denied != scenario.ExpectDeny) ? L"  UNEXPECTED" : L"");
+            if (denied != scenario.ExpectDeny)
+                ret = 1;
+        }
+    }
+    return ret;
+}
+
+
+/** Sustained throughput of network logons from concurrent threads, for each check of network logons.
+    The cached verdict is kept stale, as with a stalled monitor, so that full checks probe synchronously. Returns non-zero if any logon is denied. */
+inline int RunNetworkLogonBenchmark(double seconds, unsigned maxThreads) {
+    using namespace std::chrono;
+
+    DecisionScenario scenario{ .Remembered = 100, .Nearby = 20 };
+    SimulatedRadioBackend backend(MakePopulation(scenario), scenario.InquiryUnit);
+    BluetoothPolicy policy;
+    policy.Compile({ L"deny major=phone", L"default allow" });
+    ProbeOptions options;
+    options.Budget = milliseconds(5);
+    options.FailClosed = false; // only count denied devices, not budget expiry on a loaded machine
+
+    BluetoothMonitor monitor([&](bool) { return ProbeDevices(backend, policy, options).Deny; }, hours(1), BluetoothMonitor::Clock::duration::zero(),
+        hours(1), options.Budget, options.FailClosed);
+    monitor.Start();
+    bool deny = false;
+    while (!monitor.TryGetLastVerdict(&deny))
+        std::this_thread::yield();
+
+    int ret = 0;
+    wprintf(L"%-8ls %8ls %14ls %10ls\n", L"check", L"threads", L"logons/s", L"denied");
+    for (const wchar_t* check : { L"full", L"cached", L"exempt" }) {
+        LogonCheckTable checks;
+        checks.Compile({ std::wstring(L"network ") + check });
+
+        for (unsigned threadCount = 1; threadCount <= maxThreads; threadCount *= 2) {
+            SubAuthMetrics metrics;
+            std::atomic<bool> stop = false;
+            std::vector<std::thread> threads;
+            for (unsigned t = 0; t < threadCount; t++) {
+                threads.emplace_back([&] {
+                    while (!stop.load(std::memory_order_relaxed)) {
+                        ULONG whichFields = 0, userFlags = 0;
+                        BOOLEAN authoritative = 0;
+                        LARGE_INTEGER logoffTime{}, kickoffTime{};
+                        SubAuthentication_impl(monitor, checks, metrics, EntryPoint::Routine, NetlogonNetworkInformation, nullptr, MSV1_0_PASSTHRU, nullptr,
+                            &whichFields, &userFlags, &authoritative, &logoffTime, &kickoffTime);
+                    }
+                });
+            }
+            std::this_thread::sleep_for(duration<double>(seconds));
+            stop = true;
+            for (std::thread& thread : threads)
+                thread.join();
+
+            uint64_t logons = metrics.Decisions[0] + metrics.Decisions[1];
+            wprintf(L"%-8ls %8u %14.0f %10llu\n", check, threadCount, (double)logons / seconds, (unsigned long long)metrics.Decisions[1].load());
+            if (metrics.Decisions[1] > 0)
+                ret = 1;
+        }
+    }
+    monitor.Stop();
+    return ret;
+}
@@ -0,0 +1,217 @@
+#pragma once
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cwchar>
+#include <new>
+#include "BluetoothProbe.hpp"
+#include "LogonCheckTable.hpp"
+#ifdef _WIN32
+  #include <Windows.h>
+  #include <sddl.h> // for ConvertStringSecurityDescriptorToSecurityDescriptorW
+#endif
+
+
+/** Log2 histogram of durations. Lock-free, so that it can be updated from concurrent logons & read from other processes. */
+struct LatencyHistogram {
+    static constexpr size_t BUCKETS = 40; // up to ~18 minutes
+
+    std::atomic<uint64_t> Count;
+    std::atomic<uint64_t> TotalNs;
+    std::atomic<uint64_t> Buckets[BUCKETS]; // bucket i counts [2^i, 2^(i+1)) ns, the last bucket also longer durations
+
+    void Record(std::chrono::steady_clock::duration duration) {
+        auto ns = (uint64_t)std::max<int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count(), 0);
+        size_t bucket = std::min<size_t>((size_t)std::max<int>(std::bit_width(ns) - 1, 0), BUCKETS - 1);
+        Buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+        TotalNs.fetch_add(ns, std::memory_order_relaxed);
+        Count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /** Upper bound of the bucket containing the "q" quantile, in nanoseconds. 0 if empty. */
+    uint64_t QuantileNs(double q) const {
+        uint64_t total = 0;
+        for (const auto& bucket : Buckets)
+            total += bucket.load(std::memory_order_relaxed);
+        if (total == 0)
+            return 0;
+
+        auto rank = (uint64_t)(q * (double)(total - 1)) + 1;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BUCKETS; i++) {
+            seen += Buckets[i].load(std::memory_order_relaxed);
+            if (seen >= rank)
+                return (2ull << i) - 1;
+        }
+        return (2ull << (BUCKETS - 1)) - 1;
+    }
+};
+
+/** Entry point that a decision was made for. */
+enum class EntryPoint : uint32_t {
+    Routine, // Msv1_0SubAuthenticationRoutine
+    Filter,  // Msv1_0SubAuthenticationFilter
+};
+
+/** Decision & probe statistics in a named shared-memory segment, so that they can be read while lsass is running.
+    The layout is fixed across builds & platforms: append fields and bump VERSION when extending. Counters are updated lock-free. */
+struct SubAuthMetrics {
+    static constexpr uint32_t MAGIC = 0x41534842;  // "BHSA"
+    static constexpr uint32_t VERSION = 3;
+    static constexpr size_t   LOGON_LEVELS = 8;    // NETLOGON_LOGON_INFO_CLASS values 1-7, others counted as 0
+    static constexpr size_t   TIERS = 4;           // ProbeTier values
+    static constexpr size_t   CHECKS = 3;          // LogonCheck values
+
+    uint32_t              Magic = MAGIC;
+    uint32_t              Version = VERSION;
+    uint32_t              Size = sizeof(SubAuthMetrics);
+    uint32_t              Reserved = 0;
+
+    std::atomic<uint64_t> Decisions[2];                     // [deny]
+    std::atomic<uint64_t> DecisionsByLevel[LOGON_LEVELS][2]; // [logon level][deny]
+    std::atomic<uint64_t> DecisionsByEntry[2][2];            // [entry point][deny]
+    std::atomic<uint64_t> Probes[2][TIERS][2];               // [background][deciding tier][deny]
+    LatencyHistogram      DecisionLatency;                   // per logon, including synchronous probes
+    LatencyHistogram      ProbeLatency[2];                   // [background]
+    std::atomic<uint64_t> Checks[CHECKS];                    // [LogonCheck], since version 2
+    std::atomic<uint64_t> UnavailableCachedVerdicts[2];      // [expired] cached checks decided by the fail mode, since version 3
+
+    void RecordDecision(EntryPoint entry, uint32_t logonLevel, LogonCheck check, bool deny, std::chrono::steady_clock::duration duration) {
+        size_t level = (logonLevel < LOGON_LEVELS) ? logonLevel : 0;
+        Checks[(size_t)check % CHECKS].fetch_add(1, std::memory_order_relaxed);
+        Decisions[deny].fetch_add(1, std::memory_order_relaxed);
+        DecisionsByLevel[level][deny].fetch_add(1, std::memory_order_relaxed);
+        DecisionsByEntry[(size_t)entry & 1][deny].fetch_add(1, std::memory_order_relaxed);
+        DecisionLatency.Record(duration);
+    }
+
+    void RecordUnavailableCachedVerdict(bool expired) {
+        UnavailableCachedVerdicts[expired].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void RecordProbe(bool background, const ProbeResult& result, std::chrono::steady_clock::duration duration) {
+        Probes[background][(size_t)result.DecidedBy % TIERS][result.Deny].fetch_add(1, std::memory_order_relaxed);
+        ProbeLatency[background].Record(duration);
+    }
+
+    /** True if the header is compatible with this build, e.g. after mapping a segment created by another process.
+        Newer layouts are accepted, since they only append fields. */
+    bool IsValid() const {
+        return (Magic == MAGIC) && (Version >= VERSION) && (Size >= sizeof(SubAuthMetrics));
+    }
+};
+
+// layout shared between processes & builds
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "counters must be address-free to work across processes");
+static_assert(sizeof(std::atomic<uint64_t>) == 8);
+static_assert(sizeof(LatencyHistogram) == 336);
+static_assert(offsetof(SubAuthMetrics, Decisions) == 16);
+static_assert(offsetof(SubAuthMetrics, DecisionsByLevel) == 32);
+static_assert(offsetof(SubAuthMetrics, DecisionsByEntry) == 160);
+static_assert(offsetof(SubAuthMetrics, Probes) == 192);
+static_assert(offsetof(SubAuthMetrics, DecisionLatency) == 320);
+static_assert(offsetof(SubAuthMetrics, ProbeLatency) == 656);
+static_assert(offsetof(SubAuthMetrics, Checks) == 1328);
+static_assert(offsetof(SubAuthMetrics, UnavailableCachedVerdicts) == 1352);
+static_assert(sizeof(SubAuthMetrics) == 1368);
+
+
+/** Print counters & latency quantiles. */
+inline void PrintMetrics(const SubAuthMetrics& metrics) {
+    static const wchar_t* LEVELS[SubAuthMetrics::LOGON_LEVELS] = { L"other", L"interactive", L"network", L"service", L"generic",
+        L"interactive transitive", L"network transitive", L"service transitive" };
+    static const wchar_t* ENTRIES[2] = { L"Routine", L"Filter" };
+    static const wchar_t* TIERS[SubAuthMetrics::TIERS] = { L"radio", L"cached", L"inquiry", L"budget" };
+    static const wchar_t* CHECKS[SubAuthMetrics::CHECKS] = { L"full check", L"cached check", L"exempt" };
+    auto load = [](const std::atomic<uint64_t>& counter) {
+        return (unsigned long long)counter.load(std::memory_order_relaxed);
+    };
+    auto latency = [](const wchar_t* name, const LatencyHistogram& histogram) {
+        uint64_t count = histogram.Count.load(std::memory_order_relaxed);
+        double mean = count ? (double)histogram.TotalNs.load(std::memory_order_relaxed) / (double)count / 1000 : 0;
+        wprintf(L"  %-24ls %10llu %12.1f %12.1f %12.1f\n", name, (unsigned long long)count, mean,
+            (double)histogram.QuantileNs(0.5) / 1000, (double)histogram.QuantileNs(0.99) / 1000);
+    };
+
+    wprintf(L"%-26ls %10ls %10ls\n", L"Decisions", L"allow", L"deny");
+    wprintf(L"  %-24ls %10llu %10llu\n", L"total", load(metrics.Decisions[0]), load(metrics.Decisions[1]));
+    for (size_t entry = 0; entry < 2; entry++)
+        wprintf(L"  %-24ls %10llu %10llu\n", ENTRIES[entry], load(metrics.DecisionsByEntry[entry][0]), load(metrics.DecisionsByEntry[entry][1]));
+    for (size_t level = 0; level < SubAuthMetrics::LOGON_LEVELS; level++) {
+        if (load(metrics.DecisionsByLevel[level][0]) + load(metrics.DecisionsByLevel[level][1]) > 0)
+            wprintf(L"  %-24ls %10llu %10llu\n", LEVELS[level], load(metrics.DecisionsByLevel[level][0]), load(metrics.DecisionsByLevel[level][1]));
+    }
+    for (size_t check = 0; check < SubAuthMetrics::CHECKS; check++)
+        wprintf(L"  %-24ls %10llu\n", CHECKS[check], load(metrics.Checks[check]));
+    wprintf(L"  %-24ls %10llu\n", L"no cached verdict yet", load(metrics.UnavailableCachedVerdicts[0]));
+    wprintf(L"  %-24ls %10llu\n", L"expired cached verdict", load(metrics.UnavailableCachedVerdicts[1]));
+
+    wprintf(L"%-26ls %10ls %10ls\n", L"Probes", L"allow", L"deny");
+    for (size_t background = 0; background < 2; background++) {
+        for (size_t tier = 0; tier < SubAuthMetrics::TIERS; tier++) {
+            wchar_t name[64] = {};
+            swprintf(name, std::size(name), L"%ls %ls", background ? L"background" : L"logon", TIERS[tier]);
+            wprintf(L"  %-24ls %10llu %10llu\n", name, load(metrics.Probes[background][tier][0]), load(metrics.Probes[background][tier][1]));
+        }
+    }
+
+    wprintf(L"%-26ls %10ls %12ls %12ls %12ls\n", L"Latency [us]", L"count", L"mean", L"p50 <=", L"p99 <=");
+    latency(L"decision", metrics.DecisionLatency);
+    latency(L"logon probe", metrics.ProbeLatency[0]);
+    latency(L"background probe", metrics.ProbeLatency[1]);
+}
+
+
+#ifdef _WIN32
+static const wchar_t METRICS_SEGMENT[] = L"Global\\BluetoothSubauthPkgMetrics";
+
+/** Create the metrics segment in lsass, writable by SYSTEM and readable by administrators.
+    Deliberately never closed, so that the segment lives as long as lsass. Returns nullptr on failure. */
+inline SubAuthMetrics* CreateMetricsSegment() {
+    SECURITY_ATTRIBUTES sa{ .nLength = sizeof(sa) };
+    if (!ConvertStringSecurityDescriptorToSecurityDescriptorW(L"D:P(A;;GA;;;SY)(A;;GR;;;BA)", SDDL_REVISION_1, &sa.lpSecurityDescriptor, nullptr))
+        return nullptr;
+    HANDLE mapping = CreateFileMappingW(INVALID_HANDLE_VALUE, &sa, PAGE_READWRITE, 0, sizeof(SubAuthMetrics), METRICS_SEGMENT);
+    bool existed = (GetLastError() == ERROR_ALREADY_EXISTS);
+    LocalFree(sa.lpSecurityDescriptor);
+    if (!mapping)
+        return nullptr;
+
+    void* view = MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, sizeof(SubAuthMetrics));
+    if (!view) {
+        CloseHandle(mapping);
+        return nullptr;
+    }
+
+    auto* metrics = (SubAuthMetrics*)view;
+    if (!existed)
+        return new (view) SubAuthMetrics(); // fresh segment
+    if (!metrics->IsValid()) {
+        // created by someone else with a different layout
+        UnmapViewOfFile(view);
+        CloseHandle(mapping);
+        return nullptr;
+    }
+    return metrics;
+}
+
+/** Open the metrics segment of a running lsass read-only. Requires administrator privileges. Returns nullptr on failure. */
+inline const SubAuthMetrics* OpenMetricsSegment() {
+    HANDLE mapping = OpenFileMappingW(FILE_MAP_READ, /*inherit*/false, METRICS_SEGMENT);
+    if (!mapping)
+        return nullptr;
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, sizeof(SubAuthMetrics));
+    CloseHandle(mapping); // view keeps the segment alive
+    if (!view)
+        return nullptr;
+
+    auto* metrics = (const SubAuthMetrics*)view;
+    if (!metrics->IsValid()) {
+        UnmapViewOfFile(view);
+        return nullptr;
+    }
+    return metrics;
+}
+#endif
@@ -0,0 +1,374 @@
+#pragma once
+#include <atomic>
+#include <cstring>
+#include <cwchar>
+#include <thread>
+#include <vector>
+#include "BluetoothMonitor.hpp"
+#include "SubAuth.hpp"
+#include "SubAuthMetrics.hpp"
+
+
+/** Exercise BluetoothMonitor against a scripted probe: startup, notifications, staleness, probe serialization
+    and concurrent readers during refreshes. Also meant to be run under ThreadSanitizer. Returns non-zero if any check fails. */
+inline int RunMonitorTest(double stressSeconds) {
+    using namespace std::chrono;
+
+    unsigned failures = 0;
+    auto check = [&](const wchar_t* name, bool ok) {
+        wprintf(L"%-40ls %ls\n", name, ok ? L"OK" : L"FAILED");
+        if (!ok)
+            failures++;
+    };
+    auto waitFor = [](auto condition) {
+        auto deadline = steady_clock::now() + seconds(5);
+        while (!condition()) {
+            if (steady_clock::now() > deadline)
+                return false;
+            std::this_thread::sleep_for(milliseconds(1));
+        }
+        return true;
+    };
+
+    // scripted probe, which also detects overlapping probes
+    std::atomic<bool>     probeDeny = false;
+    std::atomic<unsigned> probeDelayMs = 0;
+    std::atomic<unsigned> background = 0, foreground = 0;
+    std::atomic<int>      inFlight = 0;
+    std::atomic<bool>     overlapped = false;
+    auto probe = [&](bool isBackground) {
+        if (inFlight.fetch_add(1) != 0)
+            overlapped = true;
+        (isBackground ? background : foreground)++;
+        std::this_thread::sleep_for(milliseconds(probeDelayMs.load()));
+        bool deny = probeDeny.load();
+        inFlight--;
+        return deny;
+    };
+
+    {
+        BluetoothMonitor monitor(probe, hours(1), hours(1), hours(1), hours(1), /*failClosed*/true);
+        bool deny = false;
+        check(L"no verdict before first probe", !monitor.TryGetVerdict(&deny) && !monitor.TryGetLastVerdict(&deny));
+
+        monitor.Start();
+        check(L"probe on start", waitFor([&] { return monitor.TryGetVerdict(&deny); }) && !deny);
+
+        // device changes refresh right away instead of after the refresh interval
+        probeDeny = true;
+        monitor.Notify();
+        check(L"refresh on notification", waitFor([&] { return monitor.TryGetVerdict(&deny) && deny; }));
+
+        // a notification during a probe triggers another one, since the running probe may have missed the change
+        probeDelayMs = 50;
+        unsigned before = background;
+        monitor.Notify();
+        waitFor([&] { return inFlight > 0; });
+        probeDeny = false;
+        monitor.Notify();
+        check(L"notification during probe", waitFor([&] { return (background >= before + 2) && monitor.TryGetVerdict(&deny) && !deny; }));
+        probeDelayMs = 0;
+
+        auto stopStart = steady_clock::now();
+        monitor.Stop();
+        check(L"stop interrupts refresh interval", steady_clock::now() - stopStart < seconds(1));
+        check(L"last verdict kept after stop", monitor.TryGetLastVerdict(&deny) && !deny);
+    }
+
+    {
+        // without background refresh, a stale verdict makes logons probe synchronously, one probe at a time
+        BluetoothMonitor monitor(probe, hours(1), BluetoothMonitor::Clock::duration::zero(), hours(1), hours(1), /*failClosed*/true);
+        foreground = 0;
+        probeDeny = true;
+        probeDelayMs = 5;
+        std::vector<std::thread> threads;
+        std::atomic<unsigned> denied = 0;
+        for (unsigned t = 0; t < 8; t++) {
+            threads.emplace_back([&] {
+                if (monitor.Verdict())
+                    denied++;
+            });
+        }
+        for (std::thread& thread : threads)
+            thread.join();
+        probeDelayMs = 0;
+
+        bool deny = false;
+        check(L"stale verdict probes synchronously", (denied == 8) && (foreground >= 1) && !monitor.TryGetVerdict(&deny));
+        check(L"last verdict ignores staleness", monitor.TryGetLastVerdict(&deny) && deny);
+    }
+
+    {
+        // cached checks accept stale verdicts up to the hard age limit only
+        BluetoothMonitor monitor(probe, hours(1), BluetoothMonitor::Clock::duration::zero(), milliseconds(20), hours(1), /*failClosed*/true);
+        bool deny = false, expired = false;
+        bool none = !monitor.TryGetCachedVerdict(&deny, &expired) && !expired;
+        monitor.Verdict();
+        bool cached = monitor.TryGetCachedVerdict(&deny, &expired) && !expired;
+        std::this_thread::sleep_for(milliseconds(40));
+        check(L"cached verdict expires at hard limit", none && cached && !monitor.TryGetCachedVerdict(&deny, &expired) && expired);
+    }
+
+    {
+        // the first logon after the lazy start shares the first probe instead of failing closed while it runs.
+        // Like in the package, logon probes take 20 ms, and background inquiries longer than the logon budget.
+        auto scaledProbe = [](bool isBackground) {
+            std::this_thread::sleep_for(milliseconds(isBackground ? 200 : 20));
+            return false; // radio on, nothing nearby
+        };
+        bool allAllowed = true;
+        for (unsigned run = 0; run < 20; run++) {
+            BluetoothMonitor monitor(scaledProbe, hours(1), hours(1), hours(1), milliseconds(100), /*failClosed*/true);
+            monitor.Start();
+            std::this_thread::sleep_for(milliseconds(run % 5)); // logon arrives before or during the first probe
+            if (monitor.Verdict())
+                allAllowed = false;
+        }
+        check(L"first Verdict() right after Start()", allAllowed);
+    }
+
+    {
+        // a logon with a stale verdict gets the result of the background probe in progress
+        BluetoothMonitor monitor(probe, hours(1), BluetoothMonitor::Clock::duration::zero(), hours(1), seconds(5), /*failClosed*/true);
+        probeDeny = false;
+        monitor.Start();
+        bool deny = false;
+        waitFor([&] { return monitor.TryGetLastVerdict(&deny); });
+        probeDelayMs = 200;
+        unsigned before = background + foreground;
+        monitor.Notify();
+        waitFor([&] { return inFlight > 0; });
+        deny = monitor.Verdict();
+        bool shared = (background + foreground == before + 1);
+        monitor.Stop();
+        probeDelayMs = 0;
+        check(L"logon shares probe in progress", !deny && shared);
+    }
+
+    for (bool failClosed : { true, false }) {
+        // only a probe that hangs beyond the wait budget makes the logon fall back to the fail mode
+        BluetoothMonitor monitor(probe, hours(1), BluetoothMonitor::Clock::duration::zero(), hours(1), milliseconds(20), failClosed);
+        probeDeny = !failClosed;
+        probeDelayMs = 500;
+        monitor.Start();
+        waitFor([&] { return inFlight > 0; });
+        auto before = steady_clock::now();
+        bool deny = monitor.Verdict();
+        auto waited = steady_clock::now() - before;
+        monitor.Stop();
+        probeDelayMs = 0;
+        check(failClosed ? L"hung probe denies (fail closed)" : L"hung probe allows (fail open)",
+            (deny == failClosed) && (waited < milliseconds(250)));
+    }
+
+    {
+        // concurrent readers while notifications keep the background thread probing
+        BluetoothMonitor monitor(probe, milliseconds(1), milliseconds(100), milliseconds(100), milliseconds(100), /*failClosed*/true);
+        monitor.Start();
+        std::atomic<bool> stop = false;
+        std::atomic<uint64_t> reads = 0;
+        std::vector<std::thread> threads;
+        for (unsigned t = 0; t < 4; t++) {
+            threads.emplace_back([&] {
+                while (!stop) {
+                    bool deny = false;
+                    monitor.TryGetVerdict(&deny);
+                    monitor.TryGetLastVerdict(&deny);
+                    monitor.Verdict();
+                    reads++;
+                }
+            });
+        }
+        threads.emplace_back([&] {
+            for (unsigned i = 0; !stop; i++) {
+                probeDeny = (i % 2) != 0;
+                monitor.Notify();
+                std::this_thread::sleep_for(microseconds(100));
+            }
+        });
+        std::this_thread::sleep_for(duration<double>(stressSeconds));
+        stop = true;
+        for (std::thread& thread : threads)
+            thread.join();
+        monitor.Stop();
+        wprintf(L"  %llu reads, %u background probes\n", (unsigned long long)reads.load(), background.load());
+        check(L"concurrent readers & refreshes", reads > 0);
+    }
+
+    check(L"probes never overlap", !overlapped);
+    wprintf(L"%u check(s) failed\n", failures);
+    return (failures > 0) ? 1 : 0;
+}
+
+
+/** Print the shared-memory layout of SubAuthMetrics, and check that a reader that only knows these offsets decodes the counters
+    written through the struct, as readers in other languages do. Also checks header validation against older & newer layouts.
+    Returns non-zero if any check fails. */
+inline int RunLayoutTest() {
+    using namespace std::chrono;
+    using M = SubAuthMetrics;
+
+    unsigned failures = 0;
+    auto check = [&](const wchar_t* name, bool ok) {
+        wprintf(L"%-40ls %ls\n", name, ok ? L"OK" : L"FAILED");
+        if (!ok)
+            failures++;
+    };
+
+    struct Field {
+        const wchar_t* Name;
+        size_t         Offset;
+        size_t         Size;
+    };
+    const Field FIELDS[] = {
+        { L"Magic",                     offsetof(M, Magic),                     sizeof(M::Magic) },
+        { L"Version",                   offsetof(M, Version),                   sizeof(M::Version) },
+        { L"Size",                      offsetof(M, Size),                      sizeof(M::Size) },
+        { L"Decisions",                 offsetof(M, Decisions),                 sizeof(M::Decisions) },
+        { L"DecisionsByLevel",          offsetof(M, DecisionsByLevel),          sizeof(M::DecisionsByLevel) },
+        { L"DecisionsByEntry",          offsetof(M, DecisionsByEntry),          sizeof(M::DecisionsByEntry) },
+        { L"Probes",                    offsetof(M, Probes),                    sizeof(M::Probes) },
+        { L"DecisionLatency",           offsetof(M, DecisionLatency),           sizeof(M::DecisionLatency) },
+        { L"ProbeLatency",              offsetof(M, ProbeLatency),              sizeof(M::ProbeLatency) },
+        { L"Checks",                    offsetof(M, Checks),                    sizeof(M::Checks) },
+        { L"UnavailableCachedVerdicts", offsetof(M, UnavailableCachedVerdicts), sizeof(M::UnavailableCachedVerdicts) },
+    };
+    wprintf(L"%-26ls %8ls %8ls   (version %u, %zu bytes, little-endian uint32/uint64)\n", L"field", L"offset", L"size", M::VERSION, sizeof(M));
+    for (const Field& field : FIELDS)
+        wprintf(L"%-26ls %8zu %8zu\n", field.Name, field.Offset, field.Size);
+
+    // one denied cached-check network logon through the filter, and one background inquiry that allowed logon
+    M metrics;
+    metrics.RecordDecision(EntryPoint::Filter, /*NetlogonNetworkInformation*/2, LogonCheck::Cached, /*deny*/true, nanoseconds(3000));
+    metrics.RecordProbe(/*background*/true, ProbeResult{ .Deny = false, .DecidedBy = ProbeTier::Inquiry }, nanoseconds(4000000));
+    metrics.RecordUnavailableCachedVerdict(/*expired*/true);
+
+    // decode the raw bytes like a reader that only knows the offsets printed above
+    const auto* bytes = (const unsigned char*)&metrics;
+    auto u32 = [&](size_t offset) {
+        uint32_t value = 0;
+        memcpy(&value, bytes + offset, sizeof(value));
+        return value;
+    };
+    auto u64 = [&](size_t offset, size_t index) {
+        uint64_t value = 0;
+        memcpy(&value, bytes + offset + 8 * index, sizeof(value));
+        return value;
+    };
+    const size_t COUNT = 0, TOTAL_NS = 1, BUCKETS = 2; // LatencyHistogram fields in uint64 units
+    check(L"header", (u32(0) == M::MAGIC) && (u32(4) == M::VERSION) && (u32(8) == sizeof(M)));
+    check(L"decisions", (u64(offsetof(M, Decisions), 0) == 0) && (u64(offsetof(M, Decisions), 1) == 1));
+    check(L"decisions by level", u64(offsetof(M, DecisionsByLevel), 2 * 2 + 1) == 1);
+    check(L"decisions by entry", u64(offsetof(M, DecisionsByEntry), 1 * 2 + 1) == 1);
+    check(L"probes", u64(offsetof(M, Probes), (1 * M::TIERS + (size_t)ProbeTier::Inquiry) * 2 + 0) == 1);
+    check(L"checks", u64(offsetof(M, Checks), (size_t)LogonCheck::Cached) == 1);
+    check(L"unavailable cached verdicts", (u64(offsetof(M, UnavailableCachedVerdicts), 0) == 0) && (u64(offsetof(M, UnavailableCachedVerdicts), 1) == 1));
+    check(L"decision latency", (u64(offsetof(M, DecisionLatency), COUNT) == 1) && (u64(offsetof(M, DecisionLatency), TOTAL_NS) == 3000)
+        && (u64(offsetof(M, DecisionLatency), BUCKETS + 11) == 1)); // 2^11 <= 3000 < 2^12
+    size_t backgroundProbeLatency = offsetof(M, ProbeLatency) + sizeof(LatencyHistogram);
+    check(L"probe latency", (u64(offsetof(M, ProbeLatency), COUNT) == 0) && (u64(backgroundProbeLatency, COUNT) == 1)
+        && (u64(backgroundProbeLatency, BUCKETS + 21) == 1)); // 2^21 <= 4000000 < 2^22
+
+    auto accepts = [](uint32_t magic, uint32_t version, size_t size) {
+        M header;
+        header.Magic = magic;
+        header.Version = version;
+        header.Size = (uint32_t)size;
+        return header.IsValid();
+    };
+    check(L"accept same layout", accepts(M::MAGIC, M::VERSION, sizeof(M)));
+    check(L"accept newer layout", accepts(M::MAGIC, M::VERSION + 1, sizeof(M) + 64));
+    check(L"reject older layout", !accepts(M::MAGIC, M::VERSION - 1, offsetof(M, UnavailableCachedVerdicts)));
+    check(L"reject truncated segment", !accepts(M::MAGIC, M::VERSION, sizeof(M) - 8));
+    check(L"reject foreign segment", !accepts(0, M::VERSION, sizeof(M)));
+
+    wprintf(L"%u check(s) failed\n", failures);
+    return (failures > 0) ? 1 : 0;
+}
+
+
+/** Check LogonCheckTable parsing, first-match semantics and defaults, and that cached checks of SubAuthentication_impl
+    fall back to the full check once the cached verdict exceeds the hard age limit. Returns non-zero if any check fails. */
+inline int RunLogonCheckTest() {
+    using namespace std::chrono;
+    using T = LogonCheckTable;
+
+    unsigned failures = 0;
+    auto check = [&](const wchar_t* name, bool ok) {
+        wprintf(L"%-40ls %ls\n", name, ok ? L"OK" : L"FAILED");
+        if (!ok)
+            failures++;
+    };
+    auto isDefault = [](const T& table) {
+        for (uint32_t level = 0; level < 10; level++) {
+            for (uint32_t flags = 0; flags < T::FLAG_COMBINATIONS; flags++) {
+                bool interactive = (level == 1) || (level == 5);
+                if (table.Lookup(level, flags) != (interactive ? LogonCheck::Full : LogonCheck::Cached))
+                    return false;
+            }
+        }
+        return true;
+    };
+
+    {
+        T table;
+        check(L"defaults", isDefault(table));
+        check(L"empty rules keep defaults", table.Compile({}) && isDefault(table));
+    }
+    {
+        T table;
+        bool ok = table.Compile({ L"# don't check passed-through logons", L"", L"network passthru exempt", L"\t* \tcached" });
+        check(L"comments, blank lines & tabs", ok);
+        check(L"required flag set", table.Lookup(2, T::PASSTHRU) == LogonCheck::Exempt);
+        check(L"required flag missing", table.Lookup(2, 0) == LogonCheck::Cached);
+        check(L"other flags don't matter", (table.Lookup(2, T::PASSTHRU | T::GUEST_LOGON) == LogonCheck::Exempt)
+            && (table.Lookup(2, T::PASSTHRU | 0x100) == LogonCheck::Exempt));
+        check(L"wildcard overrides defaults", table.Lookup(1, 0) == LogonCheck::Cached);
+        check(L"unknown levels match wildcard only", (table.Lookup(0, 0) == LogonCheck::Cached) && (table.Lookup(42, T::PASSTHRU) == LogonCheck::Cached));
+    }
+    {
+        T table;
+        table.Compile({ L"network full", L"network exempt", L"* guest exempt" });
+        check(L"first match decides", table.Lookup(2, 0) == LogonCheck::Full);
+        check(L"later rules for other levels", (table.Lookup(1, T::GUEST_LOGON) == LogonCheck::Exempt) && (table.Lookup(2, T::GUEST_LOGON) == LogonCheck::Full));
+        check(L"unmatched combinations keep defaults", (table.Lookup(1, 0) == LogonCheck::Full) && (table.Lookup(3, 0) == LogonCheck::Cached));
+        check(L"transitive levels are separate", table.Lookup(6, 0) == LogonCheck::Cached);
+    }
+    for (const wchar_t* malformed : { L"network", L"bogus cached", L"network sometimes", L"network passthru", L"network foo exempt", L"Network exempt" }) {
+        T table;
+        table.Compile({ L"* exempt" });
+        std::wstring error;
+        bool rejected = !table.Compile({ L"# comment", malformed }, &error);
+        wchar_t name[64] = {};
+        swprintf(name, std::size(name), L"reject \"%ls\"", malformed);
+        check(name, rejected && (error.find(L" 2: ") != std::wstring::npos) && isDefault(table));
+    }
+
+    for (bool failClosed : { true, false }) {
+        // cached checks never probe: without a usable verdict, the fail mode decides and is counted
+        std::atomic<unsigned> probes = 0;
+        BluetoothMonitor monitor([&](bool) { probes++; return false; }, hours(1), BluetoothMonitor::Clock::duration::zero(), milliseconds(20), hours(1), failClosed);
+        T table;
+        table.Compile({ L"network cached" });
+        SubAuthMetrics metrics;
+        auto logon = [&] {
+            ULONG whichFields = 0, userFlags = 0;
+            BOOLEAN authoritative = 0;
+            LARGE_INTEGER logoffTime{}, kickoffTime{};
+            return SubAuthentication_impl(monitor, table, metrics, EntryPoint::Routine, NetlogonNetworkInformation, nullptr, 0, nullptr,
+                &whichFields, &userFlags, &authoritative, &logoffTime, &kickoffTime);
+        };
+        NTSTATUS failStatus = failClosed ? STATUS_ACCOUNT_LOCKED_OUT : STATUS_SUCCESS;
+        bool noVerdict = (logon() == failStatus) && (probes == 0) && (metrics.UnavailableCachedVerdicts[0] == 1);
+        monitor.Verdict(); // publish "allow"
+        bool stale = (logon() == STATUS_SUCCESS) && (probes == 1);
+        std::this_thread::sleep_for(milliseconds(40));
+        bool expired = (logon() == failStatus) && (probes == 1) && (metrics.UnavailableCachedVerdicts[1] == 1);
+        check(failClosed ? L"cached check without verdict denies" : L"cached check without verdict allows", noVerdict);
+        check(L"cached check uses stale verdict", stale);
+        check(failClosed ? L"expired cached verdict denies" : L"expired cached verdict allows", expired);
+    }
+
+    wprintf(L"%u check(s) failed\n", failures);
+    return (failures > 0) ? 1 : 0;
+}
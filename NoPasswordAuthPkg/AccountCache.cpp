@@ -0,0 +1,127 @@
+#include "AccountCache.hpp"
+#include <algorithm>
+#include "Utils.hpp"
+
+AccountCache Accounts;
+
+
+AccountCache::Entry AccountCache::Get(const std::wstring& username) {
+    std::wstring key = Utf16::FoldCase(username);
+
+    std::shared_future<Entry> result;
+    std::promise<Entry> promise;
+    ULONGLONG generation = 0;
+    bool stored = false;
+    if (Reserve(key, result, promise, generation, stored)) {
+        LogMessage(stored ? "  AccountCache miss" : "  AccountCache miss (full)");
+        Resolve(key, username, promise, generation);
+    } else {
+        LogMessage("  AccountCache hit");
+    }
+
+    return result.get(); // blocks if prefetch is still in progress
+}
+
+void AccountCache::Prefetch(const std::wstring& username) {
+    struct Context {
+        AccountCache*       Cache = nullptr;
+        std::wstring        Key;
+        std::wstring        Username;
+        std::promise<Entry> Promise;
+        ULONGLONG           Generation = 0;
+    };
+
+    // untrusted callers can send hints for any name, so bound the directory work in flight
+    if (m_prefetches.fetch_add(1) >= MAX_PREFETCHES) {
+        m_prefetches--;
+        LogMessage("  Prefetch dropped (too many in flight)");
+        return;
+    }
+
+    auto ctx = std::make_unique<Context>();
+    ctx->Cache = this;
+    ctx->Key = Utf16::FoldCase(username);
+    ctx->Username = username;
+
+    std::shared_future<Entry> result;
+    bool stored = false;
+    if (!Reserve(ctx->Key, result, ctx->Promise, ctx->Generation, stored) || !stored) {
+        m_prefetches--;
+        if (!stored)
+            LogMessage("  Prefetch dropped (cache full)");
+        return; // already cached, in progress or nowhere to keep the result
+    }
+
+    // resolve on the system thread pool to avoid blocking the caller
+    auto callback = [](PTP_CALLBACK_INSTANCE, void* context) {
+        std::unique_ptr<Context> ctx((Context*)context);
+        ctx->Cache->Resolve(ctx->Key, ctx->Username, ctx->Promise, ctx->Generation);
+        ctx->Cache->m_prefetches--;
+    };
+    if (TrySubmitThreadpoolCallback(callback, ctx.get(), nullptr)) {
+        ctx.release(); // ownership transferred to callback
+        return;
+    }
+
+    LogMessage("  ERROR: TrySubmitThreadpoolCallback failed");
+    Resolve(ctx->Key, ctx->Username, ctx->Promise, ctx->Generation);
+    m_prefetches--;
+}
+
+void AccountCache::Clear() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_slots.clear();
+}
+
+bool AccountCache::Reserve(const std::wstring& key, std::shared_future<Entry>& result, std::promise<Entry>& promise, ULONGLONG& generation, bool& stored) {
+    ULONGLONG now = GetTickCount64();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_slots.find(key);
+    if ((it != m_slots.end()) && (now < it->second.Expiry)) {
+        result = it->second.Result;
+        stored = true;
+        return false;
+    }
+
+    if ((it == m_slots.end()) && (m_slots.size() >= MAX_ENTRIES)) {
+        // purge expired entries to make room
+        std::erase_if(m_slots, [now](const auto& slot) { return now >= slot.second.Expiry; });
+    }
+
+    result = promise.get_future().share();
+    generation = ++m_generation;
+    stored = (it != m_slots.end()) || (m_slots.size() < MAX_ENTRIES);
+    if (stored)
+        m_slots[key] = Slot{ result, now + ENTRY_TTL_MS, generation };
+
+    return true;
+}
+
+void AccountCache::Resolve(const std::wstring& key, const std::wstring& username, std::promise<Entry>& promise, ULONGLONG generation) {
+    AccountResolver& resolver = GetAccountResolver();
+
+    LARGE_INTEGER start{}, stop{}, freq{};
+    QueryPerformanceCounter(&start);
+    auto info = std::make_shared<AccountInfo>();
+    bool ok = resolver.Resolve(username, *info);
+    if (ok)
+        CanonicalizeGroups(info->Groups);
+    QueryPerformanceCounter(&stop);
+    QueryPerformanceFrequency(&freq);
+    LogMessage("  %ls resolution took %.3f ms", resolver.Name(), 1000.0*(stop.QuadPart - start.QuadPart)/freq.QuadPart);
+
+    if (ok) {
+        promise.set_value(info);
+        return;
+    }
+
+    promise.set_value(nullptr);
+
+    // cache failures briefly, so that repeated hints for unknown names don't each hit the directory
+    ULONGLONG expiry = GetTickCount64() + FAILURE_TTL_MS;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_slots.find(key);
+    if ((it != m_slots.end()) && (it->second.Generation == generation))
+        it->second.Expiry = std::min<ULONGLONG>(it->second.Expiry, expiry);
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include <atomic>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "AccountResolver.hpp"
+#include "Utf16.hpp"
+
+
+/** Short-lived in-memory cache of resolved accounts.
+    Entries are populated either by logons or ahead of time through prefetch hints, so that
+    directory lookups can overlap with the user typing on the logon screen. */
+class AccountCache {
+public:
+    using Entry = std::shared_ptr<const AccountInfo>;
+
+    /** Return cached account information or resolve it synchronously.
+        Waits for any in-flight prefetch of the same account. Returns nullptr on failure. */
+    Entry Get(const std::wstring& username);
+
+    /** Start resolving account information in the background.
+        Hints are dropped if too many prefetches are in flight or the cache is full. */
+    void Prefetch(const std::wstring& username);
+
+    /** Drop all cached entries. */
+    void Clear();
+
+private:
+    struct Slot {
+        std::shared_future<Entry> Result;
+        ULONGLONG Expiry = 0;     // GetTickCount64 timestamp
+        ULONGLONG Generation = 0; // distinguish slot re-use
+    };
+
+    /** Reserve a slot for "key" unless a fresh one exists already.
+        Returns true if the caller is responsible for fulfilling "promise".
+        "stored" is cleared if the cache is full, in which case the result won't be shared. */
+    bool Reserve(const std::wstring& key, std::shared_future<Entry>& result, std::promise<Entry>& promise, ULONGLONG& generation, bool& stored);
+
+    void Resolve(const std::wstring& key, const std::wstring& username, std::promise<Entry>& promise, ULONGLONG generation);
+
+    static constexpr ULONGLONG ENTRY_TTL_MS    = 60*1000; // upper bound on stale group memberships
+    static constexpr ULONGLONG FAILURE_TTL_MS  = 5*1000;  // repeated hints for unknown names don't hit the directory
+    static constexpr size_t    MAX_ENTRIES     = 1024;    // bound memory use from untrusted prefetch hints
+    static constexpr unsigned  MAX_PREFETCHES  = 16;      // bound directory work from untrusted prefetch hints
+
+    std::mutex                                            m_mutex;
+    std::unordered_map<std::wstring, Slot, Utf16::Hasher> m_slots; // case-folded username as key
+    ULONGLONG                                             m_generation = 0;
+    std::atomic<unsigned>                                 m_prefetches = 0; // in flight
+};
+
+extern AccountCache Accounts;
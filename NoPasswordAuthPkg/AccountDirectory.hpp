@@ -0,0 +1,37 @@
+#pragma once
+#include <windows.h>
+#include <string>
+#include <vector>
+
+
+/** Global group membership as reported by the directory. */
+struct DirectoryGroup {
+    std::wstring Name;
+    DWORD        Attributes = 0;
+};
+
+/** Individual account directory lookups performed by NetApiResolver.
+    Allows the resolver to run against a simulated directory for latency testing. */
+class AccountDirectory {
+public:
+    virtual ~AccountDirectory() = default;
+
+    /** Look up the SID of a user or group account. */
+    virtual bool NameToSid(const std::wstring& name, std::vector<BYTE>& sid) = 0;
+
+    /** Global groups that the user is member of. */
+    virtual bool GetGroups(const std::wstring& username, std::vector<DirectoryGroup>& groups) = 0;
+
+    /** Local groups that the user is member of. */
+    virtual bool GetLocalGroups(const std::wstring& username, std::vector<std::wstring>& groups) = 0;
+};
+
+/** Directory backed by LookupAccountNameW, NetUserGetGroups & NetUserGetLocalGroups. */
+class Win32Directory : public AccountDirectory {
+public:
+    bool NameToSid(const std::wstring& name, std::vector<BYTE>& sid) override;
+
+    bool GetGroups(const std::wstring& username, std::vector<DirectoryGroup>& groups) override;
+
+    bool GetLocalGroups(const std::wstring& username, std::vector<std::wstring>& groups) override;
+};
@@ -0,0 +1,86 @@
+#include "AccountResolver.hpp"
+#include <algorithm>
+#include <unordered_map>
+#include "Utils.hpp"
+
+static std::unique_ptr<AccountResolver> s_resolver;
+
+
+bool NameToSid(const wchar_t* username, std::vector<BYTE>& sid) {
+    DWORD lengthSid = 0;
+    SID_NAME_USE Use = {};
+    DWORD referencedDomainNameLen = 0;
+    BOOL res = LookupAccountNameW(nullptr, username, nullptr, &lengthSid, nullptr, &referencedDomainNameLen, &Use);
+
+    sid.resize(lengthSid);
+    std::wstring referencedDomainName(referencedDomainNameLen, L'\0'); // throwaway string
+    res = LookupAccountNameW(nullptr, username, sid.data(), &lengthSid, referencedDomainName.data(), &referencedDomainNameLen, &Use);
+    if (!res) {
+        DWORD err = GetLastError();
+        LogMessage("  LookupAccountNameW failed (err %u)", err);
+        return false;
+    }
+
+    return true;
+}
+
+/** Merge attributes of the same group reported through different sources.
+    Deny-only takes precedence, since it is the more restrictive setting. */
+static DWORD MergeGroupAttributes(DWORD a, DWORD b) {
+    DWORD merged = a | b;
+    if (merged & SE_GROUP_USE_FOR_DENY_ONLY)
+        merged &= ~(SE_GROUP_ENABLED | SE_GROUP_ENABLED_BY_DEFAULT);
+    return merged;
+}
+
+void CanonicalizeGroups(std::vector<AccountInfo::Group>& groups) {
+    auto AsKey = [](const std::vector<BYTE>& sid) {
+        return std::string_view((const char*)sid.data(), sid.size());
+    };
+
+    // hash-based de-duplication (keys point into the "groups" vector, so it must not be reallocated)
+    std::unordered_map<std::string_view, size_t> index;
+    index.reserve(groups.size());
+    size_t count = 0;
+    for (size_t i = 0; i < groups.size(); i++) {
+        auto [it, inserted] = index.try_emplace(AsKey(groups[i].Sid), count);
+        if (!inserted) {
+            AccountInfo::Group& existing = groups[it->second];
+            existing.Attributes = MergeGroupAttributes(existing.Attributes, groups[i].Attributes);
+            continue;
+        }
+
+        if (count != i) {
+            groups[count] = std::move(groups[i]);
+            it->second = count; // key remains valid, since the SID buffer itself is moved
+        }
+        count++;
+    }
+    index.clear();
+    groups.resize(count);
+
+    // canonical order for reproducible tokens
+    std::sort(groups.begin(), groups.end(), [](const AccountInfo::Group& a, const AccountInfo::Group& b) {
+        return std::lexicographical_compare(a.Sid.begin(), a.Sid.end(), b.Sid.begin(), b.Sid.end());
+    });
+}
+
+void SelectAccountResolver(const std::wstring& name) {
+    if (name == L"S4U")
+        s_resolver = std::make_unique<S4UResolver>();
+    else
+        s_resolver = std::make_unique<NetApiResolver>();
+
+    LogMessage("  TokenSource: %ls", s_resolver->Name());
+}
+
+void SelectAccountResolver(std::unique_ptr<AccountResolver> resolver) {
+    s_resolver = std::move(resolver);
+    LogMessage("  TokenSource: %ls", s_resolver->Name());
+}
+
+AccountResolver& GetAccountResolver() {
+    if (!s_resolver)
+        s_resolver = std::make_unique<NetApiResolver>();
+    return *s_resolver;
+}
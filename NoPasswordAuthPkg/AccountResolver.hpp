@@ -0,0 +1,97 @@
+#pragma once
+#include <ntstatus.h>
+#include <windows.h>
+#include <sspi.h>
+#include <NTSecAPI.h>  // for LSA_STRING
+#include <ntsecpkg.h>  // for LSA_DISPATCH_TABLE
+#include <authz.h>
+#include <functional>
+#include <memory>
+#include <string_view>
+#include <string>
+#include <vector>
+#include "AccountDirectory.hpp"
+
+
+/** Directory information needed to build a logon token for an account.
+    Stored in regular process heap so that it can be cached across logons. */
+struct AccountInfo {
+    struct Group {
+        std::vector<BYTE> Sid;
+        DWORD Attributes = 0;
+    };
+
+    std::vector<BYTE> UserSid;
+    std::vector<Group> Groups;
+};
+
+
+/** Source of user SID and group memberships for an account.
+    Selected per deployment through the "TokenSource" registry value. */
+class AccountResolver {
+public:
+    virtual ~AccountResolver() = default;
+
+    virtual const wchar_t* Name() const = 0;
+
+    /** Look up user SID and group memberships for an account. */
+    virtual bool Resolve(const std::wstring& username, AccountInfo& info) = 0;
+};
+
+/** Builds the group list from NetUserGetGroups & NetUserGetLocalGroups with one LookupAccountNameW call per group.
+    Misses universal, nested and SID-history groups.
+    Lookups run concurrently on a bounded worker pool, so that resolution takes roughly as long as the slowest lookup chain. */
+class NetApiResolver : public AccountResolver {
+public:
+    static constexpr unsigned DEFAULT_WORKERS = 8; // bound concurrent requests against the domain controller
+
+    explicit NetApiResolver(std::unique_ptr<AccountDirectory> directory = std::make_unique<Win32Directory>(), unsigned maxWorkers = DEFAULT_WORKERS);
+    ~NetApiResolver() override;
+
+    const wchar_t* Name() const override { return L"NetApi"; }
+
+    /** Fails as soon as the user SID or group list lookups fail. Lookups that haven't started yet are then skipped. */
+    bool Resolve(const std::wstring& username, AccountInfo& info) override;
+
+private:
+    /** Run "task" on the worker pool, or inline if the pool is unavailable. */
+    void Submit(std::function<void()> task);
+
+    std::unique_ptr<AccountDirectory> m_directory;
+    PTP_POOL                          m_pool = nullptr;
+    PTP_CLEANUP_GROUP                 m_cleanup = nullptr; // track tasks that may outlive Resolve
+    TP_CALLBACK_ENVIRON               m_environ = {};
+};
+
+/** Obtains the complete and authoritative group set in one call through Authz.
+    AuthzInitializeContextFromSid performs a Service-for-User (S4U) logon for domain accounts,
+    so universal, nested and SID-history groups are included. */
+class S4UResolver : public AccountResolver {
+public:
+    S4UResolver();
+    ~S4UResolver() override;
+
+    const wchar_t* Name() const override { return L"S4U"; }
+
+    bool Resolve(const std::wstring& username, AccountInfo& info) override;
+
+private:
+    AUTHZ_RESOURCE_MANAGER_HANDLE m_rm = nullptr;
+};
+
+
+/** Look up the SID of a user or group account. */
+bool NameToSid(const wchar_t* username, std::vector<BYTE>& sid);
+
+/** Remove duplicate group SIDs and sort the rest in canonical (byte-wise) order.
+    Attributes are merged for SIDs that appear more than once. Runs in expected O(n log n). */
+void CanonicalizeGroups(std::vector<AccountInfo::Group>& groups);
+
+/** Select resolver by name. Falls back to NetApi for unknown names. */
+void SelectAccountResolver(const std::wstring& name);
+
+/** Replace resolver, typically with one backed by a simulated directory. */
+void SelectAccountResolver(std::unique_ptr<AccountResolver> resolver);
+
+/** Currently selected resolver. */
+AccountResolver& GetAccountResolver();
@@ -0,0 +1,177 @@
+#include "AuditLog.hpp"
+#include <sddl.h>
+#include <algorithm>
+#include "Utils.hpp"
+
+AuditLog Audit;
+
+
+void AuditLog::Start(AuditOverflow overflow, const std::wstring& filePath) {
+    m_overflow = overflow;
+    if (!filePath.empty()) {
+        m_file = CreateFileW(filePath.c_str(), FILE_APPEND_DATA, FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (m_file == INVALID_HANDLE_VALUE)
+            LogMessage("AuditLog: ERROR: Unable to open %ls (err %u), using LSA audit facility instead", filePath.c_str(), GetLastError());
+    }
+    m_stopEvent = CreateEventW(nullptr, /*manualReset*/true, /*initialState*/false, nullptr);
+    m_worker = std::thread(&AuditLog::Run, this);
+}
+
+void AuditLog::Stop() {
+    if (!m_worker.joinable())
+        return;
+
+    SetEvent(m_stopEvent);
+    m_worker.join(); // worker flushes remaining records before exiting
+    CloseHandle(m_stopEvent);
+    m_stopEvent = nullptr;
+    if (m_file != INVALID_HANDLE_VALUE) {
+        CloseHandle(m_file);
+        m_file = INVALID_HANDLE_VALUE;
+    }
+}
+
+bool AuditLog::Enqueue(NTSTATUS status, NTSTATUS subStatus, SECURITY_LOGON_TYPE logonType, const LSA_UNICODE_STRING& accountName, const LSA_UNICODE_STRING& domain, PSID userSid, const LUID& logonId) {
+    AuditRecord record;
+    GetSystemTimeAsFileTime(&record.Time);
+    record.Status = status;
+    record.SubStatus = subStatus;
+    record.LogonType = logonType;
+    record.LogonId = logonId;
+    if (userSid)
+        CopySid(sizeof(record.UserSid), record.UserSid, userSid);
+
+    // truncate overlong names instead of allocating
+    record.AccountNameLength = std::min<USHORT>(accountName.Length, sizeof(record.AccountName));
+    memcpy(/*dst*/record.AccountName, /*src*/accountName.Buffer, record.AccountNameLength);
+    record.DomainLength = std::min<USHORT>(domain.Length, sizeof(record.Domain));
+    memcpy(/*dst*/record.Domain, /*src*/domain.Buffer, record.DomainLength);
+
+    if (m_queue.TryPush(record))
+        return true;
+
+    m_dropped++;
+    return false;
+}
+
+void AuditLog::Run() {
+    AuditRecord batch[MAX_BATCH];
+    for (;;) {
+        bool stopping = (WaitForSingleObject(m_stopEvent, FLUSH_INTERVAL_MS) == WAIT_OBJECT_0);
+
+        // drain queue in batches
+        size_t count = 0;
+        do {
+            count = 0;
+            while ((count < MAX_BATCH) && m_queue.TryPop(batch[count]))
+                count++;
+
+            if (count)
+                Emit(batch, count);
+
+            if (count)
+                LogMessage("AuditLog: emitted %u records", (unsigned)count);
+        } while (count == MAX_BATCH);
+
+        uint64_t dropped = m_dropped.exchange(0);
+        if (dropped) {
+            LogMessage("AuditLog: WARNING: %llu records dropped due to full queue", dropped);
+            EmitDropped(dropped);
+        }
+
+        if (stopping)
+            return;
+    }
+}
+
+void AuditLog::EmitDropped(uint64_t dropped) {
+    // audit the loss itself, since LogMessage is compiled out of release builds
+    AuditRecord record;
+    GetSystemTimeAsFileTime(&record.Time);
+    record.Status = STATUS_INSUFFICIENT_RESOURCES;
+    record.LogonType = Network; // not a logon, but LSA expects a valid type
+    record.Dropped = dropped;
+
+    // the LSA audit facility has no field for the count, so it goes into the account name
+    int length = swprintf_s(record.AccountName, L"<%llu audit records dropped>", dropped);
+    record.AccountNameLength = (USHORT)(std::max<int>(length, 0) * sizeof(wchar_t));
+
+    Emit(&record, 1);
+}
+
+void AuditLog::Emit(AuditRecord* records, size_t count) {
+    if (m_file != INVALID_HANDLE_VALUE) {
+        EmitToFile(records, count);
+        return;
+    }
+    if (!FunctionTable.AuditLogon)
+        return;
+
+    for (size_t i = 0; i < count; i++) {
+        AuditRecord& record = records[i];
+
+        UNICODE_STRING accountName {
+            .Length = record.AccountNameLength,
+            .MaximumLength = record.AccountNameLength,
+            .Buffer = record.AccountName,
+        };
+        UNICODE_STRING domain {
+            .Length = record.DomainLength,
+            .MaximumLength = record.DomainLength,
+            .Buffer = record.Domain,
+        };
+        UNICODE_STRING workstation {}; // not known
+
+        TOKEN_SOURCE source {
+            .SourceName = "NoPwdAP",
+            .SourceIdentifier = {},
+        };
+
+        PSID userSid = IsValidSid(record.UserSid) ? (PSID)record.UserSid : nullptr;
+        FunctionTable.AuditLogon(record.Status, record.SubStatus, &accountName, &domain, &workstation, userSid, record.LogonType, &source, &record.LogonId);
+    }
+}
+
+void AuditLog::EmitToFile(const AuditRecord* records, size_t count) {
+    // format the whole batch as UTF-8 lines, so that it is written with a single WriteFile call
+    std::string lines;
+    for (size_t i = 0; i < count; i++) {
+        const AuditRecord& record = records[i];
+
+        SYSTEMTIME time = {};
+        FileTimeToSystemTime(&record.Time, &time);
+        wchar_t* userSid = nullptr;
+        if (IsValidSid((PSID)record.UserSid))
+            ConvertSidToStringSidW((PSID)record.UserSid, &userSid);
+
+        wchar_t line[1024] = {};
+        int length = 0;
+        if (record.Dropped) {
+            length = swprintf_s(line, L"%04u-%02u-%02uT%02u:%02u:%02u.%03uZ status=0x%08x dropped=%llu\n",
+                time.wYear, time.wMonth, time.wDay, time.wHour, time.wMinute, time.wSecond, time.wMilliseconds,
+                (ULONG)record.Status, record.Dropped);
+        } else {
+            length = swprintf_s(line, L"%04u-%02u-%02uT%02u:%02u:%02u.%03uZ status=0x%08x substatus=0x%08x type=%u logonid=%08x:%08x sid=%ls account=%.*ls\\%.*ls\n",
+                time.wYear, time.wMonth, time.wDay, time.wHour, time.wMinute, time.wSecond, time.wMilliseconds,
+                (ULONG)record.Status, (ULONG)record.SubStatus, (unsigned)record.LogonType, (ULONG)record.LogonId.HighPart, record.LogonId.LowPart,
+                userSid ? userSid : L"-", record.DomainLength / 2, record.Domain, record.AccountNameLength / 2, record.AccountName);
+        }
+        if (userSid)
+            LocalFree(userSid);
+        if (length <= 0)
+            continue;
+        for (int j = 0; j < length - 1; j++) {
+            if (line[j] < L' ')
+                line[j] = L'?'; // keep crafted account names from forging extra lines
+        }
+
+        int size = WideCharToMultiByte(CP_UTF8, 0, line, length, nullptr, 0, nullptr, nullptr);
+        size_t offset = lines.size();
+        lines.resize(offset + size);
+        WideCharToMultiByte(CP_UTF8, 0, line, length, lines.data() + offset, size, nullptr, nullptr);
+    }
+
+    DWORD written = 0;
+    if (!WriteFile(m_file, lines.data(), (DWORD)lines.size(), &written, nullptr))
+        LogMessage("AuditLog: ERROR: WriteFile failed (err %u)", GetLastError());
+}
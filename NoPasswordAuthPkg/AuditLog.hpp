@@ -0,0 +1,72 @@
+#pragma once
+#include <ntstatus.h>
+#include <windows.h>
+#include <sspi.h>
+#include <NTSecAPI.h>  // for LSA_UNICODE_STRING
+#include <ntsecpkg.h>  // for LSA_SECPKG_FUNCTION_TABLE
+#include <atomic>
+#include <string>
+#include <thread>
+#include "BoundedQueue.hpp"
+
+
+/** Fixed-size audit record, so that enqueueing never allocates. */
+struct AuditRecord {
+    static constexpr size_t MAX_NAME_CHARS = 256; // longer names are truncated
+
+    FILETIME            Time = {}; // when the record was queued
+    NTSTATUS            Status = 0;
+    NTSTATUS            SubStatus = 0;
+    SECURITY_LOGON_TYPE LogonType = {};
+    LUID                LogonId = {};
+    BYTE                UserSid[SECURITY_MAX_SID_SIZE] = {}; // all zero if unknown
+    USHORT              AccountNameLength = 0; // [bytes]
+    wchar_t             AccountName[MAX_NAME_CHARS] = {};
+    USHORT              DomainLength = 0; // [bytes]
+    wchar_t             Domain[MAX_NAME_CHARS] = {};
+    uint64_t            Dropped = 0; // non-zero if this reports records dropped due to a full queue instead of a logon
+};
+
+/** What to do when the audit queue is full. */
+enum class AuditOverflow {
+    Drop,   // drop and count the record, let the logon proceed (default). The count is audited as its own record.
+    Reject, // fail the logon, since it cannot be audited
+};
+
+/** Asynchronous logon auditing.
+    LsaApLogonUser only copies a record into a bounded lock-free queue. A background worker
+    drains the queue in batches and emits the records through the LSA audit facility, or
+    appends them to a text file with one write per batch. */
+class AuditLog {
+public:
+    /** Start the background worker. Records go to "filePath" instead of the LSA audit facility if non-empty. */
+    void Start(AuditOverflow overflow, const std::wstring& filePath = L"");
+    void Stop();
+
+    /** Queue a logon audit record. Never blocks.
+        Returns false if the record was dropped because the queue is full. */
+    bool Enqueue(NTSTATUS status, NTSTATUS subStatus, SECURITY_LOGON_TYPE logonType, const LSA_UNICODE_STRING& accountName, const LSA_UNICODE_STRING& domain, PSID userSid, const LUID& logonId);
+
+    AuditOverflow Overflow() const {
+        return m_overflow;
+    }
+
+private:
+    void Run();
+    void EmitDropped(uint64_t dropped);
+    void Emit(AuditRecord* records, size_t count);
+    void EmitToFile(const AuditRecord* records, size_t count);
+
+    static constexpr size_t QUEUE_CAPACITY = 1024;
+    static constexpr size_t MAX_BATCH = 64;
+    static constexpr DWORD  FLUSH_INTERVAL_MS = 100; // worker wake-up interval, avoids signaling from the logon path
+
+    BoundedQueue<AuditRecord, QUEUE_CAPACITY> m_queue;
+    AuditOverflow         m_overflow = AuditOverflow::Drop;
+    std::atomic<uint64_t> m_dropped = 0;
+    HANDLE                m_stopEvent = nullptr;
+    HANDLE                m_file = INVALID_HANDLE_VALUE; // optional file sink
+    std::thread           m_worker;
+};
+
+extern AuditLog Audit;
@@ -0,0 +1,73 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+
+/** Bounded lock-free multi-producer/multi-consumer queue.
+    Based on Dmitry Vyukov's array-based queue, where each cell carries a sequence number
+    that tells producers and consumers whose turn it is. Never blocks or allocates. */
+template <class T, size_t CAPACITY>
+class BoundedQueue {
+    static_assert((CAPACITY >= 2) && ((CAPACITY & (CAPACITY - 1)) == 0), "CAPACITY must be a power of two");
+
+public:
+    BoundedQueue() {
+        for (size_t i = 0; i < CAPACITY; i++)
+            m_cells[i].Sequence.store(i, std::memory_order_relaxed);
+    }
+
+    /** Returns false if the queue is full. */
+    bool TryPush(const T& data) {
+        size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = m_cells[pos & (CAPACITY - 1)];
+            size_t seq = cell.Sequence.load(std::memory_order_acquire);
+            auto diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                // cell is free for this position
+                if (m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.Data = data;
+                    cell.Sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false; // full
+            } else {
+                pos = m_enqueuePos.load(std::memory_order_relaxed); // another producer won the race
+            }
+        }
+    }
+
+    /** Returns false if the queue is empty. */
+    bool TryPop(T& data) {
+        size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = m_cells[pos & (CAPACITY - 1)];
+            size_t seq = cell.Sequence.load(std::memory_order_acquire);
+            auto diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (diff == 0) {
+                // cell holds data for this position
+                if (m_dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    data = cell.Data;
+                    cell.Sequence.store(pos + CAPACITY, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false; // empty
+            } else {
+                pos = m_dequeuePos.load(std::memory_order_relaxed); // another consumer won the race
+            }
+        }
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> Sequence;
+        T Data{};
+    };
+
+    Cell                             m_cells[CAPACITY];
+    alignas(64) std::atomic<size_t>  m_enqueuePos = 0; // separate cache lines to avoid false sharing
+    alignas(64) std::atomic<size_t>  m_dequeuePos = 0;
+};
@@ -0,0 +1,204 @@
+#pragma once
+#include <windows.h>
+#include <NTSecAPI.h> // for MSV1_0_INTERACTIVE_LOGON
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <string_view>
+#include <vector>
+#include "Utf16.hpp"
+
+
+/** Compile-time layout of a fixed-size "Header" struct followed by the contents of the UNICODE_STRING "FIELDS", packed back-to-back in field order.
+    "FIELDS" are members of "T", which must be the first member of "Header" (or "Header" itself).
+    String addresses are stored relative to a base address, as done for LSA submit & profile buffers.
+    Shared by NoPasswordAuthPkg and AuthPkgTester, so that both sides agree on the buffer format. */
+template <class HEADER, class T, UNICODE_STRING T::*... FIELDS>
+struct HeaderLayout {
+    using Header = HEADER;
+    using Strings = std::array<std::wstring_view, sizeof...(FIELDS)>;
+
+    static_assert(sizeof(Header) >= sizeof(T), "T must be a prefix of Header");
+    static_assert(sizeof(Header) % alignof(wchar_t) == 0, "string contents must be wchar_t aligned");
+
+    /** Buffer size [bytes] needed for the given field values. */
+    static constexpr size_t Size(const Strings& strings) {
+        size_t size = sizeof(Header);
+        for (std::wstring_view str : strings)
+            size += sizeof(wchar_t) * str.size();
+        return size;
+    }
+
+    /** Copy field values to the end of a zero-initialized buffer of Size(strings) bytes and return the header.
+        Addresses are relative to "base", so pass nullptr for offsets or the address the buffer will be copied to. */
+    static Header* Pack(BYTE* buffer, const Strings& strings, const BYTE* base) {
+        auto* prefix = (T*)buffer;
+        size_t offset = sizeof(Header);
+        size_t idx = 0;
+        (PackField(buffer, offset, strings[idx++], base, prefix->*FIELDS), ...);
+        return (Header*)buffer;
+    }
+
+    /** Validate that all fields lie within the buffer and make relative addresses absolute in-place.
+        Returns nullptr if the buffer is malformed. */
+    static Header* Unpack(void* buffer, size_t bufferSize) {
+        if (bufferSize < sizeof(Header))
+            return nullptr;
+
+        auto* prefix = (T*)buffer;
+        if (!(UnpackField((BYTE*)buffer, bufferSize, prefix->*FIELDS) && ...))
+            return nullptr;
+        return (Header*)buffer;
+    }
+
+private:
+    static void PackField(BYTE* buffer, size_t& offset, std::wstring_view str, const BYTE* base, UNICODE_STRING& field) {
+        auto size = (USHORT)(sizeof(wchar_t) * str.size());
+        assert(sizeof(wchar_t) * str.size() <= MAXUSHORT);
+
+        memcpy(/*dst*/buffer + offset, /*src*/str.data(), size);
+        // assign members individually to leave struct padding zeroed
+        field.Length = size;
+        field.MaximumLength = size;
+        field.Buffer = (wchar_t*)((size_t)base + offset);
+        offset += size;
+    }
+
+    static bool UnpackField(BYTE* buffer, size_t bufferSize, UNICODE_STRING& field) {
+        if ((field.Length > field.MaximumLength) || (field.Length % sizeof(wchar_t) != 0))
+            return false;
+        if (field.MaximumLength == 0) {
+            field.Buffer = nullptr; // don't keep an unchecked address around
+            return true;
+        }
+
+        // the whole string allocation must be wchar_t aligned and lie behind the header, since consumers may use it up to MaximumLength
+        auto offset = (size_t)field.Buffer;
+        if ((offset < sizeof(Header)) || (offset % alignof(wchar_t) != 0) || (offset > bufferSize) || (field.MaximumLength > bufferSize - offset))
+            return false;
+
+        field.Buffer = (wchar_t*)(buffer + offset);
+        return true;
+    }
+};
+
+/** Layout of a struct "T" followed by its strings. */
+template <class T, UNICODE_STRING T::*... FIELDS>
+using PackedLayout = HeaderLayout<T, T, FIELDS...>;
+
+
+using InteractiveLogonLayout = PackedLayout<MSV1_0_INTERACTIVE_LOGON,
+    &MSV1_0_INTERACTIVE_LOGON::LogonDomainName, &MSV1_0_INTERACTIVE_LOGON::UserName, &MSV1_0_INTERACTIVE_LOGON::Password>;
+
+using InteractiveProfileLayout = PackedLayout<MSV1_0_INTERACTIVE_PROFILE,
+    &MSV1_0_INTERACTIVE_PROFILE::FullName, &MSV1_0_INTERACTIVE_PROFILE::LogonServer>;
+
+using KerbInteractiveLogonLayout = PackedLayout<KERB_INTERACTIVE_LOGON,
+    &KERB_INTERACTIVE_LOGON::LogonDomainName, &KERB_INTERACTIVE_LOGON::UserName, &KERB_INTERACTIVE_LOGON::Password>;
+
+using KerbUnlockLogonLayout = HeaderLayout<KERB_INTERACTIVE_UNLOCK_LOGON, KERB_INTERACTIVE_LOGON,
+    &KERB_INTERACTIVE_LOGON::LogonDomainName, &KERB_INTERACTIVE_LOGON::UserName, &KERB_INTERACTIVE_LOGON::Password>;
+
+/** NoPasswordAuthPkg accepts MSV1_0_INTERACTIVE_LOGON buffers and ignores the password. */
+using NoPasswordLogonLayout = InteractiveLogonLayout;
+
+// detect unexpected struct packing, since buffers are exchanged across processes
+static_assert(sizeof(MSV1_0_INTERACTIVE_LOGON) == 7 * sizeof(void*));
+static_assert(offsetof(MSV1_0_INTERACTIVE_LOGON, LogonDomainName) == sizeof(void*));
+static_assert(offsetof(MSV1_0_INTERACTIVE_LOGON, UserName) == offsetof(MSV1_0_INTERACTIVE_LOGON, LogonDomainName) + sizeof(UNICODE_STRING));
+static_assert(offsetof(MSV1_0_INTERACTIVE_LOGON, Password) == offsetof(MSV1_0_INTERACTIVE_LOGON, UserName) + sizeof(UNICODE_STRING));
+static_assert(sizeof(KERB_INTERACTIVE_LOGON) == sizeof(MSV1_0_INTERACTIVE_LOGON));
+static_assert(offsetof(KERB_INTERACTIVE_UNLOCK_LOGON, Logon) == 0);
+static_assert(offsetof(KERB_INTERACTIVE_UNLOCK_LOGON, LogonId) == sizeof(KERB_INTERACTIVE_LOGON));
+static_assert(offsetof(MSV1_0_INTERACTIVE_PROFILE, LogonTime) == 8);
+static_assert(offsetof(MSV1_0_INTERACTIVE_PROFILE, FullName) == 8 + 6 * sizeof(LARGE_INTEGER) + 2 * sizeof(UNICODE_STRING));
+static_assert(offsetof(MSV1_0_INTERACTIVE_PROFILE, LogonServer) == 8 + 6 * sizeof(LARGE_INTEGER) + 5 * sizeof(UNICODE_STRING));
+
+
+/** Set the submit buffer message type. Selected at compile time from the layout header. */
+inline void InitSubmitHeader(MSV1_0_INTERACTIVE_LOGON& header) {
+    header.MessageType = MsV1_0InteractiveLogon;
+}
+
+inline void InitSubmitHeader(KERB_INTERACTIVE_LOGON& header) {
+    header.MessageType = KerbInteractiveLogon;
+}
+
+inline void InitSubmitHeader(KERB_INTERACTIVE_UNLOCK_LOGON& header) {
+    header.Logon.MessageType = KerbWorkstationUnlockLogon; // LogonId to be filled in by caller
+}
+
+/** Pack a LsaLogonUser submit buffer of "Layout" into a new vector, with relative string addresses. */
+template <class Layout>
+std::vector<BYTE> PackSubmitBuffer(const typename Layout::Strings& strings) {
+    std::vector<BYTE> buffer(Layout::Size(strings), (BYTE)0);
+    InitSubmitHeader(*Layout::Pack(buffer.data(), strings, /*base*/nullptr));
+    return buffer;
+}
+
+/** Pack MSV1_0_INTERACTIVE_LOGON struct with domain, username & password at the end and relative string addresses. */
+inline std::vector<BYTE> PackInteractiveLogon(std::wstring_view domain, std::wstring_view username, std::wstring_view password) {
+    return PackSubmitBuffer<InteractiveLogonLayout>({ domain, username, password });
+}
+
+/** Validate MSV1_0_INTERACTIVE_LOGON submit buffer and make relative string addresses absolute in-place.
+    Returns nullptr if the buffer is malformed. */
+inline MSV1_0_INTERACTIVE_LOGON* UnpackInteractiveLogon(void* buffer, ULONG bufferSize) {
+    return InteractiveLogonLayout::Unpack(buffer, bufferSize);
+}
+
+
+/** Bump allocator for packing many submit buffers back-to-back into one caller-provided block.
+    Avoids per-buffer heap allocations when preparing large batches, e.g. for load tests. */
+class SubmitBufferArena {
+public:
+    /** "buffer" must be pointer aligned and outlive all packed buffers. */
+    SubmitBufferArena(BYTE* buffer, size_t size) : m_begin(buffer), m_cur(buffer), m_end(buffer + size) {
+        assert((size_t)buffer % alignof(void*) == 0);
+    }
+
+    /** Arena bytes taken by a submit buffer of "Layout", including padding. Sum over all buffers to size an arena. */
+    template <class Layout>
+    static size_t Footprint(const typename Layout::Strings& strings) {
+        return (Layout::Size(strings) + alignof(void*) - 1) & ~(alignof(void*) - 1);
+    }
+
+    /** Pack a submit buffer of "Layout" with relative string addresses.
+        Returns the header and its size, or nullptr if the arena is full or a string exceeds the UNICODE_STRING limit. */
+    template <class Layout>
+    typename Layout::Header* Pack(const typename Layout::Strings& strings, ULONG* size) {
+        for (std::wstring_view str : strings) {
+            if (sizeof(wchar_t) * str.size() > MAXUSHORT)
+                return nullptr;
+        }
+        size_t bufferSize = Layout::Size(strings);
+        if (bufferSize > (size_t)(m_end - m_cur))
+            return nullptr;
+
+        // string contents overwrite the rest, so only the header needs clearing
+        memset(m_cur, 0, sizeof(typename Layout::Header));
+        typename Layout::Header* header = Layout::Pack(m_cur, strings, /*base*/nullptr);
+        InitSubmitHeader(*header);
+
+        // keep pointer alignment for the next header
+        m_cur += std::min<size_t>(Footprint<Layout>(strings), m_end - m_cur);
+        *size = (ULONG)bufferSize;
+        return header;
+    }
+
+    /** Bytes used so far. */
+    size_t Used() const {
+        return m_cur - m_begin;
+    }
+
+    /** Discard all packed buffers. */
+    void Reset() {
+        m_cur = m_begin;
+    }
+
+private:
+    BYTE* m_begin = nullptr;
+    BYTE* m_cur = nullptr;
+    BYTE* m_end = nullptr;
+};
@@ -0,0 +1,57 @@
+#pragma once
+#include <windows.h>
+#include <sddl.h>
+#include <string>
+#include <vector>
+
+/* Text format of recorded logon corpus files. One record per line:
+     L <LogonType> <hex MSV1_0_INTERACTIVE_LOGON submit buffer>
+     S <name> <SID string, or "-" if lookup failed>
+     G <username> <count> <group>:<attributes>... (or "-" if lookup failed)
+     A <username> <count> <local group>...       (or "-" if lookup failed)
+   All names are pseudonyms and SIDs are anonymized by LogonRecorder. */
+
+
+inline std::string ToHex(const BYTE* data, size_t size) {
+    static const char DIGITS[] = "0123456789abcdef";
+    if (size == 0)
+        return "-";
+
+    std::string hex(2 * size, '\0');
+    for (size_t i = 0; i < size; i++) {
+        hex[2 * i] = DIGITS[data[i] >> 4];
+        hex[2 * i + 1] = DIGITS[data[i] & 0xF];
+    }
+    return hex;
+}
+
+inline std::vector<BYTE> FromHex(const std::string& hex) {
+    if (hex == "-")
+        return {};
+
+    auto nibble = [](char c) -> BYTE {
+        return (BYTE)((c <= '9') ? (c - '0') : (c - 'a' + 10));
+    };
+    std::vector<BYTE> data(hex.size() / 2, (BYTE)0);
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = (BYTE)((nibble(hex[2 * i]) << 4) | nibble(hex[2 * i + 1]));
+    return data;
+}
+
+inline std::string SidToString(const std::vector<BYTE>& sid) {
+    char* str = nullptr;
+    if (!ConvertSidToStringSidA((PSID)sid.data(), &str))
+        return "-";
+    std::string result = str;
+    LocalFree(str);
+    return result;
+}
+
+inline bool StringToSid(const std::string& str, std::vector<BYTE>& sid) {
+    PSID tmp = nullptr;
+    if (!ConvertStringSidToSidA(str.c_str(), &tmp))
+        return false;
+    sid.assign((BYTE*)tmp, (BYTE*)tmp + GetLengthSid(tmp));
+    LocalFree(tmp);
+    return true;
+}
@@ -0,0 +1,100 @@
+#include "LogonRecorder.hpp"
+#include "LogonBuffer.hpp"
+#include "LogonCorpus.hpp"
+#include "Utils.hpp"
+
+LogonRecorder Recorder;
+
+
+bool LogonRecorder::Open(const std::wstring& path) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    // truncate, since pseudonyms and domain numbers are only consistent within one recording session
+    _wfopen_s(&m_file, path.c_str(), L"w");
+    if (!m_file) {
+        LogMessage("  WARNING: Unable to open record file %ls", path.c_str());
+        return false;
+    }
+    LogMessage("  Recording logons to %ls", path.c_str());
+    return true;
+}
+
+void LogonRecorder::Close() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_file) {
+        fclose(m_file);
+        m_file = nullptr;
+    }
+}
+
+void LogonRecorder::RecordLogon(SECURITY_LOGON_TYPE logonType, const MSV1_0_INTERACTIVE_LOGON& logonInfo) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::string domain = Pseudonym(std::wstring(logonInfo.LogonDomainName.Buffer, logonInfo.LogonDomainName.Length / 2));
+    std::string username = Pseudonym(std::wstring(logonInfo.UserName.Buffer, logonInfo.UserName.Length / 2));
+
+    // re-pack with pseudonyms and without password
+    std::vector<BYTE> buffer = PackInteractiveLogon(std::wstring(domain.begin(), domain.end()), std::wstring(username.begin(), username.end()), L"");
+    WriteLine("L " + std::to_string(logonType) + " " + ToHex(buffer.data(), buffer.size()));
+}
+
+void LogonRecorder::RecordSid(const std::wstring& name, const std::vector<BYTE>* sid) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    WriteLine("S " + Pseudonym(name) + " " + (sid ? AnonymizeSid(*sid) : "-"));
+}
+
+void LogonRecorder::RecordGroups(const std::wstring& username, const std::vector<DirectoryGroup>* groups) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::string line = "G " + Pseudonym(username);
+    if (groups) {
+        line += " " + std::to_string(groups->size());
+        for (const DirectoryGroup& group : *groups)
+            line += " " + Pseudonym(group.Name) + ":" + std::to_string(group.Attributes);
+    } else {
+        line += " -";
+    }
+    WriteLine(line);
+}
+
+void LogonRecorder::RecordLocalGroups(const std::wstring& username, const std::vector<std::wstring>* groups) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::string line = "A " + Pseudonym(username);
+    if (groups) {
+        line += " " + std::to_string(groups->size());
+        for (const std::wstring& group : *groups)
+            line += " " + Pseudonym(group);
+    } else {
+        line += " -";
+    }
+    WriteLine(line);
+}
+
+std::string LogonRecorder::Pseudonym(const std::wstring& name) {
+    if (name.empty())
+        return "";
+
+    // stable pseudonym per case-folded name
+    auto [it, inserted] = m_names.try_emplace(Utf16::FoldCase(name), "");
+    if (inserted)
+        it->second = "name" + std::to_string(m_names.size());
+    return it->second;
+}
+
+std::string LogonRecorder::AnonymizeSid(const std::vector<BYTE>& sid) {
+    std::vector<BYTE> copy = sid;
+    DWORD count = *GetSidSubAuthorityCount(copy.data());
+    if ((count >= 4) && (*GetSidSubAuthority(copy.data(), 0) == SECURITY_NT_NON_UNIQUE)) {
+        // replace S-1-5-21-<a>-<b>-<c>-<rid> domain identifier with S-1-5-21-0-0-<domain number>-<rid>
+        std::array<DWORD, 3> domain = { *GetSidSubAuthority(copy.data(), 1), *GetSidSubAuthority(copy.data(), 2), *GetSidSubAuthority(copy.data(), 3) };
+        auto [it, inserted] = m_domains.try_emplace(domain, (DWORD)m_domains.size() + 1);
+        *GetSidSubAuthority(copy.data(), 1) = 0;
+        *GetSidSubAuthority(copy.data(), 2) = 0;
+        *GetSidSubAuthority(copy.data(), 3) = it->second;
+    }
+    return SidToString(copy); // well-known & BUILTIN SIDs are kept as-is
+}
+
+void LogonRecorder::WriteLine(const std::string& line) {
+    if (!m_file)
+        return;
+    fprintf(m_file, "%s\n", line.c_str());
+    fflush(m_file);
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include <array>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "AccountResolver.hpp"
+
+
+/** Records anonymized submit buffers and directory responses to a corpus file for replay testing.
+    Names are replaced by pseudonyms, domain SIDs are renumbered and passwords are never recorded. */
+class LogonRecorder {
+public:
+    /** Start a new corpus, replacing any previous content of "path". */
+    bool Open(const std::wstring& path);
+    void Close();
+
+    bool Enabled() const {
+        return m_file != nullptr;
+    }
+
+    /** Record submit buffer after relative addresses have been made absolute. */
+    void RecordLogon(SECURITY_LOGON_TYPE logonType, const MSV1_0_INTERACTIVE_LOGON& logonInfo);
+
+    /** Record directory responses. Pass nullptr for failed lookups. */
+    void RecordSid(const std::wstring& name, const std::vector<BYTE>* sid);
+    void RecordGroups(const std::wstring& username, const std::vector<DirectoryGroup>* groups);
+    void RecordLocalGroups(const std::wstring& username, const std::vector<std::wstring>* groups);
+
+private:
+    std::string Pseudonym(const std::wstring& name);
+    std::string AnonymizeSid(const std::vector<BYTE>& sid);
+    void WriteLine(const std::string& line);
+
+    std::mutex                                    m_mutex; // serialize prefetch & logon threads
+    FILE*                                         m_file = nullptr;
+    std::unordered_map<std::wstring, std::string> m_names;   // case-folded name -> pseudonym
+    std::map<std::array<DWORD, 3>, DWORD>         m_domains; // domain sub-authorities -> domain number
+};
+
+extern LogonRecorder Recorder;
+
+
+/** Directory decorator that records all responses from another directory. */
+class RecordingDirectory : public AccountDirectory {
+public:
+    RecordingDirectory(std::unique_ptr<AccountDirectory> inner, LogonRecorder& recorder) : m_inner(std::move(inner)), m_recorder(recorder) {
+    }
+
+    bool NameToSid(const std::wstring& name, std::vector<BYTE>& sid) override {
+        bool ok = m_inner->NameToSid(name, sid);
+        m_recorder.RecordSid(name, ok ? &sid : nullptr);
+        return ok;
+    }
+
+    bool GetGroups(const std::wstring& username, std::vector<DirectoryGroup>& groups) override {
+        bool ok = m_inner->GetGroups(username, groups);
+        m_recorder.RecordGroups(username, ok ? &groups : nullptr);
+        return ok;
+    }
+
+    bool GetLocalGroups(const std::wstring& username, std::vector<std::wstring>& groups) override {
+        bool ok = m_inner->GetLocalGroups(username, groups);
+        m_recorder.RecordLocalGroups(username, ok ? &groups : nullptr);
+        return ok;
+    }
+
+private:
+    std::unique_ptr<AccountDirectory> m_inner;
+    LogonRecorder&                    m_recorder;
+};
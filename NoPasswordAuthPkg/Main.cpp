@@ -1,5 +1,11 @@
 #include "PrepareToken.hpp"
 #include "PrepareProfile.hpp"
+#include "AccountCache.hpp"
+#include "AuditLog.hpp"
+#include "LogonBuffer.hpp"
+#include "LogonRecorder.hpp"
+#include "Policy.hpp"
+#include "Protocol.hpp"
 #include "Utils.hpp"
 
 // exported symbols
@@ -50,12 +56,30 @@ NTSTATUS NTAPI SpInitialize(_In_ ULONG_PTR PackageId, _In_ SECPKG_PARAMETERS* Pa
 
     FunctionTable = *functionTable; // copy function pointer table
 
+    // select source of user & group SIDs
+    SelectAccountResolver(GetConfigString(L"TokenSource", L"NetApi"));
+
+    // optionally record anonymized logons & directory responses for replay testing
+    std::wstring recordPath = GetConfigString(L"RecordPath", L"");
+    if (!recordPath.empty() && Recorder.Open(recordPath))
+        SelectAccountResolver(std::make_unique<NetApiResolver>(std::make_unique<RecordingDirectory>(std::make_unique<Win32Directory>(), Recorder)));
+
+    // load policy and watch for changes
+    Policy.Start();
+
+    // start background audit emission
+    Audit.Start((GetConfigString(L"AuditOverflow", L"Drop") == L"Reject") ? AuditOverflow::Reject : AuditOverflow::Drop, GetConfigString(L"AuditFile", L""));
+
     LogMessage("  return STATUS_SUCCESS");
     return STATUS_SUCCESS;
 }
 
 NTSTATUS NTAPI SpShutDown() {
     LogMessage("SpShutDown");
+
+    Audit.Stop(); // flush pending audit records
+    Policy.Stop();
+    Recorder.Close();
     LogMessage("  return STATUS_SUCCESS");
     return STATUS_SUCCESS;
 }
@@ -110,59 +134,93 @@ NTSTATUS LsaApLogonUser (
     }
 
     // input arguments
-    LogMessage("  LogonType: %i", LogonType); // Interactive=2, RemoteInteractive=10
+    LogMessage("  LogonType: %i", LogonType); // Interactive=2, Network=3, Batch=4, Service=5, RemoteInteractive=10
     ClientBufferBase;
     LogMessage("  ProtocolSubmitBuffer size: %i", SubmitBufferSize);
 
+    // release outputs on failure, since LSA only takes ownership of them on success
+    bool logonSessionCreated = false;
+    auto Release = [&]() {
+        if (logonSessionCreated)
+            FunctionTable.DeleteLogonSession(LogonId);
+        if (*ProfileBuffer) {
+            FunctionTable.FreeClientBuffer(ClientRequest, *ProfileBuffer);
+            *ProfileBuffer = nullptr;
+            *ProfileBufferSize = 0;
+        }
+    };
+
+    // audit failed attempts on every path, with empty names until the submit buffer is unpacked
+    MSV1_0_INTERACTIVE_LOGON* logonInfo = nullptr;
+    auto Fail = [&](NTSTATUS status, NTSTATUS subStatus) {
+        Release();
+        const LSA_UNICODE_STRING unknown = {};
+        Audit.Enqueue(status, subStatus, LogonType, logonInfo ? logonInfo->UserName : unknown, logonInfo ? logonInfo->LogonDomainName : unknown, /*userSid*/nullptr, *LogonId);
+        *SubStatus = subStatus;
+        return status;
+    };
+
     // deliberately restrict supported logontypes
-    if ((LogonType != Interactive) && (LogonType != RemoteInteractive)) {
+    bool interactive = (LogonType == Interactive) || (LogonType == RemoteInteractive);
+    bool nonInteractive = (LogonType == Network) || (LogonType == Batch) || (LogonType == Service); // lightweight path without profile
+    if (!interactive && !nonInteractive) {
         LogMessage("  return STATUS_NOT_IMPLEMENTED (unsupported LogonType)");
-        return STATUS_NOT_IMPLEMENTED;
+        return Fail(STATUS_NOT_IMPLEMENTED, STATUS_SUCCESS);
     }
 
-    // authentication credentials passed by client
-    auto* logonInfo = (MSV1_0_INTERACTIVE_LOGON*)ProtocolSubmitBuffer;
-    {
-        if (SubmitBufferSize < sizeof(MSV1_0_INTERACTIVE_LOGON)) {
-            LogMessage("  ERROR: SubmitBufferSize too small");
-            return STATUS_INVALID_PARAMETER;
-        }
+    // lock-free read of current policy, only pinned for the check so that reloads don't wait for the logon
+    if (!Policy.Current()->AllowsLogonType(LogonType)) {
+        LogMessage("  return STATUS_LOGON_TYPE_NOT_GRANTED (denied by policy)");
+        return Fail(STATUS_LOGON_TYPE_NOT_GRANTED, STATUS_SUCCESS);
+    }
 
-        // make relative pointers absolute to ease later access
-        logonInfo->LogonDomainName.Buffer = (wchar_t*)((BYTE*)logonInfo + (size_t)logonInfo->LogonDomainName.Buffer);
-        logonInfo->UserName.Buffer = (wchar_t*)((BYTE*)logonInfo + (size_t)logonInfo->UserName.Buffer);
-        logonInfo->Password.Buffer = (wchar_t*)((BYTE*)logonInfo + (size_t)logonInfo->Password.Buffer);
+    // authentication credentials passed by client
+    logonInfo = UnpackInteractiveLogon(ProtocolSubmitBuffer, SubmitBufferSize); // make relative pointers absolute to ease later access
+    if (!logonInfo) {
+        LogMessage("  ERROR: Malformed ProtocolSubmitBuffer");
+        return Fail(STATUS_INVALID_PARAMETER, STATUS_SUCCESS);
     }
 
+    if (Recorder.Enabled())
+        Recorder.RecordLogon(LogonType, *logonInfo);
+
     // assign output arguments
 
-    {
+    if (interactive) {
+        // non-interactive logons don't load a user profile, so "ProfileBuffer" is left empty
         wchar_t computerName[MAX_COMPUTERNAME_LENGTH + 1] = {};
         DWORD computerNameSize = ARRAYSIZE(computerName);
         if (!GetComputerNameW(computerName, &computerNameSize)) {
             LogMessage("  return STATUS_INTERNAL_ERROR (GetComputerNameW failed)");
-            return STATUS_INTERNAL_ERROR;
+            return Fail(STATUS_INTERNAL_ERROR, STATUS_SUCCESS);
         }
 
-        // assign "ProfileBuffer" output argument
-        *ProfileBufferSize = GetProfileBufferSize(computerName, *logonInfo);
-        FunctionTable.AllocateClientBuffer(ClientRequest, *ProfileBufferSize, ProfileBuffer); // will update *ProfileBuffer
+        // assign "ProfileBuffer" output argument, with one layout for both allocation and packing
+        ProfileLayout layout = GetProfileLayout(std::wstring_view(computerName, computerNameSize), *logonInfo);
+        NTSTATUS status = FunctionTable.AllocateClientBuffer(ClientRequest, layout.Size, ProfileBuffer); // will update *ProfileBuffer
+        if (status != STATUS_SUCCESS) {
+            LogMessage("  ERROR: AllocateClientBuffer failed with err: 0x%x", status);
+            *ProfileBuffer = nullptr;
+            return Fail(status, STATUS_SUCCESS);
+        }
+        *ProfileBufferSize = layout.Size;
 
-        std::vector<BYTE> profileBuffer = PrepareProfileBuffer(computerName, *logonInfo, (BYTE*)*ProfileBuffer);
-        FunctionTable.CopyToClientBuffer(ClientRequest, (ULONG)profileBuffer.size(), *ProfileBuffer, profileBuffer.data()); // copy to caller process
+        std::vector<BYTE> profileBuffer = PrepareProfileBuffer(layout, (BYTE*)*ProfileBuffer);
+        FunctionTable.CopyToClientBuffer(ClientRequest, layout.Size, *ProfileBuffer, profileBuffer.data()); // copy to caller process
     }
 
     {
         // assign "LogonId" output argument
         if (!AllocateLocallyUniqueId(LogonId)) {
             LogMessage("  ERROR: AllocateLocallyUniqueId failed");
-            return STATUS_FAIL_FAST_EXCEPTION;
+            return Fail(STATUS_FAIL_FAST_EXCEPTION, STATUS_SUCCESS);
         }
         NTSTATUS status = FunctionTable.CreateLogonSession(LogonId);
         if (status != STATUS_SUCCESS) {
             LogMessage("  ERROR: CreateLogonSession failed with err: 0x%x", status);
-            return status;
+            return Fail(status, STATUS_SUCCESS);
         }
+        logonSessionCreated = true;
 
         LogMessage("  LogonId: High=0x%x , Low=0x%x", LogonId->HighPart, LogonId->LowPart);
     }
@@ -173,14 +231,22 @@ NTSTATUS LsaApLogonUser (
         // Assign "TokenInformation" output argument
         LSA_TOKEN_INFORMATION_V2* tokenInfo = nullptr;
         NTSTATUS subStatus = 0;
-        NTSTATUS status = UserNameToToken(&logonInfo->UserName, &tokenInfo, &subStatus);
+        NTSTATUS status = UserNameToToken(&logonInfo->UserName, Policy, &tokenInfo, &subStatus);
         if (status != STATUS_SUCCESS) {
             LogMessage("ERROR: UserNameToToken failed with err: 0x%x", status);
-            *SubStatus = subStatus;
-            return status;
+            return Fail(status, subStatus);
         }
 
-        *TokenInformationType = LsaTokenInformationV1;
+        // queue audit record without waiting for it to be written
+        if (!Audit.Enqueue(STATUS_SUCCESS, STATUS_SUCCESS, LogonType, logonInfo->UserName, logonInfo->LogonDomainName, tokenInfo->User.User.Sid, *LogonId)
+            && (Audit.Overflow() == AuditOverflow::Reject)) {
+            LogMessage("  return STATUS_INSUFFICIENT_RESOURCES (audit queue full)");
+            FunctionTable.FreeLsaHeap(tokenInfo);
+            Release();
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        *TokenInformationType = LsaTokenInformationV2; // single allocation
         *TokenInformation = tokenInfo;
     }
 
@@ -211,6 +277,64 @@ NTSTATUS LsaApLogonUser (
     return STATUS_SUCCESS;
 }
 
+/* Handle LsaCallAuthenticationPackage requests from untrusted clients.
+   Only used for prefetch hints, so no return buffer is ever produced. */
+NTSTATUS NTAPI LsaApCallPackageUntrusted(
+    _In_ PLSA_CLIENT_REQUEST ClientRequest,
+    _In_reads_bytes_(SubmitBufferLength) VOID* ProtocolSubmitBuffer,
+    _In_ VOID* ClientBufferBase,
+    _In_ ULONG SubmitBufferLength,
+    _Outptr_result_bytebuffer_(*ReturnBufferLength) VOID** ProtocolReturnBuffer,
+    _Out_ ULONG* ReturnBufferLength,
+    _Out_ NTSTATUS* ProtocolStatus
+) {
+    LogMessage("LsaApCallPackageUntrusted");
+
+    // no return buffer
+    ClientRequest;
+    ClientBufferBase;
+    *ProtocolReturnBuffer = nullptr;
+    *ReturnBufferLength = 0;
+    *ProtocolStatus = STATUS_SUCCESS;
+
+    if (SubmitBufferLength < sizeof(NOPASSWORD_PROTOCOL_MESSAGE_TYPE)) {
+        LogMessage("  ERROR: SubmitBufferLength too small");
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    auto messageType = *(NOPASSWORD_PROTOCOL_MESSAGE_TYPE*)ProtocolSubmitBuffer;
+    if (messageType != NoPasswordPrefetchAccount) {
+        LogMessage("  return STATUS_INVALID_PARAMETER (unsupported MessageType %u)", messageType);
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    auto* request = (NOPASSWORD_PREFETCH_REQUEST*)ProtocolSubmitBuffer;
+    {
+        if (SubmitBufferLength < sizeof(NOPASSWORD_PREFETCH_REQUEST)) {
+            LogMessage("  ERROR: SubmitBufferLength too small");
+            return STATUS_INVALID_PARAMETER;
+        }
+
+        // validate and resolve relative pointer
+        auto offset = (size_t)request->UserName.Buffer;
+        if ((request->UserName.Length == 0) || (offset < sizeof(NOPASSWORD_PREFETCH_REQUEST)) || (offset + request->UserName.Length > SubmitBufferLength)) {
+            LogMessage("  ERROR: UserName out of bounds");
+            return STATUS_INVALID_PARAMETER;
+        }
+        request->UserName.Buffer = (wchar_t*)((BYTE*)request + offset);
+    }
+
+    // logons look up the plain account name, so drop any "DOMAIN\" prefix to share the cache key
+    std::wstring username = ToWstring(request->UserName);
+    username.erase(0, username.find_last_of(L'\\') + 1); // npos+1 == 0 keeps unqualified names
+
+    LogMessage("  Prefetch: %ls", username.c_str());
+    Accounts.Prefetch(username);
+
+    LogMessage("  return STATUS_SUCCESS");
+    return STATUS_SUCCESS;
+}
+
 void LsaApLogonTerminated(_In_ LUID* LogonId) {
     LogMessage("LsaApLogonTerminated");
     LogMessage("  LogonId: High=0x%x , Low=0x%x", LogonId->HighPart, LogonId->LowPart);
@@ -222,7 +346,7 @@ SECPKG_FUNCTION_TABLE SecurityPackageFunctionTable = {
     .LogonUser = LsaApLogonUser,
     .CallPackage = nullptr,
     .LogonTerminated = LsaApLogonTerminated,
-    .CallPackageUntrusted = nullptr,
+    .CallPackageUntrusted = LsaApCallPackageUntrusted,
     .CallPackagePassthrough = nullptr,
     .LogonUserEx = nullptr,
     .LogonUserEx2 = nullptr,
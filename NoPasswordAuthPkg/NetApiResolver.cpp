@@ -0,0 +1,233 @@
+#include "AccountResolver.hpp"
+#include <Lm.h>
+#include <condition_variable>
+#include <mutex>
+#include "Utils.hpp"
+
+#pragma comment(lib, "Netapi32.lib")
+
+
+bool Win32Directory::NameToSid(const std::wstring& name, std::vector<BYTE>& sid) {
+    return ::NameToSid(name.c_str(), sid);
+}
+
+bool Win32Directory::GetGroups(const std::wstring& username, std::vector<DirectoryGroup>& groups) {
+    GROUP_USERS_INFO_1* pGroupInfo = nullptr;
+    DWORD NumberOfEntries = 0;
+    DWORD TotalEntries = 0;
+    DWORD status = NetUserGetGroups(NULL, username.c_str(), 1, (BYTE**)&pGroupInfo, MAX_PREFERRED_LENGTH, &NumberOfEntries, &TotalEntries);
+    if (status != NERR_Success) {
+        LogMessage("ERROR: NetUserGetGroups failed with error %u", status );
+        return false;
+    }
+
+    groups.reserve(NumberOfEntries);
+    for (DWORD i = 0; i < NumberOfEntries; i++)
+        groups.push_back(DirectoryGroup{ pGroupInfo[i].grui1_name, pGroupInfo[i].grui1_attributes });
+
+    NetApiBufferFree(pGroupInfo);
+    return true;
+}
+
+bool Win32Directory::GetLocalGroups(const std::wstring& username, std::vector<std::wstring>& groups) {
+    GROUP_USERS_INFO_0* pLocalGroupInfo = nullptr;
+    DWORD NumberOfEntries = 0;
+    DWORD TotalEntries = 0;
+    DWORD status = NetUserGetLocalGroups(NULL, username.c_str(), 0, 0, (BYTE**)&pLocalGroupInfo, MAX_PREFERRED_LENGTH, &NumberOfEntries, &TotalEntries);
+    if (status != NERR_Success) {
+        LogMessage("ERROR: NetUserGetLocalGroups failed with error %u", status);
+        return false;
+    }
+
+    groups.reserve(NumberOfEntries);
+    for (DWORD i = 0; i < NumberOfEntries; i++)
+        groups.push_back(pLocalGroupInfo[i].grui0_name);
+
+    NetApiBufferFree(pLocalGroupInfo);
+    return true;
+}
+
+
+/** Lookup results shared between NetApiResolver::Resolve and its worker tasks.
+    Reference counted, since tasks may outlive Resolve after a failed lookup. */
+struct ResolveState {
+    std::mutex              Mutex;
+    std::condition_variable Changed;
+    unsigned                Pending = 0;    // submitted tasks that haven't completed
+    bool                    Failed = false; // user SID or group list lookup failed
+    bool                    GroupsReady = false;
+    bool                    LocalGroupsReady = false;
+
+    std::vector<BYTE>               UserSid;
+    std::vector<DirectoryGroup>     Groups;
+    std::vector<std::wstring>       LocalGroups;
+    std::vector<AccountInfo::Group> GroupSids;      // one entry per Groups entry. Empty SID if unresolvable
+    std::vector<AccountInfo::Group> LocalGroupSids; // one entry per LocalGroups entry. Empty SID if unresolvable
+};
+
+/** Submit a lookup that fails the resolution if returning false. Skipped if the resolution has already failed. */
+static void SubmitLookup(const std::shared_ptr<ResolveState>& state, const std::function<void(std::function<void()>)>& submit, std::function<bool()> lookup) {
+    {
+        std::lock_guard<std::mutex> lock(state->Mutex);
+        state->Pending++;
+    }
+    submit([state, lookup = std::move(lookup)]() {
+        bool cancelled = false;
+        {
+            std::lock_guard<std::mutex> lock(state->Mutex);
+            cancelled = state->Failed;
+        }
+        bool ok = cancelled || lookup();
+
+        std::lock_guard<std::mutex> lock(state->Mutex);
+        state->Pending--;
+        if (!ok)
+            state->Failed = true;
+        state->Changed.notify_all();
+    });
+}
+
+
+NetApiResolver::NetApiResolver(std::unique_ptr<AccountDirectory> directory, unsigned maxWorkers) : m_directory(std::move(directory)) {
+    m_pool = CreateThreadpool(nullptr);
+    if (!m_pool) {
+        LogMessage("  ERROR: CreateThreadpool failed. Lookups will run sequentially.");
+        return;
+    }
+    SetThreadpoolThreadMaximum(m_pool, maxWorkers);
+    SetThreadpoolThreadMinimum(m_pool, 1);
+
+    InitializeThreadpoolEnvironment(&m_environ);
+    SetThreadpoolCallbackPool(&m_environ, m_pool);
+    m_cleanup = CreateThreadpoolCleanupGroup();
+    if (m_cleanup)
+        SetThreadpoolCallbackCleanupGroup(&m_environ, m_cleanup, nullptr);
+}
+
+NetApiResolver::~NetApiResolver() {
+    if (!m_pool)
+        return;
+
+    if (m_cleanup) {
+        CloseThreadpoolCleanupGroupMembers(m_cleanup, /*cancel pending*/FALSE, nullptr); // wait for stragglers using m_directory
+        CloseThreadpoolCleanupGroup(m_cleanup);
+    }
+    DestroyThreadpoolEnvironment(&m_environ);
+    CloseThreadpool(m_pool);
+}
+
+void NetApiResolver::Submit(std::function<void()> task) {
+    if (m_pool && m_cleanup) {
+        auto ctx = std::make_unique<std::function<void()>>(std::move(task));
+        auto callback = [](PTP_CALLBACK_INSTANCE, void* context) {
+            std::unique_ptr<std::function<void()>> task((std::function<void()>*)context);
+            (*task)();
+        };
+        if (TrySubmitThreadpoolCallback(callback, ctx.get(), &m_environ)) {
+            ctx.release(); // ownership transferred to callback
+            return;
+        }
+
+        LogMessage("  ERROR: TrySubmitThreadpoolCallback failed");
+        task = std::move(*ctx);
+    }
+    task();
+}
+
+bool NetApiResolver::Resolve(const std::wstring& username, AccountInfo& info) {
+    auto state = std::make_shared<ResolveState>();
+    AccountDirectory* directory = m_directory.get(); // kept alive by destructor until all tasks have completed
+    auto submit = [this](std::function<void()> task) { Submit(std::move(task)); };
+
+    // first stage: independent lookups
+    SubmitLookup(state, submit, [=]() {
+        std::vector<BYTE> sid;
+        if (!directory->NameToSid(username, sid))
+            return false;
+
+        std::lock_guard<std::mutex> lock(state->Mutex);
+        state->UserSid = std::move(sid);
+        return true;
+    });
+    SubmitLookup(state, submit, [=]() {
+        std::vector<DirectoryGroup> groups;
+        if (!directory->GetGroups(username, groups))
+            return false;
+        LogMessage("  NumberOfGroups: %u", (unsigned)groups.size());
+
+        std::lock_guard<std::mutex> lock(state->Mutex);
+        state->Groups = std::move(groups);
+        state->GroupsReady = true;
+        return true;
+    });
+    SubmitLookup(state, submit, [=]() {
+        std::vector<std::wstring> localGroups;
+        if (!directory->GetLocalGroups(username, localGroups))
+            return false;
+        LogMessage("  NumberOfLocalGroups: %u", (unsigned)localGroups.size());
+
+        std::lock_guard<std::mutex> lock(state->Mutex);
+        state->LocalGroups = std::move(localGroups);
+        state->LocalGroupsReady = true;
+        return true;
+    });
+
+    // second stage: resolve group SIDs as soon as each group list arrives
+    bool groupsSubmitted = false;
+    bool localGroupsSubmitted = false;
+    std::unique_lock<std::mutex> lock(state->Mutex);
+    for (;;) {
+        state->Changed.wait(lock, [&]() {
+            return state->Failed || (state->GroupsReady && !groupsSubmitted) || (state->LocalGroupsReady && !localGroupsSubmitted) || (state->Pending == 0);
+        });
+        if (state->Failed)
+            return false; // remaining tasks are skipped
+
+        if (state->GroupsReady && !groupsSubmitted) {
+            groupsSubmitted = true;
+            state->GroupSids.resize(state->Groups.size());
+            lock.unlock();
+            for (size_t i = 0; i < state->Groups.size(); i++) {
+                SubmitLookup(state, submit, [=]() {
+                    AccountInfo::Group& group = state->GroupSids[i];
+                    if (directory->NameToSid(state->Groups[i].Name, group.Sid))
+                        group.Attributes = state->Groups[i].Attributes;
+                    return true; // skip unresolvable groups
+                });
+            }
+            lock.lock();
+        } else if (state->LocalGroupsReady && !localGroupsSubmitted) {
+            localGroupsSubmitted = true;
+            state->LocalGroupSids.resize(state->LocalGroups.size());
+            lock.unlock();
+            for (size_t i = 0; i < state->LocalGroups.size(); i++) {
+                SubmitLookup(state, submit, [=]() {
+                    AccountInfo::Group& group = state->LocalGroupSids[i];
+                    if (!directory->NameToSid(state->LocalGroups[i], group.Sid))
+                        return true; // skip unresolvable groups
+
+                    // get the attributes of group since local groups don't contain attributes
+                    if (*GetSidSubAuthority(group.Sid.data(), 0) != SECURITY_BUILTIN_DOMAIN_RID)
+                        group.Attributes = SE_GROUP_ENABLED | SE_GROUP_ENABLED_BY_DEFAULT;
+                    else
+                        group.Attributes = 0;
+                    return true;
+                });
+            }
+            lock.lock();
+        } else if (state->Pending == 0) {
+            break;
+        }
+    }
+
+    // join results in directory order
+    info.UserSid = std::move(state->UserSid);
+    info.Groups.reserve(state->GroupSids.size() + state->LocalGroupSids.size());
+    for (std::vector<AccountInfo::Group>* groups : { &state->GroupSids, &state->LocalGroupSids }) {
+        for (AccountInfo::Group& group : *groups) {
+            if (!group.Sid.empty())
+                info.Groups.push_back(std::move(group));
+        }
+    }
+    return true;
+}
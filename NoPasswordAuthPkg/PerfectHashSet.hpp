@@ -0,0 +1,98 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "Utf16.hpp"
+
+
+/** Immutable set of strings with collision-free lookup.
+    Uses "hash and displace" perfect hashing: keys are first hashed into buckets, and every bucket
+    gets its own seed that maps its keys to distinct slots. A lookup therefore costs two hash
+    computations and at most one string comparison, independent of the set size. */
+class PerfectHashSet {
+public:
+    PerfectHashSet() = default;
+
+    explicit PerfectHashSet(std::vector<std::wstring> keys) {
+        std::sort(keys.begin(), keys.end());
+        keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+        if (keys.empty())
+            return;
+
+        // retry with a sparser table in the unlikely event that no seed is found
+        for (size_t slotCount = 2 * keys.size(); !Build(keys, slotCount); slotCount += keys.size()) {
+        }
+    }
+
+    bool Empty() const {
+        return m_slots.empty();
+    }
+
+    bool Contains(std::wstring_view key) const {
+        if (m_slots.empty())
+            return false;
+
+        uint32_t seed = m_seeds[Hash(key, 0) % m_seeds.size()];
+        const std::wstring& candidate = m_slots[Hash(key, seed) % m_slots.size()];
+        return !candidate.empty() && (candidate == key);
+    }
+
+private:
+    static uint64_t Hash(std::wstring_view key, uint64_t seed) {
+        return Utf16::Hash(key, seed);
+    }
+
+    bool Build(const std::vector<std::wstring>& keys, size_t slotCount) {
+        constexpr uint32_t MAX_SEED = 1u << 16;
+
+        // first level: distribute keys into buckets
+        std::vector<std::vector<const std::wstring*>> buckets(std::max<size_t>(1, keys.size() / 2));
+        for (const std::wstring& key : keys)
+            buckets[Hash(key, 0) % buckets.size()].push_back(&key);
+
+        // place large buckets first, while the table is still sparse
+        std::vector<size_t> order(buckets.size());
+        for (size_t i = 0; i < order.size(); i++)
+            order[i] = i;
+        std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return buckets[a].size() > buckets[b].size(); });
+
+        m_seeds.assign(buckets.size(), 0);
+        m_slots.assign(slotCount, std::wstring());
+        std::vector<bool> used(slotCount, false);
+        std::vector<size_t> slots;
+        for (size_t b : order) {
+            if (buckets[b].empty())
+                break;
+
+            // second level: search for a seed that maps all keys in the bucket to distinct free slots
+            bool placed = false;
+            for (uint32_t seed = 1; !placed && (seed < MAX_SEED); seed++) {
+                slots.clear();
+                placed = true;
+                for (const std::wstring* key : buckets[b]) {
+                    size_t slot = Hash(*key, seed) % slotCount;
+                    if (used[slot] || (std::find(slots.begin(), slots.end(), slot) != slots.end())) {
+                        placed = false;
+                        break;
+                    }
+                    slots.push_back(slot);
+                }
+                if (placed)
+                    m_seeds[b] = seed;
+            }
+            if (!placed)
+                return false;
+
+            for (size_t i = 0; i < slots.size(); i++) {
+                used[slots[i]] = true;
+                m_slots[slots[i]] = *buckets[b][i];
+            }
+        }
+        return true;
+    }
+
+    std::vector<uint32_t>     m_seeds; // displacement seed per bucket
+    std::vector<std::wstring> m_slots; // key per slot (empty if unused)
+};
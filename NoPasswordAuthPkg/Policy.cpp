@@ -0,0 +1,211 @@
+#include "Policy.hpp"
+#include <sddl.h>
+#include "Utils.hpp"
+
+PolicyStore Policy;
+
+static const PolicySnapshot s_allowAll; // used until Start, or if the configuration key can't be opened
+
+
+/** Read a REG_MULTI_SZ value. Returns an empty list if not set. */
+static std::vector<std::wstring> ReadMultiString(HKEY key, const wchar_t* name) {
+    DWORD size = 0;
+    if (RegGetValueW(key, nullptr, name, RRF_RT_REG_MULTI_SZ, nullptr, nullptr, &size) != ERROR_SUCCESS)
+        return {};
+
+    std::vector<wchar_t> buffer(size / sizeof(wchar_t) + 1, L'\0');
+    if (RegGetValueW(key, nullptr, name, RRF_RT_REG_MULTI_SZ, nullptr, buffer.data(), &size) != ERROR_SUCCESS)
+        return {};
+
+    std::vector<std::wstring> result;
+    for (const wchar_t* str = buffer.data(); *str; str += wcslen(str) + 1)
+        result.push_back(str);
+    return result;
+}
+
+static bool ParseLogonType(const std::wstring& name, SECURITY_LOGON_TYPE* logonType) {
+    static const struct {
+        const wchar_t*      Name;
+        SECURITY_LOGON_TYPE Type;
+    } LOGON_TYPES[] = {
+        { L"Interactive", Interactive },
+        { L"Network", Network },
+        { L"Batch", Batch },
+        { L"Service", Service },
+        { L"RemoteInteractive", RemoteInteractive },
+    };
+    for (auto& entry : LOGON_TYPES) {
+        if (_wcsicmp(entry.Name, name.c_str()) == 0) {
+            *logonType = entry.Type;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+std::unique_ptr<PolicySnapshot> PolicySnapshot::Load(HKEY key) {
+    auto policy = std::make_unique<PolicySnapshot>();
+
+    std::vector<std::wstring> users = ReadMultiString(key, L"AllowedUsers");
+    std::vector<std::wstring> groupSids = ReadMultiString(key, L"AllowedGroups");
+    policy->m_restrictAccounts = !users.empty() || !groupSids.empty(); // before dropping invalid entries
+
+    {
+        for (std::wstring& user : users)
+            user = Utf16::FoldCase(user);
+        policy->m_users = PerfectHashSet(std::move(users));
+    }
+
+    {
+        std::vector<AccountInfo::Group> groups;
+        for (const std::wstring& sidStr : groupSids) {
+            PSID sid = nullptr;
+            if (!ConvertStringSidToSidW(sidStr.c_str(), &sid)) {
+                LogMessage("  WARNING: Ignoring invalid AllowedGroups SID %ls", sidStr.c_str());
+                continue;
+            }
+            groups.push_back(AccountInfo::Group{
+                .Sid = std::vector<BYTE>((BYTE*)sid, (BYTE*)sid + GetLengthSid(sid)),
+            });
+            LocalFree(sid);
+        }
+
+        // same ordering as account groups, so that membership is a linear merge
+        CanonicalizeGroups(groups);
+        for (AccountInfo::Group& group : groups)
+            policy->m_groups.push_back(std::move(group.Sid));
+    }
+
+    {
+        std::vector<std::wstring> logonTypes = ReadMultiString(key, L"AllowedLogonTypes");
+        if (!logonTypes.empty()) {
+            policy->m_logonTypes = 0;
+            for (const std::wstring& name : logonTypes) {
+                SECURITY_LOGON_TYPE logonType = {};
+                if (ParseLogonType(name, &logonType))
+                    policy->m_logonTypes |= 1ull << logonType;
+                else
+                    LogMessage("  WARNING: Ignoring unknown AllowedLogonTypes entry %ls", name.c_str());
+            }
+        }
+    }
+
+    return policy;
+}
+
+bool PolicySnapshot::AllowsAccount(const std::wstring& username, const AccountInfo& account) const {
+    if (!m_restrictAccounts)
+        return true; // unrestricted
+
+    if (m_users.Contains(Utf16::FoldCase(username)))
+        return true;
+
+    // intersect two sorted SID lists
+    auto allowed = m_groups.begin();
+    auto member = account.Groups.begin();
+    while ((allowed != m_groups.end()) && (member != account.Groups.end())) {
+        if (std::lexicographical_compare(allowed->begin(), allowed->end(), member->Sid.begin(), member->Sid.end())) {
+            ++allowed;
+        } else if (std::lexicographical_compare(member->Sid.begin(), member->Sid.end(), allowed->begin(), allowed->end())) {
+            ++member;
+        } else {
+            if (!(member->Attributes & SE_GROUP_USE_FOR_DENY_ONLY))
+                return true;
+            ++allowed;
+            ++member;
+        }
+    }
+    return false;
+}
+
+
+PolicyStore::ReadGuard::ReadGuard(const PolicyStore& store) : m_store(store) {
+    for (;;) {
+        unsigned epoch = store.m_epoch.load();
+        m_slot = epoch & 1;
+        store.m_readers[m_slot]++;
+        if (store.m_epoch.load() == epoch)
+            break;
+        store.m_readers[m_slot]--; // raced with Publish, so Publish may not wait for this slot
+    }
+    m_snapshot = store.m_current.load(std::memory_order_acquire);
+}
+
+PolicyStore::ReadGuard::~ReadGuard() {
+    m_store.m_readers[m_slot].fetch_sub(1, std::memory_order_release);
+}
+
+
+PolicyStore::PolicyStore() : m_current(&s_allowAll), m_readers{ 0, 0 } {
+}
+
+void PolicyStore::Start() {
+    LSTATUS ret = RegCreateKeyExW(HKEY_LOCAL_MACHINE, CONFIG_KEY, 0, nullptr, 0, KEY_READ | KEY_NOTIFY, nullptr, &m_key, nullptr);
+    if (ret != ERROR_SUCCESS) {
+        LogMessage("  WARNING: Unable to open policy key (err %u)", ret);
+        return;
+    }
+
+    m_event = CreateEventW(nullptr, /*manualReset*/false, /*initialState*/false, nullptr);
+
+    // arm notification before loading, so that no change is missed
+    if (ArmNotification()) {
+        auto callback = [](void* context, BOOLEAN /*timedOut*/) {
+            auto* store = (PolicyStore*)context;
+            store->ArmNotification(); // notifications are one-shot
+            store->Reload();
+        };
+        RegisterWaitForSingleObject(&m_wait, m_event, callback, this, INFINITE, WT_EXECUTEDEFAULT);
+    }
+
+    Reload();
+}
+
+void PolicyStore::Stop() {
+    if (m_wait) {
+        UnregisterWaitEx(m_wait, INVALID_HANDLE_VALUE); // wait for callbacks to complete
+        m_wait = nullptr;
+    }
+    if (m_event) {
+        CloseHandle(m_event);
+        m_event = nullptr;
+    }
+    if (m_key) {
+        RegCloseKey(m_key);
+        m_key = nullptr;
+    }
+
+    // keep the last loaded policy instead of falling back to the unrestricted default
+}
+
+bool PolicyStore::ArmNotification() {
+    // REG_NOTIFY_THREAD_AGNOSTIC since the notification is re-armed from thread pool threads
+    LSTATUS ret = RegNotifyChangeKeyValue(m_key, /*watchSubtree*/false, REG_NOTIFY_CHANGE_LAST_SET | REG_NOTIFY_THREAD_AGNOSTIC, m_event, /*async*/true);
+    if (ret != ERROR_SUCCESS) {
+        LogMessage("  WARNING: RegNotifyChangeKeyValue failed (err %u)", ret);
+        return false;
+    }
+    return true;
+}
+
+void PolicyStore::Reload() {
+    Publish(PolicySnapshot::Load(m_key));
+}
+
+void PolicyStore::Publish(std::unique_ptr<PolicySnapshot> snapshot) {
+    std::lock_guard<std::mutex> lock(m_reloadMutex);
+
+    std::unique_ptr<PolicySnapshot> replaced = std::move(m_snapshot);
+    m_snapshot = std::move(snapshot);
+    m_current.store(m_snapshot.get()); // publish
+
+    // readers that start from now on count themselves in the other slot and see the new snapshot,
+    // so the replaced one can be deleted once the slot of the previous epoch has drained
+    unsigned epoch = m_epoch++;
+    while (m_readers[epoch & 1].load() != 0)
+        Sleep(1);
+    replaced.reset();
+
+    LogMessage("PolicyStore: loaded policy version %u", epoch + 1);
+}
@@ -0,0 +1,98 @@
+#pragma once
+#include <ntstatus.h>
+#include <windows.h>
+#include <sspi.h>
+#include <NTSecAPI.h>  // for SECURITY_LOGON_TYPE
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "AccountResolver.hpp"
+#include "PerfectHashSet.hpp"
+
+
+/** Immutable, precompiled logon policy.
+    Missing or empty lists are unrestricted, so that the default policy allows everything.
+    Lists where no entry is valid allow nothing, so that configuration errors fail closed. */
+class PolicySnapshot {
+public:
+    /** Compile policy from the AllowedUsers, AllowedGroups & AllowedLogonTypes values under "key". */
+    static std::unique_ptr<PolicySnapshot> Load(HKEY key);
+
+    bool AllowsLogonType(SECURITY_LOGON_TYPE logonType) const {
+        if ((unsigned)logonType >= 64)
+            return false; // outside the bitmask, so never listed
+        return (m_logonTypes >> logonType) & 1;
+    }
+
+    /** Check if account is listed by name or through an enabled group membership.
+        Expects account groups in CanonicalizeGroups order. */
+    bool AllowsAccount(const std::wstring& username, const AccountInfo& account) const;
+
+private:
+    PerfectHashSet                  m_users;  // case-folded names
+    std::vector<std::vector<BYTE>>  m_groups; // SIDs in CanonicalizeGroups order
+    bool                            m_restrictAccounts = false; // AllowedUsers or AllowedGroups set, even if no entry is valid
+    ULONGLONG                       m_logonTypes = ~0ull; // bitmask of (1 << SECURITY_LOGON_TYPE)
+};
+
+
+/** Publishes the current PolicySnapshot RCU-style.
+    Readers never lock: they pin the current snapshot by counting themselves in the reader slot of
+    the current epoch. A registry change notification compiles a new snapshot and atomically swaps
+    it in without restarting LSA. The replaced snapshot is deleted once its epoch has no readers left. */
+class PolicyStore {
+public:
+    /** Keeps the snapshot that was current on construction alive until destroyed. */
+    class ReadGuard {
+    public:
+        explicit ReadGuard(const PolicyStore& store);
+        ~ReadGuard();
+
+        ReadGuard(const ReadGuard&) = delete;
+        ReadGuard& operator=(const ReadGuard&) = delete;
+
+        const PolicySnapshot& operator*() const {
+            return *m_snapshot;
+        }
+        const PolicySnapshot* operator->() const {
+            return m_snapshot;
+        }
+
+    private:
+        const PolicyStore&    m_store;
+        unsigned              m_slot = 0;
+        const PolicySnapshot* m_snapshot = nullptr;
+    };
+
+    PolicyStore();
+
+    void Start();
+
+    /** Stop watching for changes. The last loaded policy stays in effect. */
+    void Stop();
+
+    /** Pin the current snapshot. Only retries if racing with Publish. */
+    ReadGuard Current() const {
+        return ReadGuard(*this);
+    }
+
+    /** Swap in "snapshot" and delete the replaced one once no reader uses it anymore.
+        Waits for in-flight readers, so it must not be called while holding a ReadGuard. */
+    void Publish(std::unique_ptr<PolicySnapshot> snapshot);
+
+private:
+    void Reload();
+    bool ArmNotification();
+
+    std::atomic<const PolicySnapshot*> m_current;
+    std::unique_ptr<PolicySnapshot>    m_snapshot;    // owns m_current unless it's the built-in default
+    std::atomic<unsigned>              m_epoch = 0;   // incremented on every Publish
+    mutable std::atomic<size_t>        m_readers[2];  // readers pinned during even & odd epochs
+    std::mutex                         m_reloadMutex; // serialize writers
+    HKEY                               m_key = nullptr;
+    HANDLE                             m_event = nullptr;
+    HANDLE                             m_wait = nullptr;
+};
+
+extern PolicyStore Policy;
@@ -3,8 +3,17 @@
 #include <vector>
 #include <NTSecAPI.h> // for MSV1_0_INTERACTIVE_LOGON
 #include <NTSecPKG.h> // for PLSA_CLIENT_REQUEST
+#include "LogonBuffer.hpp"
 
 
-ULONG GetProfileBufferSize(const std::wstring& computername, const MSV1_0_INTERACTIVE_LOGON& logonInfo);
+/** Strings of the MSV1_0_INTERACTIVE_PROFILE for a logon together with the buffer size they need.
+    Computed once, so that the client buffer allocation and PrepareProfileBuffer use the same layout. */
+struct ProfileLayout {
+    InteractiveProfileLayout::Strings Strings; // views into the computer name & submit buffer
+    ULONG                             Size = 0;
+};
 
-std::vector<BYTE> PrepareProfileBuffer(const std::wstring& computername, const MSV1_0_INTERACTIVE_LOGON& logonInfo, BYTE* hostProfileAddress);
+ProfileLayout GetProfileLayout(std::wstring_view computername, const MSV1_0_INTERACTIVE_LOGON& logonInfo);
+
+/** Pack the profile into "layout.Size" bytes with string addresses relative to "hostProfileAddress". */
+std::vector<BYTE> PrepareProfileBuffer(const ProfileLayout& layout, BYTE* hostProfileAddress);
@@ -1,32 +1,41 @@
 #include "PrepareToken.hpp"
-#include <Lm.h>
+#include "AccountCache.hpp"
 #include "Utils.hpp"
 
-#pragma comment(lib, "Netapi32.lib")
 
+/** Bump allocator for carving all token parts out of one pre-sized LSA heap block.
+    Lets LsaTokenInformationV2 tokens be built in linear time with a single allocation. */
+class TokenArena {
+public:
+    TokenArena(BYTE* buffer, size_t size) : m_cur(buffer), m_end(buffer + size) {
+    }
 
-static bool NameToSid(const wchar_t* username, PSID* userSid) {
-    DWORD lengthSid = 0;
-    SID_NAME_USE Use = {};
-    DWORD referencedDomainNameLen = 0;
-    BOOL res = LookupAccountNameW(nullptr, username, nullptr, &lengthSid, nullptr, &referencedDomainNameLen, &Use);
+    void* Allocate(size_t size) {
+        assert(m_cur + size <= m_end);
+        void* ptr = m_cur;
+        m_cur += (size + 7) & ~(size_t)7; // keep 8-byte alignment for pointer members
+        return ptr;
+    }
 
-    *userSid = (PSID)FunctionTable.AllocateLsaHeap(lengthSid);
-    wchar_t* referencedDomainName = (wchar_t*)FunctionTable.AllocateLsaHeap(sizeof(wchar_t) * referencedDomainNameLen); // throwaway string
-    res = LookupAccountNameW(nullptr, username, *userSid, &lengthSid, referencedDomainName, &referencedDomainNameLen, &Use);
-    if (!res) {
-        DWORD err = GetLastError();
-        LogMessage("  LookupAccountNameW failed (err %u)", err);
-        return false;
+    PSID CopySid(const std::vector<BYTE>& sid) {
+        auto* copy = (PSID)Allocate(sid.size());
+        memcpy(/*dst*/copy, /*src*/sid.data(), sid.size());
+        return copy;
     }
 
-    FunctionTable.FreeLsaHeap(referencedDomainName);
-    return true;
-}
+    /** Arena size needed for a SID. */
+    static size_t SidSize(const std::vector<BYTE>& sid) {
+        return (sid.size() + 7) & ~(size_t)7;
+    }
+
+private:
+    BYTE* m_cur = nullptr;
+    BYTE* m_end = nullptr;
+};
 
-static void GetPrimaryGroupSidFromUserSid(PSID userSID, PSID* primaryGroupSID) {
+static void GetPrimaryGroupSidFromUserSid(PSID userSID, TokenArena& arena, PSID* primaryGroupSID) {
     // duplicate the user sid
-    *primaryGroupSID = (PSID)FunctionTable.AllocateLsaHeap(GetLengthSid(userSID));
+    *primaryGroupSID = (PSID)arena.Allocate(GetLengthSid(userSID));
     CopySid(GetLengthSid(userSID), *primaryGroupSID, userSID);
 
     // replace the last subauthority by DOMAIN_GROUP_RID_USERS
@@ -36,30 +45,11 @@ static void GetPrimaryGroupSidFromUserSid(PSID userSID, PSID* primaryGroupSID) {
     *GetSidSubAuthority(*primaryGroupSID, SubAuthorityCount - 1) = DOMAIN_GROUP_RID_USERS;
 }
 
-static bool GetGroups(const wchar_t* UserName, GROUP_USERS_INFO_1** lpGroupInfo, DWORD* pTotalEntries) {
-    DWORD NumberOfEntries = 0;
-    DWORD status = NetUserGetGroups(NULL, UserName, 1, (BYTE**)lpGroupInfo, MAX_PREFERRED_LENGTH, &NumberOfEntries, pTotalEntries);
-    if (status != NERR_Success) {
-        LogMessage("ERROR: NetUserGetGroups failed with error %u", status );
-        return false;
-    }
-    return true;
-}
-
-static bool GetLocalGroups(const wchar_t* UserName, GROUP_USERS_INFO_0** lpGroupInfo, DWORD* pTotalEntries) {
-    DWORD NumberOfEntries = 0;
-    DWORD status = NetUserGetLocalGroups(NULL, UserName, 0, 0, (BYTE**)lpGroupInfo, MAX_PREFERRED_LENGTH, &NumberOfEntries, pTotalEntries);
-    if (status != NERR_Success) {
-        LogMessage("ERROR: NetUserGetLocalGroups failed with error %u", status);
-        return false;
-    }
-    return true;
-}
-
 
 NTSTATUS UserNameToToken(
     __in LSA_UNICODE_STRING* AccountName,
-    __out LSA_TOKEN_INFORMATION_V1** Token,
+    __in const PolicyStore& policy,
+    __out LSA_TOKEN_INFORMATION_V2** Token,
     __out PNTSTATUS SubStatus
 ) {
     const LARGE_INTEGER Forever {
@@ -70,15 +60,41 @@ NTSTATUS UserNameToToken(
     // convert username to zero-terminated string
     std::wstring username = ToWstring(*AccountName);
 
-    auto* token = (LSA_TOKEN_INFORMATION_V1*)FunctionTable.AllocateLsaHeap(sizeof(LSA_TOKEN_INFORMATION_V1));
+    // reuse prefetched directory information if available
+    AccountCache::Entry account = Accounts.Get(username);
+    if (!account)
+        return STATUS_FAIL_FAST_EXCEPTION;
+
+    if (!policy.Current()->AllowsAccount(username, *account)) {
+        LogMessage("  ERROR: Account denied by policy");
+        *SubStatus = STATUS_ACCOUNT_RESTRICTION;
+        return STATUS_ACCOUNT_RESTRICTION;
+    }
+
+    // groups are already de-duplicated and sorted by CanonicalizeGroups
+    auto GroupCount = (DWORD)account->Groups.size();
+    LogMessage("  GroupCount: %u", GroupCount);
+
+    // size single block: token header, group array, user SID, primary group SID and group SIDs
+    size_t tokenSize = sizeof(LSA_TOKEN_INFORMATION_V2);
+    tokenSize += (FIELD_OFFSET(TOKEN_GROUPS, Groups[GroupCount]) + 7) & ~(size_t)7;
+    tokenSize += 2*TokenArena::SidSize(account->UserSid);
+    for (const AccountInfo::Group& group : account->Groups)
+        tokenSize += TokenArena::SidSize(group.Sid);
+
+    auto* tokenBuffer = (BYTE*)FunctionTable.AllocateLsaHeap((ULONG)tokenSize);
+    if (!tokenBuffer)
+        return STATUS_NO_MEMORY;
+    TokenArena arena(tokenBuffer, tokenSize);
+
+    auto* token = (LSA_TOKEN_INFORMATION_V2*)arena.Allocate(sizeof(LSA_TOKEN_INFORMATION_V2));
 
     token->ExpirationTime = Forever;
 
     PSID userSid = nullptr;
     {
         // configure "User"
-        if (!NameToSid(username.c_str(), &userSid))
-            return STATUS_FAIL_FAST_EXCEPTION;
+        userSid = arena.CopySid(account->UserSid);
 
         LogMessage("  User.User: %ls", username.c_str());
         token->User.User = {
@@ -89,41 +105,19 @@ NTSTATUS UserNameToToken(
 
     {
         // configure "Groups"
-        DWORD NumberOfGroups = 0;
-        GROUP_USERS_INFO_1* pGroupInfo = nullptr;
-        if (!GetGroups(username.c_str(), &pGroupInfo, &NumberOfGroups)) {
-            return STATUS_FAIL_FAST_EXCEPTION;
-        }
-        LogMessage("  NumberOfGroups: %u", NumberOfGroups);
-
-        DWORD NumberOfLocalGroups = 0;
-        GROUP_USERS_INFO_0* pLocalGroupInfo = nullptr;
-        if (!GetLocalGroups(username.c_str(), &pLocalGroupInfo, &NumberOfLocalGroups)) {
-            return STATUS_FAIL_FAST_EXCEPTION;
-        }
-        LogMessage("  NumberOfLocalGroups: %u", NumberOfLocalGroups);
-
-        TOKEN_GROUPS* tokenGroups = (TOKEN_GROUPS*)FunctionTable.AllocateLsaHeap(FIELD_OFFSET(TOKEN_GROUPS, Groups[NumberOfGroups + NumberOfLocalGroups]));
-        tokenGroups->GroupCount = NumberOfGroups + NumberOfLocalGroups;
-        for (size_t i = 0; i < NumberOfGroups; i++) {
-            NameToSid(pGroupInfo[i].grui1_name, &tokenGroups->Groups[i].Sid);
-
-            tokenGroups->Groups[i].Attributes = pGroupInfo[i].grui1_attributes;
-        }
-        for (size_t i = 0; i < NumberOfLocalGroups; i++) {
-            NameToSid(pLocalGroupInfo[i].grui0_name, &tokenGroups->Groups[NumberOfGroups + i].Sid);
-
-            // get the attributes of group since pLocalGroupInfo doesn't contain attributes
-            if (*GetSidSubAuthority(tokenGroups->Groups[NumberOfGroups + i].Sid, 0) != SECURITY_BUILTIN_DOMAIN_RID)
-                tokenGroups->Groups[NumberOfGroups + i].Attributes = SE_GROUP_ENABLED | SE_GROUP_ENABLED_BY_DEFAULT;
-            else
-                tokenGroups->Groups[NumberOfGroups + i].Attributes = 0;
+        TOKEN_GROUPS* tokenGroups = (TOKEN_GROUPS*)arena.Allocate(FIELD_OFFSET(TOKEN_GROUPS, Groups[GroupCount]));
+        tokenGroups->GroupCount = GroupCount;
+        for (size_t i = 0; i < GroupCount; i++) {
+            tokenGroups->Groups[i] = {
+                .Sid = arena.CopySid(account->Groups[i].Sid),
+                .Attributes = account->Groups[i].Attributes,
+            };
         }
 
         token->Groups = tokenGroups;
     }
 
-    GetPrimaryGroupSidFromUserSid(userSid, &token->PrimaryGroup.PrimaryGroup);
+    GetPrimaryGroupSidFromUserSid(userSid, arena, &token->PrimaryGroup.PrimaryGroup);
 
     // TOKEN_PRIVILEGES Privileges not currently configured
     token->Privileges = nullptr;
@@ -5,8 +5,14 @@
 #include <sspi.h>
 #include <NTSecAPI.h>  // for LSA_STRING
 #include <ntsecpkg.h>  // for LSA_DISPATCH_TABLE
+#include "AccountResolver.hpp"
+#include "Policy.hpp"
 
 
+/** Build token information for an account if allowed by the current snapshot of "policy".
+    The snapshot is only pinned for the account check, not across the directory lookup, so that policy reloads never wait for the directory.
+    The token is allocated as a single LSA heap block, so it must be returned as LsaTokenInformationV2. */
 NTSTATUS UserNameToToken(__in LSA_UNICODE_STRING* AccountName,
-    __out LSA_TOKEN_INFORMATION_V1** Token,
+    __in const PolicyStore& policy,
+    __out LSA_TOKEN_INFORMATION_V2** Token,
     __out PNTSTATUS SubStatus);
@@ -0,0 +1,16 @@
+#pragma once
+#include <windows.h>
+#include <NTSecAPI.h> // for LSA_UNICODE_STRING
+
+/** Message types accepted through LsaCallAuthenticationPackage.
+    Must be kept in sync with ReversePassword/Constants.cs. */
+enum NOPASSWORD_PROTOCOL_MESSAGE_TYPE : ULONG {
+    NoPasswordPrefetchAccount = 1,
+};
+
+/** Hint that an account is about to log on, so that directory lookups can start early.
+    UserName.Buffer is relative to the start of the request, similar to MSV1_0_INTERACTIVE_LOGON. */
+struct NOPASSWORD_PREFETCH_REQUEST {
+    NOPASSWORD_PROTOCOL_MESSAGE_TYPE MessageType;
+    LSA_UNICODE_STRING UserName;
+};
@@ -0,0 +1,293 @@
+#ifndef _WINDLL
+#include "Replay.hpp"
+#include "AccountCache.hpp"
+#include "LogonBuffer.hpp"
+#include "LogonCorpus.hpp"
+#include "PrepareProfile.hpp"
+#include "PrepareToken.hpp"
+#include "Utils.hpp"
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <optional>
+#include <sstream>
+
+
+std::atomic<size_t> AllocationCount = 0;
+
+/** Count all C++ heap allocations, so that the replay can enforce an allocation budget. */
+void* operator new(size_t size) {
+    AllocationCount++;
+    if (void* ptr = malloc(size ? size : 1))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    free(ptr);
+}
+
+
+static std::string Narrow(const std::wstring& str) {
+    std::string result(str.size(), '\0');
+    for (size_t i = 0; i < str.size(); i++)
+        result[i] = (char)str[i]; // pseudonyms are ASCII
+    return result;
+}
+
+static std::wstring Widen(const std::string& str) {
+    return std::wstring(str.begin(), str.end());
+}
+
+
+/** Directory that answers with responses recorded by LogonRecorder. */
+class ReplayDirectory : public AccountDirectory {
+public:
+    bool NameToSid(const std::wstring& name, std::vector<BYTE>& sid) override {
+        auto it = Sids.find(Narrow(name));
+        if ((it == Sids.end()) || !it->second)
+            return false;
+        sid = *it->second;
+        return true;
+    }
+
+    bool GetGroups(const std::wstring& username, std::vector<DirectoryGroup>& groups) override {
+        auto it = Groups.find(Narrow(username));
+        if ((it == Groups.end()) || !it->second)
+            return false;
+        groups = *it->second;
+        return true;
+    }
+
+    bool GetLocalGroups(const std::wstring& username, std::vector<std::wstring>& groups) override {
+        auto it = LocalGroups.find(Narrow(username));
+        if ((it == LocalGroups.end()) || !it->second)
+            return false;
+        groups = *it->second;
+        return true;
+    }
+
+    // recorded responses (std::nullopt for failed lookups)
+    std::map<std::string, std::optional<std::vector<BYTE>>>           Sids;
+    std::map<std::string, std::optional<std::vector<DirectoryGroup>>> Groups;
+    std::map<std::string, std::optional<std::vector<std::wstring>>>   LocalGroups;
+};
+
+struct RecordedLogon {
+    SECURITY_LOGON_TYPE Type = Interactive;
+    std::vector<BYTE>   Buffer;
+};
+
+
+/** Parse corpus file. Later responses override earlier ones for the same name. */
+static bool LoadCorpus(const std::wstring& path, std::vector<RecordedLogon>& logons, ReplayDirectory& directory) {
+    std::ifstream file(path);
+    if (!file) {
+        wprintf(L"ERROR: Unable to open %ls\n", path.c_str());
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream fields(line);
+        std::string tag, name, value;
+        fields >> tag >> name >> value;
+
+        if (tag == "L") {
+            logons.push_back({ (SECURITY_LOGON_TYPE)std::stoi(name), FromHex(value) });
+        } else if (tag == "S") {
+            std::vector<BYTE> sid;
+            if ((value != "-") && StringToSid(value, sid))
+                directory.Sids[name] = sid;
+            else
+                directory.Sids[name] = std::nullopt;
+        } else if (tag == "G") {
+            if (value == "-") {
+                directory.Groups[name] = std::nullopt;
+                continue;
+            }
+            std::vector<DirectoryGroup> groups(std::stoul(value));
+            for (DirectoryGroup& group : groups) {
+                std::string entry;
+                fields >> entry;
+                size_t sep = entry.rfind(':');
+                group.Name = Widen(entry.substr(0, sep));
+                group.Attributes = std::stoul(entry.substr(sep + 1));
+            }
+            directory.Groups[name] = groups;
+        } else if (tag == "A") {
+            if (value == "-") {
+                directory.LocalGroups[name] = std::nullopt;
+                continue;
+            }
+            std::vector<std::wstring> groups(std::stoul(value));
+            for (std::wstring& group : groups) {
+                std::string entry;
+                fields >> entry;
+                group = Widen(entry);
+            }
+            directory.LocalGroups[name] = groups;
+        }
+    }
+    return true;
+}
+
+
+static void AppendBytes(std::vector<BYTE>& out, const void* data, size_t size) {
+    out.insert(out.end(), (const BYTE*)data, (const BYTE*)data + size);
+}
+
+static void AppendSid(std::vector<BYTE>& out, PSID sid) {
+    DWORD length = sid ? GetLengthSid(sid) : 0;
+    AppendBytes(out, &length, sizeof(length));
+    AppendBytes(out, sid, length);
+}
+
+/** Serialize token contents without pointers, so that the result is independent of heap addresses. */
+static std::vector<BYTE> SerializeToken(const LSA_TOKEN_INFORMATION_V2& token) {
+    std::vector<BYTE> out;
+    AppendBytes(out, &token.ExpirationTime, sizeof(token.ExpirationTime));
+    AppendSid(out, token.User.User.Sid);
+    AppendBytes(out, &token.User.User.Attributes, sizeof(DWORD));
+
+    DWORD groupCount = token.Groups ? token.Groups->GroupCount : 0;
+    AppendBytes(out, &groupCount, sizeof(groupCount));
+    for (DWORD i = 0; i < groupCount; i++) {
+        AppendSid(out, token.Groups->Groups[i].Sid);
+        AppendBytes(out, &token.Groups->Groups[i].Attributes, sizeof(DWORD));
+    }
+
+    AppendSid(out, token.PrimaryGroup.PrimaryGroup);
+    DWORD privilegeCount = token.Privileges ? token.Privileges->PrivilegeCount : 0;
+    AppendBytes(out, &privilegeCount, sizeof(privilegeCount));
+    if (privilegeCount)
+        AppendBytes(out, token.Privileges->Privileges, privilegeCount * sizeof(LUID_AND_ATTRIBUTES));
+    AppendSid(out, token.Owner.Owner);
+    DWORD daclSize = token.DefaultDacl.DefaultDacl ? token.DefaultDacl.DefaultDacl->AclSize : 0;
+    AppendBytes(out, token.DefaultDacl.DefaultDacl, daclSize);
+    return out;
+}
+
+
+/** Replay all logons once. Returns one output line per logon. */
+static std::string ReplayLogons(const std::vector<RecordedLogon>& logons) {
+    std::string output;
+    for (size_t i = 0; i < logons.size(); i++) {
+        std::vector<BYTE> buffer = logons[i].Buffer; // unpacked in-place
+        MSV1_0_INTERACTIVE_LOGON* logonInfo = UnpackInteractiveLogon(buffer.data(), (ULONG)buffer.size());
+        if (!logonInfo) {
+            output += "R " + std::to_string(i) + " malformed\n";
+            continue;
+        }
+
+        Accounts.Clear(); // resolve every logon through the directory
+
+        LSA_TOKEN_INFORMATION_V2* token = nullptr;
+        NTSTATUS subStatus = 0;
+        NTSTATUS status = UserNameToToken(&logonInfo->UserName, Policy, &token, &subStatus);
+
+        std::vector<BYTE> tokenData;
+        if (status == STATUS_SUCCESS) {
+            tokenData = SerializeToken(*token);
+            FunctionTable.FreeLsaHeap(token);
+        }
+
+        std::vector<BYTE> profile;
+        if ((status == STATUS_SUCCESS) && ((logons[i].Type == Interactive) || (logons[i].Type == RemoteInteractive))) {
+            profile = PrepareProfileBuffer(GetProfileLayout(L"REPLAY", *logonInfo), /*hostProfileAddress*/nullptr); // relative addresses
+            ((MSV1_0_INTERACTIVE_PROFILE*)profile.data())->LogonTime = {}; // mask current time
+        }
+
+        char statusStr[16] = {};
+        sprintf_s(statusStr, "%08x", (ULONG)status);
+        output += "R " + std::to_string(i) + " " + statusStr + " " + ToHex(tokenData.data(), tokenData.size()) + " " + ToHex(profile.data(), profile.size()) + "\n";
+    }
+    return output;
+}
+
+
+int ReplayTest(const std::wstring& corpusPath, const std::wstring& goldenPath, bool update, double timeTolerance, double allocTolerance) {
+    std::vector<RecordedLogon> logons;
+    auto directory = std::make_unique<ReplayDirectory>();
+    if (!LoadCorpus(corpusPath, logons, *directory))
+        return -1;
+    if (logons.empty()) {
+        wprintf(L"ERROR: No logons in %ls\n", corpusPath.c_str());
+        return -1;
+    }
+    SelectAccountResolver(std::make_unique<NetApiResolver>(std::move(directory)));
+
+    // first pass: output & allocation count
+    size_t allocStart = AllocationCount;
+    std::string output = ReplayLogons(logons);
+    double allocsPerLogon = (double)(AllocationCount - allocStart) / logons.size();
+
+    // timed passes: keep the fastest to reduce noise
+    const int REPEAT = 5;
+    double usPerLogon = 0;
+    for (int i = 0; i < REPEAT; i++) {
+        auto start = std::chrono::steady_clock::now();
+        ReplayLogons(logons);
+        auto stop = std::chrono::steady_clock::now();
+        double us = std::chrono::duration<double, std::micro>(stop - start).count() / logons.size();
+        usPerLogon = (i == 0) ? us : std::min<double>(usPerLogon, us);
+    }
+    wprintf(L"Replayed %zu logons: %.1f us and %.1f allocations per logon\n", logons.size(), usPerLogon, allocsPerLogon);
+
+    if (update) {
+        std::ofstream golden(goldenPath, std::ios::binary);
+        golden << "B " << usPerLogon << " " << allocsPerLogon << "\n" << output;
+        if (!golden) {
+            wprintf(L"ERROR: Unable to write %ls\n", goldenPath.c_str());
+            return -1;
+        }
+        wprintf(L"Golden file %ls updated.\n", goldenPath.c_str());
+        return 0;
+    }
+
+    std::ifstream golden(goldenPath, std::ios::binary);
+    std::string baseline;
+    if (!std::getline(golden, baseline)) {
+        wprintf(L"ERROR: Unable to read %ls\n", goldenPath.c_str());
+        return -1;
+    }
+    double baselineUs = 0, baselineAllocs = 0;
+    std::istringstream(baseline.substr(2)) >> baselineUs >> baselineAllocs;
+    std::string expected((std::istreambuf_iterator<char>(golden)), std::istreambuf_iterator<char>());
+
+    int result = 0;
+    if (output != expected) {
+        // report first differing logon
+        std::istringstream actualLines(output), expectedLines(expected);
+        std::string actualLine, expectedLine;
+        bool reported = false;
+        while (!reported && std::getline(expectedLines, expectedLine)) {
+            std::getline(actualLines, actualLine);
+            if (actualLine != expectedLine) {
+                wprintf(L"FAILED: Output differs from golden file:\n  expected: %.120hs\n  actual:   %.120hs\n", expectedLine.c_str(), actualLine.c_str());
+                reported = true;
+            }
+        }
+        if (!reported)
+            wprintf(L"FAILED: Output differs from golden file in logon count.\n");
+        result = 1;
+    }
+    if (usPerLogon > baselineUs * (1 + timeTolerance)) {
+        wprintf(L"FAILED: %.1f us per logon exceeds baseline %.1f us by more than %.0f%%\n", usPerLogon, baselineUs, 100 * timeTolerance);
+        result = 1;
+    }
+    if (allocsPerLogon > baselineAllocs * (1 + allocTolerance)) {
+        wprintf(L"FAILED: %.1f allocations per logon exceeds baseline %.1f by more than %.0f%%\n", allocsPerLogon, baselineAllocs, 100 * allocTolerance);
+        result = 1;
+    }
+
+    if (result == 0)
+        wprintf(L"Replay matches golden file.\n");
+    return result;
+}
+
+#endif
@@ -0,0 +1,11 @@
+#pragma once
+#include <atomic>
+#include <string>
+
+/** Number of heap allocations made by the test EXE. */
+extern std::atomic<size_t> AllocationCount;
+
+/** Replay a recorded logon corpus and compare the resulting tokens & profiles against a golden file.
+    Fails if the output differs, or if time or allocations per logon exceed the golden baseline by more than the given fractions.
+    Writes a new golden file instead if "update" is set. */
+int ReplayTest(const std::wstring& corpusPath, const std::wstring& goldenPath, bool update, double timeTolerance, double allocTolerance);
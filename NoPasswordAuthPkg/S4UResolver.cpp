@@ -0,0 +1,65 @@
+#include "AccountResolver.hpp"
+#include "Utils.hpp"
+
+#pragma comment(lib, "Authz.lib")
+
+
+S4UResolver::S4UResolver() {
+    // resource manager without callbacks or auditing, only used to create client contexts
+    if (!AuthzInitializeResourceManager(AUTHZ_RM_FLAG_NO_AUDIT, nullptr, nullptr, nullptr, nullptr, &m_rm)) {
+        DWORD err = GetLastError();
+        LogMessage("ERROR: AuthzInitializeResourceManager failed with error %u", err);
+        m_rm = nullptr;
+    }
+}
+
+S4UResolver::~S4UResolver() {
+    if (m_rm)
+        AuthzFreeResourceManager(m_rm);
+}
+
+bool S4UResolver::Resolve(const std::wstring& username, AccountInfo& info) {
+    if (!m_rm)
+        return false;
+
+    if (!NameToSid(username.c_str(), info.UserSid))
+        return false;
+
+    AUTHZ_CLIENT_CONTEXT_HANDLE ctx = nullptr;
+    if (!AuthzInitializeContextFromSid(0, info.UserSid.data(), m_rm, /*expiration*/nullptr, /*identifier*/LUID{}, /*dynamicGroupArgs*/nullptr, &ctx)) {
+        DWORD err = GetLastError();
+        LogMessage("ERROR: AuthzInitializeContextFromSid failed with error %u", err);
+        return false;
+    }
+
+    std::vector<BYTE> groupsBuf;
+    {
+        DWORD bufSize = 0;
+        AuthzGetInformationFromContext(ctx, AuthzContextInfoGroupsSids, 0, &bufSize, nullptr); // expected to fail
+        groupsBuf.resize(bufSize, (BYTE)0);
+        if (!AuthzGetInformationFromContext(ctx, AuthzContextInfoGroupsSids, bufSize, &bufSize, groupsBuf.data())) {
+            DWORD err = GetLastError();
+            LogMessage("ERROR: AuthzGetInformationFromContext failed with error %u", err);
+            AuthzFreeContext(ctx);
+            return false;
+        }
+    }
+    AuthzFreeContext(ctx);
+
+    auto* tg = (TOKEN_GROUPS*)groupsBuf.data();
+    LogMessage("  NumberOfGroups: %u", tg->GroupCount);
+
+    info.Groups.reserve(tg->GroupCount);
+    for (DWORD i = 0; i < tg->GroupCount; i++) {
+        if (tg->Groups[i].Attributes & SE_GROUP_LOGON_ID)
+            continue; // LSA adds its own logon SID
+
+        auto* sid = (BYTE*)tg->Groups[i].Sid;
+        info.Groups.push_back(AccountInfo::Group{
+            .Sid = std::vector<BYTE>(sid, sid + GetLengthSid(sid)),
+            .Attributes = tg->Groups[i].Attributes,
+        });
+    }
+
+    return true;
+}
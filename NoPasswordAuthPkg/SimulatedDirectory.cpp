@@ -0,0 +1,142 @@
+#include "SimulatedDirectory.hpp"
+#include <chrono>
+#include <cmath>
+#include <thread>
+
+
+/** Delay with sub-millisecond precision, since Sleep has a coarse timer resolution. */
+static void PreciseDelay(double ms) {
+    using namespace std::chrono;
+    auto deadline = steady_clock::now() + duration_cast<steady_clock::duration>(duration<double, std::milli>(ms));
+    if (ms > 2.0)
+        std::this_thread::sleep_for(duration<double, std::milli>(ms - 2.0));
+    while (steady_clock::now() < deadline)
+        std::this_thread::yield();
+}
+
+/** Build S-1-5-21-1-2-3-<rid> or S-1-5-32-<rid> SID in self-relative binary format. */
+static std::vector<BYTE> MakeSid(bool builtin, DWORD rid) {
+    std::vector<DWORD> subAuthorities;
+    if (builtin)
+        subAuthorities = { SECURITY_BUILTIN_DOMAIN_RID, rid };
+    else
+        subAuthorities = { SECURITY_NT_NON_UNIQUE, 1, 2, 3, rid };
+
+    std::vector<BYTE> sid(GetSidLengthRequired((UCHAR)subAuthorities.size()), (BYTE)0);
+    SID_IDENTIFIER_AUTHORITY authority = SECURITY_NT_AUTHORITY;
+    InitializeSid(sid.data(), &authority, (BYTE)subAuthorities.size());
+    for (size_t i = 0; i < subAuthorities.size(); i++)
+        *GetSidSubAuthority(sid.data(), (DWORD)i) = subAuthorities[i];
+    return sid;
+}
+
+/** Parse the numeric suffix of "<prefix><N>" names. */
+static bool ParseIndex(const std::wstring& name, const wchar_t* prefix, DWORD* index) {
+    size_t prefixLen = wcslen(prefix);
+    if ((name.size() <= prefixLen) || (_wcsnicmp(name.c_str(), prefix, prefixLen) != 0))
+        return false;
+
+    wchar_t* end = nullptr;
+    *index = wcstoul(name.c_str() + prefixLen, &end, 10);
+    return *end == L'\0';
+}
+
+
+SimulatedDirectory::SimulatedDirectory(const LatencyProfile& latency, unsigned groupCount, unsigned seed) : m_latency(latency), m_groupCount(groupCount), m_random(seed) {
+}
+
+bool SimulatedDirectory::SimulateRoundTrip() {
+    double delayMs = 0;
+    bool fail = false;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::lognormal_distribution<double> latency(std::log(m_latency.MedianMs), m_latency.Sigma);
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+        delayMs = latency(m_random);
+        if (uniform(m_random) < m_latency.StallRate)
+            delayMs += m_latency.StallMs;
+        fail = uniform(m_random) < m_latency.ErrorRate;
+    }
+
+    PreciseDelay(delayMs);
+    if (fail)
+        SetLastError(ERROR_NO_LOGON_SERVERS);
+    return !fail;
+}
+
+bool SimulatedDirectory::NameToSid(const std::wstring& name, std::vector<BYTE>& sid) {
+    if (!SimulateRoundTrip())
+        return false;
+
+    DWORD index = 0;
+    if (ParseIndex(name, L"user", &index)) {
+        sid = MakeSid(false, 1000 + index);
+        return true;
+    }
+    if (ParseIndex(name, L"group", &index)) {
+        sid = MakeSid(false, 100000 + index);
+        return true;
+    }
+    if (_wcsicmp(name.c_str(), L"Users") == 0) {
+        sid = MakeSid(true, DOMAIN_ALIAS_RID_USERS);
+        return true;
+    }
+
+    SetLastError(ERROR_NONE_MAPPED);
+    return false;
+}
+
+bool SimulatedDirectory::GetGroups(const std::wstring& username, std::vector<DirectoryGroup>& groups) {
+    if (!SimulateRoundTrip())
+        return false;
+
+    DWORD index = 0;
+    if (!ParseIndex(username, L"user", &index))
+        return false;
+
+    // every user is member of "GroupCount" synthetic groups
+    groups.reserve(m_groupCount);
+    for (unsigned i = 0; i < m_groupCount; i++)
+        groups.push_back(DirectoryGroup{ L"group" + std::to_wstring(i), SE_GROUP_MANDATORY | SE_GROUP_ENABLED | SE_GROUP_ENABLED_BY_DEFAULT });
+    return true;
+}
+
+bool SimulatedDirectory::GetLocalGroups(const std::wstring& username, std::vector<std::wstring>& groups) {
+    if (!SimulateRoundTrip())
+        return false;
+
+    DWORD index = 0;
+    if (!ParseIndex(username, L"user", &index))
+        return false;
+
+    groups.push_back(L"Users");
+    return true;
+}
+
+bool SimulatedDirectory::GetTokenGroups(const std::wstring& username, std::vector<AccountInfo::Group>& groups) {
+    if (!SimulateRoundTrip())
+        return false;
+
+    DWORD index = 0;
+    if (!ParseIndex(username, L"user", &index))
+        return false;
+
+    // same memberships as GetGroups & GetLocalGroups, but already as SIDs
+    groups.reserve(m_groupCount + 1);
+    for (unsigned i = 0; i < m_groupCount; i++)
+        groups.push_back(AccountInfo::Group{ MakeSid(false, 100000 + i), SE_GROUP_MANDATORY | SE_GROUP_ENABLED | SE_GROUP_ENABLED_BY_DEFAULT });
+    groups.push_back(AccountInfo::Group{ MakeSid(true, DOMAIN_ALIAS_RID_USERS), SE_GROUP_ENABLED | SE_GROUP_ENABLED_BY_DEFAULT });
+    return true;
+}
+
+
+SimulatedS4UResolver::SimulatedS4UResolver(std::unique_ptr<SimulatedDirectory> directory) : m_directory(std::move(directory)) {
+}
+
+bool SimulatedS4UResolver::Resolve(const std::wstring& username, AccountInfo& info) {
+    if (!m_directory->NameToSid(username, info.UserSid))
+        return false;
+
+    return m_directory->GetTokenGroups(username, info.Groups);
+}
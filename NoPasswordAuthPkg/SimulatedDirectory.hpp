@@ -0,0 +1,55 @@
+#pragma once
+#include <mutex>
+#include <random>
+#include "AccountDirectory.hpp"
+#include "AccountResolver.hpp"
+
+
+/** Latency and failure characteristics of a simulated directory lookup. */
+struct LatencyProfile {
+    double MedianMs = 1.0;  // median of log-normal lookup latency
+    double Sigma = 0.5;     // log-normal shape (larger values give longer tails)
+    double ErrorRate = 0.0; // probability that a lookup fails
+    double StallRate = 0.0; // probability that a lookup stalls, e.g. due to domain controller fail-over
+    double StallMs = 0.0;   // additional delay for stalled lookups
+};
+
+/** Stand-in for a domain controller with configurable latency, error rate and stalls.
+    Every "user<N>" account exists with "GroupCount" global groups named "group<M>" and membership
+    in the local "Users" group. SIDs are synthesized from the names, so results are deterministic. */
+class SimulatedDirectory : public AccountDirectory {
+public:
+    SimulatedDirectory(const LatencyProfile& latency, unsigned groupCount, unsigned seed = 1);
+
+    bool NameToSid(const std::wstring& name, std::vector<BYTE>& sid) override;
+
+    bool GetGroups(const std::wstring& username, std::vector<DirectoryGroup>& groups) override;
+
+    bool GetLocalGroups(const std::wstring& username, std::vector<std::wstring>& groups) override;
+
+    /** Complete group SID set of a user in a single round trip, like an S4U logon against the domain controller. */
+    bool GetTokenGroups(const std::wstring& username, std::vector<AccountInfo::Group>& groups);
+
+private:
+    /** Sleep according to the latency profile. Returns false for injected failures. */
+    bool SimulateRoundTrip();
+
+    LatencyProfile  m_latency;
+    unsigned        m_groupCount = 0;
+    std::mutex      m_mutex; // protect random generator
+    std::mt19937_64 m_random;
+};
+
+/** Stand-in for S4UResolver that reads the user SID and the complete group set from a simulated directory.
+    Takes two round trips regardless of group count, and yields the same groups as NetApiResolver over the same directory. */
+class SimulatedS4UResolver : public AccountResolver {
+public:
+    explicit SimulatedS4UResolver(std::unique_ptr<SimulatedDirectory> directory);
+
+    const wchar_t* Name() const override { return L"S4U"; }
+
+    bool Resolve(const std::wstring& username, AccountInfo& info) override;
+
+private:
+    std::unique_ptr<SimulatedDirectory> m_directory;
+};
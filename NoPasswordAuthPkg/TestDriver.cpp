@@ -0,0 +1,820 @@
+#ifndef _WINDLL
+#include "PrepareToken.hpp"
+#include "AccountCache.hpp"
+#include "AuditLog.hpp"
+#include "LogonBuffer.hpp"
+#include "Replay.hpp"
+#include "SimulatedDirectory.hpp"
+#include "Utf16.hpp"
+#include "Utils.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <stdio.h>
+
+
+/** Stand-in for LSA heap functions when running outside of lsass. */
+static void* NTAPI AllocateHeap(ULONG length) {
+    AllocationCount++;
+    return HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, length);
+}
+
+static void NTAPI FreeHeap(void* base) {
+    HeapFree(GetProcessHeap(), 0, base);
+}
+
+/** Stand-ins for LSA client buffer and logon session functions.
+    Outstanding client buffers and logon sessions are counted to detect leaks. */
+static std::atomic<int> ClientBufferCount = 0;
+static std::atomic<int> LogonSessionCount = 0;
+
+static NTSTATUS NTAPI AllocateClientBuffer(PLSA_CLIENT_REQUEST, ULONG length, void** clientBaseAddress) {
+    *clientBaseAddress = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, length);
+    if (!*clientBaseAddress)
+        return STATUS_NO_MEMORY;
+    ClientBufferCount++;
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS NTAPI FreeClientBuffer(PLSA_CLIENT_REQUEST, void* clientBaseAddress) {
+    HeapFree(GetProcessHeap(), 0, clientBaseAddress);
+    ClientBufferCount--;
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS NTAPI CopyToClientBuffer(PLSA_CLIENT_REQUEST, ULONG length, void* clientBaseAddress, void* bufferToCopy) {
+    memcpy(/*dst*/clientBaseAddress, /*src*/bufferToCopy, length);
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS NTAPI CreateLogonSession(LUID*) {
+    LogonSessionCount++;
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS NTAPI DeleteLogonSession(LUID*) {
+    LogonSessionCount--;
+    return STATUS_SUCCESS;
+}
+
+extern SECPKG_FUNCTION_TABLE SecurityPackageFunctionTable; // defined in Main.cpp
+
+/** Outputs of one LsaApLogonUser call that are of interest to tests. */
+struct LogonResult {
+    NTSTATUS Status = 0;
+    NTSTATUS SubStatus = 0;
+    ULONG    ProfileBufferSize = 0;
+    bool     ProfileValid = false; // interactive profile consistent with its size
+    DWORD    GroupCount = 0;
+};
+
+/** Call LsaApLogonUser through the package function table like LSA does, and release all outputs afterwards. */
+static LogonResult CallLogonUser(SECURITY_LOGON_TYPE logonType, const std::vector<BYTE>& submitBuffer) {
+    std::vector<BYTE> buffer = submitBuffer; // unpacked in-place
+
+    void* profileBuffer = nullptr;
+    LUID logonId = {};
+    LSA_TOKEN_INFORMATION_TYPE tokenType = {};
+    void* token = nullptr;
+    LSA_UNICODE_STRING* accountName = nullptr;
+    LSA_UNICODE_STRING* authority = nullptr;
+    LogonResult result;
+    result.Status = SecurityPackageFunctionTable.LogonUser(/*ClientRequest*/nullptr, logonType, buffer.data(), /*ClientBufferBase*/nullptr, (ULONG)buffer.size(),
+        &profileBuffer, &result.ProfileBufferSize, &logonId, &result.SubStatus, &tokenType, &token, &accountName, &authority);
+    if (result.Status != STATUS_SUCCESS)
+        return result;
+
+    result.GroupCount = ((LSA_TOKEN_INFORMATION_V2*)token)->Groups->GroupCount;
+
+    if (profileBuffer) {
+        // the client buffer stand-in lives in this process, so string addresses must point right into it
+        auto* profile = (MSV1_0_INTERACTIVE_PROFILE*)profileBuffer;
+        auto inside = [&](const UNICODE_STRING& str) {
+            return ((BYTE*)str.Buffer >= (BYTE*)profileBuffer + sizeof(*profile)) && ((BYTE*)str.Buffer + str.Length <= (BYTE*)profileBuffer + result.ProfileBufferSize);
+        };
+        result.ProfileValid = (profile->MessageType == MsV1_0InteractiveProfile) && inside(profile->FullName) && inside(profile->LogonServer)
+            && (result.ProfileBufferSize == InteractiveProfileLayout::Size({ ToView(profile->FullName), ToView(profile->LogonServer) }));
+    }
+
+    // LSA takes ownership of all outputs on success
+    if (profileBuffer)
+        FreeClientBuffer(nullptr, profileBuffer);
+    DeleteLogonSession(&logonId);
+    FunctionTable.FreeLsaHeap(token);
+    for (LSA_UNICODE_STRING* str : { accountName, authority }) {
+        if (str) {
+            FunctionTable.FreeLsaHeap(str->Buffer);
+            FunctionTable.FreeLsaHeap(str);
+        }
+    }
+    return result;
+}
+
+static double Percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty())
+        return 0;
+    auto idx = (size_t)std::ceil(p * sorted.size());
+    return sorted[std::clamp<size_t>(idx, 1, sorted.size()) - 1];
+}
+
+
+/** Run UserNameToToken against a simulated directory and report the logon latency distribution. */
+static int LatencyTest(unsigned logons, unsigned users, unsigned groups, const LatencyProfile& latency, unsigned workers) {
+    wprintf(L"Simulated directory: median=%.2fms sigma=%.2f errors=%.3f stalls=%.3f (+%.0fms)\n", latency.MedianMs, latency.Sigma, latency.ErrorRate, latency.StallRate, latency.StallMs);
+    wprintf(L"Running %u logons across %u users with %u groups each using %u lookup workers...\n", logons, users, groups, workers);
+
+    SelectAccountResolver(std::make_unique<NetApiResolver>(std::make_unique<SimulatedDirectory>(latency, groups), workers));
+
+    std::mt19937 random(1);
+    std::uniform_int_distribution<unsigned> pickUser(0, users - 1);
+
+    std::vector<double> durations;
+    durations.reserve(logons);
+    unsigned failures = 0;
+    for (unsigned i = 0; i < logons; i++) {
+        std::wstring username = L"user" + std::to_wstring(pickUser(random));
+        LSA_UNICODE_STRING accountName {
+            .Length = (USHORT)(2 * username.size()),
+            .MaximumLength = (USHORT)(2 * username.size()),
+            .Buffer = username.data(),
+        };
+
+        auto start = std::chrono::steady_clock::now();
+        LSA_TOKEN_INFORMATION_V2* token = nullptr;
+        NTSTATUS subStatus = 0;
+        NTSTATUS status = UserNameToToken(&accountName, Policy, &token, &subStatus);
+        auto stop = std::chrono::steady_clock::now();
+
+        durations.push_back(std::chrono::duration<double, std::milli>(stop - start).count());
+        if (status == STATUS_SUCCESS)
+            FunctionTable.FreeLsaHeap(token);
+        else
+            failures++;
+    }
+
+    std::sort(durations.begin(), durations.end());
+    wprintf(L"\n");
+    wprintf(L"Failures: %u of %u\n", failures, logons);
+    wprintf(L"Logon latency [ms]:\n");
+    wprintf(L"  p50:  %8.3f\n", Percentile(durations, 0.50));
+    wprintf(L"  p99:  %8.3f\n", Percentile(durations, 0.99));
+    wprintf(L"  p999: %8.3f\n", Percentile(durations, 0.999));
+    wprintf(L"  max:  %8.3f\n", durations.empty() ? 0.0 : durations.back());
+    return 0;
+}
+
+
+/** Compare NetApi and S4U token sources against the same simulated directory.
+    Bypasses AccountCache so that every logon pays for a full resolution. */
+static int ResolverBenchmark(unsigned logons, unsigned users, unsigned groups, const LatencyProfile& latency) {
+    wprintf(L"Simulated directory: median=%.2fms sigma=%.2f\n", latency.MedianMs, latency.Sigma);
+    wprintf(L"Resolving %u logons across %u users with %u groups each...\n", logons, users, groups);
+
+    std::unique_ptr<AccountResolver> resolvers[] = {
+        std::make_unique<NetApiResolver>(std::make_unique<SimulatedDirectory>(latency, groups)),
+        std::make_unique<SimulatedS4UResolver>(std::make_unique<SimulatedDirectory>(latency, groups)),
+    };
+
+    // both token sources must agree on the group set of every user
+    std::vector<std::vector<std::vector<BYTE>>> groupSids[2];
+    for (auto& perUser : groupSids)
+        perUser.resize(users);
+
+    wprintf(L"\n%-8s %10s %10s %10s %10s\n", L"resolver", L"p50[ms]", L"p99[ms]", L"max[ms]", L"failures");
+    for (size_t r = 0; r < std::size(resolvers); r++) {
+        std::mt19937 random(1); // same user sequence for every resolver
+        std::uniform_int_distribution<unsigned> pickUser(0, users - 1);
+
+        std::vector<double> durations;
+        durations.reserve(logons);
+        unsigned failures = 0;
+        for (unsigned i = 0; i < logons; i++) {
+            unsigned user = pickUser(random);
+            AccountInfo info;
+            auto start = std::chrono::steady_clock::now();
+            bool ok = resolvers[r]->Resolve(L"user" + std::to_wstring(user), info);
+            auto stop = std::chrono::steady_clock::now();
+
+            durations.push_back(std::chrono::duration<double, std::milli>(stop - start).count());
+            if (!ok) {
+                failures++;
+                continue;
+            }
+            CanonicalizeGroups(info.Groups);
+            groupSids[r][user].clear();
+            for (const AccountInfo::Group& group : info.Groups)
+                groupSids[r][user].push_back(group.Sid);
+        }
+
+        std::sort(durations.begin(), durations.end());
+        wprintf(L"%-8s %10.3f %10.3f %10.3f %10u\n", resolvers[r]->Name(), Percentile(durations, 0.50), Percentile(durations, 0.99), durations.empty() ? 0.0 : durations.back(), failures);
+    }
+
+    for (unsigned user = 0; user < users; user++) {
+        if (groupSids[0][user] != groupSids[1][user]) {
+            wprintf(L"ERROR: Group sets of user%u differ between resolvers\n", user);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+/** Measure how group canonicalization and token building scale from 1 to "maxGroups" groups.
+    Both are expected to grow linearly, so the time per group should stay roughly constant. */
+static int TokenScalingBenchmark(unsigned maxGroups, unsigned iterations) {
+    const LatencyProfile instant {
+        .MedianMs = 0.001,
+        .Sigma = 0.0,
+    };
+    std::mt19937 random(1);
+
+    wprintf(L"%-8s %18s %12s %18s\n", L"groups", L"canonicalize[us]", L"token[us]", L"token/group[ns]");
+    for (unsigned groupCount = 1; groupCount <= maxGroups; groupCount *= 10) {
+        auto directory = std::make_unique<SimulatedDirectory>(instant, groupCount);
+
+        // report every group twice in random order, like overlapping global & local memberships
+        std::vector<AccountInfo::Group> groups;
+        if (!directory->GetTokenGroups(L"user0", groups)) {
+            wprintf(L"ERROR: Unable to get groups\n");
+            return 1;
+        }
+        size_t uniqueCount = groups.size();
+        std::vector<AccountInfo::Group> reported = groups;
+        for (const AccountInfo::Group& group : groups)
+            reported.push_back(AccountInfo::Group{ group.Sid, SE_GROUP_USE_FOR_DENY_ONLY });
+        std::shuffle(reported.begin(), reported.end(), random);
+
+        double canonicalizeUs = 0;
+        for (unsigned i = 0; i < iterations; i++) {
+            std::vector<AccountInfo::Group> copy = reported;
+            auto start = std::chrono::steady_clock::now();
+            CanonicalizeGroups(copy);
+            auto stop = std::chrono::steady_clock::now();
+            canonicalizeUs += std::chrono::duration<double, std::micro>(stop - start).count();
+
+            if (copy.size() != uniqueCount) {
+                wprintf(L"ERROR: %zu groups left after de-duplication, expected %zu\n", copy.size(), uniqueCount);
+                return 1;
+            }
+        }
+
+        // time token building alone by serving every logon from a warm AccountCache
+        SelectAccountResolver(std::make_unique<SimulatedS4UResolver>(std::move(directory)));
+        Accounts.Clear();
+        std::wstring username = L"user0";
+        LSA_UNICODE_STRING accountName {
+            .Length = (USHORT)(2 * username.size()),
+            .MaximumLength = (USHORT)(2 * username.size()),
+            .Buffer = username.data(),
+        };
+
+        double tokenUs = 0;
+        for (unsigned i = 0; i <= iterations; i++) {
+            LSA_TOKEN_INFORMATION_V2* token = nullptr;
+            NTSTATUS subStatus = 0;
+            auto start = std::chrono::steady_clock::now();
+            NTSTATUS status = UserNameToToken(&accountName, Policy, &token, &subStatus);
+            auto stop = std::chrono::steady_clock::now();
+            if (i > 0)
+                tokenUs += std::chrono::duration<double, std::micro>(stop - start).count(); // first call fills the cache
+
+            if (status != STATUS_SUCCESS) {
+                wprintf(L"ERROR: UserNameToToken failed with err: 0x%x\n", status);
+                return 1;
+            }
+            DWORD tokenGroups = token->Groups->GroupCount;
+            FunctionTable.FreeLsaHeap(token);
+            if (tokenGroups != uniqueCount) {
+                wprintf(L"ERROR: Token has %u groups, expected %zu\n", tokenGroups, uniqueCount);
+                return 1;
+            }
+        }
+
+        canonicalizeUs /= iterations;
+        tokenUs /= iterations;
+        wprintf(L"%-8zu %18.2f %12.2f %18.1f\n", uniqueCount, canonicalizeUs, tokenUs, 1000.0 * tokenUs / uniqueCount);
+    }
+    return 0;
+}
+
+
+/** Compare the cost of interactive logons with the lightweight Network, Batch and Service path.
+    Accounts are served from a warm AccountCache, so the difference comes from the profile buffer and GetComputerNameW. */
+static int LogonTypeBenchmark(unsigned logons, unsigned groups) {
+    const LatencyProfile instant {
+        .MedianMs = 0.001,
+        .Sigma = 0.0,
+    };
+    SelectAccountResolver(std::make_unique<NetApiResolver>(std::make_unique<SimulatedDirectory>(instant, groups)));
+    Accounts.Clear();
+
+    const unsigned users = 10;
+    std::vector<std::vector<BYTE>> submitBuffers;
+    for (unsigned i = 0; i < users; i++)
+        submitBuffers.push_back(PackInteractiveLogon(L"CONTOSO", L"user" + std::to_wstring(i), /*password*/L""));
+
+    const std::pair<SECURITY_LOGON_TYPE, const wchar_t*> logonTypes[] = {
+        { Interactive, L"Interactive" },
+        { Network,     L"Network" },
+        { Batch,       L"Batch" },
+        { Service,     L"Service" },
+    };
+
+    wprintf(L"%-12s %10s %10s %10s %14s\n", L"type", L"p50[us]", L"p99[us]", L"mean[us]", L"profile[bytes]");
+    for (auto [logonType, name] : logonTypes) {
+        for (const std::vector<BYTE>& submitBuffer : submitBuffers)
+            CallLogonUser(logonType, submitBuffer); // fill cache
+
+        std::vector<double> durations;
+        durations.reserve(logons);
+        ULONG profileSize = 0;
+        for (unsigned i = 0; i < logons; i++) {
+            auto start = std::chrono::steady_clock::now();
+            LogonResult result = CallLogonUser(logonType, submitBuffers[i % users]);
+            auto stop = std::chrono::steady_clock::now();
+            durations.push_back(std::chrono::duration<double, std::micro>(stop - start).count());
+
+            if (result.Status != STATUS_SUCCESS) {
+                wprintf(L"ERROR: %s logon failed with err: 0x%x\n", name, result.Status);
+                return 1;
+            }
+            bool interactive = (logonType == Interactive);
+            if ((interactive != (result.ProfileBufferSize > 0)) || (interactive && !result.ProfileValid)) {
+                wprintf(L"ERROR: Unexpected profile buffer of %u bytes for %s logon\n", result.ProfileBufferSize, name);
+                return 1;
+            }
+            profileSize = result.ProfileBufferSize;
+        }
+
+        double mean = 0;
+        for (double duration : durations)
+            mean += duration / durations.size();
+        std::sort(durations.begin(), durations.end());
+        wprintf(L"%-12s %10.2f %10.2f %10.2f %14u\n", name, Percentile(durations, 0.50), Percentile(durations, 0.99), mean, profileSize);
+    }
+
+    if ((ClientBufferCount != 0) || (LogonSessionCount != 0)) {
+        wprintf(L"ERROR: Leaked %i client buffers and %i logon sessions\n", (int)ClientBufferCount, (int)LogonSessionCount);
+        return 1;
+    }
+    return 0;
+}
+
+
+/** Measure the LsaApLogonUser hot-path cost of queueing audit records, with the file sink as audit target.
+    Also checks that rejected logons are audited, that every accepted record reaches the file and that drops are reported there. */
+static int AuditBenchmark(unsigned records, unsigned threadCount) {
+    wchar_t tempDir[MAX_PATH] = {};
+    GetTempPathW(ARRAYSIZE(tempDir), tempDir);
+    std::wstring path = std::wstring(tempDir) + L"NoPasswordAuthPkg_audit.txt";
+    DeleteFileW(path.c_str());
+    Audit.Start(AuditOverflow::Drop, path);
+
+    // logons rejected before the account is known must be audited too
+    const std::vector<BYTE> malformed(4, (BYTE)0xFF);
+    if ((CallLogonUser(Network, malformed).Status != STATUS_INVALID_PARAMETER) || (CallLogonUser(Proxy, malformed).Status != STATUS_NOT_IMPLEMENTED)) {
+        wprintf(L"ERROR: Unexpected status for rejected logons\n");
+        Audit.Stop();
+        return 1;
+    }
+
+    // flood the queue from several threads, like a burst of concurrent logons
+    std::wstring username = L"user0";
+    std::wstring domain = L"CONTOSO";
+    LSA_UNICODE_STRING accountName { .Length = (USHORT)(2 * username.size()), .MaximumLength = (USHORT)(2 * username.size()), .Buffer = username.data() };
+    LSA_UNICODE_STRING domainName { .Length = (USHORT)(2 * domain.size()), .MaximumLength = (USHORT)(2 * domain.size()), .Buffer = domain.data() };
+
+    std::vector<std::vector<double>> durations(threadCount);
+    std::atomic<unsigned> accepted = 0;
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < threadCount; t++) {
+        threads.emplace_back([&, t] {
+            durations[t].reserve(records / threadCount);
+            for (unsigned i = 0; i < records / threadCount; i++) {
+                LUID logonId { .LowPart = i, .HighPart = (LONG)t };
+                auto start = std::chrono::steady_clock::now();
+                bool ok = Audit.Enqueue(STATUS_SUCCESS, STATUS_SUCCESS, Network, accountName, domainName, /*userSid*/nullptr, logonId);
+                auto stop = std::chrono::steady_clock::now();
+                durations[t].push_back(std::chrono::duration<double, std::nano>(stop - start).count());
+                if (ok)
+                    accepted++;
+            }
+        });
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+    Audit.Stop(); // flushes remaining records
+
+    std::vector<double> all;
+    for (const std::vector<double>& d : durations)
+        all.insert(all.end(), d.begin(), d.end());
+    std::sort(all.begin(), all.end());
+    wprintf(L"Enqueue latency [ns] from %u threads:\n", threadCount);
+    wprintf(L"  p50:  %8.1f\n", Percentile(all, 0.50));
+    wprintf(L"  p99:  %8.1f\n", Percentile(all, 0.99));
+    wprintf(L"  max:  %8.1f\n", all.empty() ? 0.0 : all.back());
+    wprintf(L"Accepted %u of %zu records, the rest was dropped due to a full queue\n", (unsigned)accepted, all.size());
+
+    // every accepted record must reach the file sink
+    FILE* file = nullptr;
+    _wfopen_s(&file, path.c_str(), L"rb");
+    if (!file) {
+        wprintf(L"ERROR: Unable to open %s\n", path.c_str());
+        return 1;
+    }
+    size_t lines = 0;
+    uint64_t dropped = 0;
+    bool rejectedAudited[2] = {};
+    char line[2048] = {};
+    while (fgets(line, sizeof(line), file)) {
+        if (const char* report = strstr(line, " dropped=")) {
+            dropped += strtoull(report + 9, nullptr, 10); // drop reports aren't logon records
+            continue;
+        }
+        lines++;
+        rejectedAudited[0] |= (strstr(line, "status=0xc000000d type=3 ") != nullptr); // STATUS_INVALID_PARAMETER, Network
+        rejectedAudited[1] |= (strstr(line, "status=0xc0000002 type=6 ") != nullptr); // STATUS_NOT_IMPLEMENTED, Proxy
+    }
+    fclose(file);
+    if (!rejectedAudited[0] || !rejectedAudited[1]) {
+        wprintf(L"ERROR: Rejected logons missing from audit file\n");
+        return 1;
+    }
+    if (lines != accepted + 2) {
+        wprintf(L"ERROR: Audit file has %zu records, expected %u\n", lines, accepted + 2);
+        return 1;
+    }
+    if (dropped != all.size() - accepted) {
+        wprintf(L"ERROR: Audit file reports %llu dropped records, expected %zu\n", dropped, all.size() - accepted);
+        return 1;
+    }
+    wprintf(L"Audit file: %s\n", path.c_str());
+    return 0;
+}
+
+
+/** Write a REG_MULTI_SZ value, or delete it if "values" is empty. */
+static void SetMultiString(HKEY key, const wchar_t* name, const std::vector<std::wstring>& values) {
+    if (values.empty()) {
+        RegDeleteValueW(key, name);
+        return;
+    }
+    std::wstring data;
+    for (const std::wstring& value : values)
+        data += value + L'\0';
+    data += L'\0';
+    RegSetValueExW(key, name, 0, REG_MULTI_SZ, (const BYTE*)data.c_str(), (DWORD)(sizeof(wchar_t) * data.size()));
+}
+
+/** Check policy semantics on a volatile test key, then measure the cost of pinning the current snapshot
+    and checking an account against it, both idle and while another thread keeps publishing new snapshots. */
+static int PolicyBenchmark(unsigned checks, unsigned threadCount) {
+    HKEY key = nullptr;
+    if (RegCreateKeyExW(HKEY_CURRENT_USER, L"Software\\NoPasswordAuthPkgTest", 0, nullptr, REG_OPTION_VOLATILE, KEY_READ | KEY_WRITE, nullptr, &key, nullptr) != ERROR_SUCCESS) {
+        wprintf(L"ERROR: Unable to create test key\n");
+        return 1;
+    }
+
+    // "user0" is member of group0..group19 (S-1-5-21-1-2-3-100000...) and Users
+    const LatencyProfile instant {
+        .MedianMs = 0.001,
+        .Sigma = 0.0,
+    };
+    SimulatedS4UResolver resolver(std::make_unique<SimulatedDirectory>(instant, 20));
+    const std::wstring username = L"user0";
+    AccountInfo account;
+    resolver.Resolve(username, account);
+    CanonicalizeGroups(account.Groups);
+
+    struct Case {
+        const wchar_t*            Name;
+        std::vector<std::wstring> Users;
+        std::vector<std::wstring> Groups;
+        std::vector<std::wstring> LogonTypes;
+        bool                      AllowsAccount;
+        bool                      AllowsInteractive;
+    };
+    const Case cases[] = {
+        { L"unrestricted",        {},           {},                           {},             true,  true },
+        { L"listed user",         { L"USER0" }, {},                           {},             true,  true },
+        { L"unlisted user",       { L"user1" }, {},                           {},             false, true },
+        { L"member group",        {},           { L"S-1-5-21-1-2-3-100005" }, {},             true,  true },
+        { L"other group",         {},           { L"S-1-5-21-1-2-3-200000" }, {},             false, true },
+        { L"only invalid groups", {},           { L"not-a-sid" },             {},             false, true },
+        { L"logon type",          {},           {},                           { L"Network" }, true,  false },
+        { L"only invalid types",  {},           {},                           { L"bogus" },   true,  false },
+    };
+    int failures = 0;
+    for (const Case& c : cases) {
+        SetMultiString(key, L"AllowedUsers", c.Users);
+        SetMultiString(key, L"AllowedGroups", c.Groups);
+        SetMultiString(key, L"AllowedLogonTypes", c.LogonTypes);
+        std::unique_ptr<PolicySnapshot> policy = PolicySnapshot::Load(key);
+        bool allowsAccount = policy->AllowsAccount(username, account);
+        bool allowsInteractive = policy->AllowsLogonType(Interactive);
+        if ((allowsAccount != c.AllowsAccount) || (allowsInteractive != c.AllowsInteractive)) {
+            wprintf(L"ERROR: Policy \"%s\" gave account=%i interactive=%i\n", c.Name, allowsAccount, allowsInteractive);
+            failures++;
+        }
+    }
+    {
+        // logon types outside the bitmask must not wrap around onto allowed ones
+        SetMultiString(key, L"AllowedUsers", {});
+        SetMultiString(key, L"AllowedGroups", {});
+        SetMultiString(key, L"AllowedLogonTypes", {});
+        std::unique_ptr<PolicySnapshot> policy = PolicySnapshot::Load(key);
+        for (int logonType : { 64, 66, -1 }) {
+            if (policy->AllowsLogonType((SECURITY_LOGON_TYPE)logonType)) {
+                wprintf(L"ERROR: Policy allows out-of-range logon type %i\n", logonType);
+                failures++;
+            }
+        }
+    }
+    if (failures) {
+        RegDeleteTreeW(key, nullptr);
+        RegCloseKey(key);
+        return 1;
+    }
+
+    // benchmark a realistic policy: a few hundred users and groups, where "user0" is allowed through its last group
+    std::vector<std::wstring> users;
+    for (unsigned i = 1000; i < 1300; i++)
+        users.push_back(L"user" + std::to_wstring(i));
+    std::vector<std::wstring> groups;
+    for (unsigned i = 0; i < 300; i++)
+        groups.push_back(L"S-1-5-21-1-2-3-" + std::to_wstring(200000 + i));
+    groups.push_back(L"S-1-5-21-1-2-3-100019");
+    SetMultiString(key, L"AllowedUsers", users);
+    SetMultiString(key, L"AllowedGroups", groups);
+    SetMultiString(key, L"AllowedLogonTypes", { L"Interactive", L"RemoteInteractive" });
+    Policy.Publish(PolicySnapshot::Load(key));
+
+    wprintf(L"%-10s %12s %12s\n", L"writer", L"ns/check", L"publishes");
+    for (bool reloading : { false, true }) {
+        std::atomic<bool> done = false;
+        std::atomic<unsigned> publishes = 0;
+        std::thread writer;
+        if (reloading) {
+            writer = std::thread([&] {
+                while (!done) {
+                    Policy.Publish(PolicySnapshot::Load(key));
+                    publishes++;
+                }
+            });
+        }
+
+        std::atomic<unsigned> denied = 0;
+        std::vector<std::thread> readers;
+        auto start = std::chrono::steady_clock::now();
+        for (unsigned t = 0; t < threadCount; t++) {
+            readers.emplace_back([&] {
+                for (unsigned i = 0; i < checks / threadCount; i++) {
+                    PolicyStore::ReadGuard policy = Policy.Current();
+                    if (!policy->AllowsLogonType(Interactive) || !policy->AllowsAccount(username, account))
+                        denied++;
+                }
+            });
+        }
+        for (std::thread& reader : readers)
+            reader.join();
+        auto stop = std::chrono::steady_clock::now();
+        done = true;
+        if (writer.joinable())
+            writer.join();
+
+        double ns = std::chrono::duration<double, std::nano>(stop - start).count() * threadCount / checks;
+        wprintf(L"%-10s %12.1f %12u\n", reloading ? L"reloading" : L"idle", ns, (unsigned)publishes);
+        if (denied) {
+            wprintf(L"ERROR: %u checks denied\n", (unsigned)denied);
+            failures++;
+        }
+    }
+
+    RegDeleteTreeW(key, nullptr);
+    RegCloseKey(key);
+    return failures ? 1 : 0;
+}
+
+
+/** Time "func" over "iterations" calls and return nanoseconds per call. */
+template <class FUNC>
+static double TimeNs(unsigned iterations, FUNC func) {
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned i = 0; i < iterations; i++)
+        func();
+    auto stop = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(stop - start).count() / iterations;
+}
+
+/** Compare SIMD and scalar UTF-16 kernels on account names of typical lengths. */
+static int StringBenchmark(unsigned iterations) {
+    std::mt19937 random(1);
+    std::uniform_int_distribution<int> pickChar(0, 51);
+
+    wprintf(L"%-8s %-22s %10s %10s\n", L"length", L"kernel", L"scalar[ns]", L"simd[ns]");
+    for (size_t length : { 8u, 20u, 64u, 256u }) {
+        std::wstring name(length, L'\0');
+        for (wchar_t& c : name) {
+            int idx = pickChar(random);
+            c = (wchar_t)((idx < 26) ? (L'a' + idx) : (L'A' + idx - 26));
+        }
+        std::wstring other = Utf16::FoldCase(name);
+        std::wstring folded(length, L'\0');
+        std::string narrow(length, '\0');
+        volatile uint64_t sink = 0; // prevent optimizing away results
+
+        auto report = [&](const wchar_t* kernel, double scalarNs, double simdNs) {
+            wprintf(L"%-8zu %-22s %10.1f %10.1f\n", length, kernel, scalarNs, simdNs);
+        };
+        report(L"IsAscii",
+            TimeNs(iterations, [&] { sink = sink + Utf16::Scalar::IsAscii(name); }),
+            TimeNs(iterations, [&] { sink = sink + Utf16::Simd::IsAscii(name); }));
+        report(L"AsciiToLower",
+            TimeNs(iterations, [&] { Utf16::Scalar::AsciiToLower(name.data(), folded.data(), length); sink = sink + folded[0]; }),
+            TimeNs(iterations, [&] { Utf16::Simd::AsciiToLower(name.data(), folded.data(), length); sink = sink + folded[0]; }));
+        report(L"AsciiEqualsIgnoreCase",
+            TimeNs(iterations, [&] { sink = sink + Utf16::Scalar::AsciiEqualsIgnoreCase(name.data(), other.data(), length); }),
+            TimeNs(iterations, [&] { sink = sink + Utf16::Simd::AsciiEqualsIgnoreCase(name.data(), other.data(), length); }));
+        report(L"AsciiNarrow",
+            TimeNs(iterations, [&] { Utf16::Scalar::AsciiNarrow(name.data(), narrow.data(), length); sink = sink + narrow[0]; }),
+            TimeNs(iterations, [&] { Utf16::Simd::AsciiNarrow(name.data(), narrow.data(), length); sink = sink + narrow[0]; }));
+        report(L"HashIgnoreCase",
+            TimeNs(iterations, [&] { sink = sink + Utf16::Scalar::Hash(name, 0, /*fold*/true); }),
+            TimeNs(iterations, [&] { sink = sink + Utf16::Simd::Hash(name, 0, /*fold*/true); }));
+
+        if (Utf16::Scalar::Hash(name, 0, true) != Utf16::Simd::Hash(name, 0, true)) {
+            wprintf(L"ERROR: Scalar and SIMD hashes differ\n");
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+/** Compare packing submit buffers into separate vectors against packing them into one arena. */
+static int SubmitBufferBenchmark(unsigned count) {
+    // mix of account names & layouts, similar to a load test against several packages
+    std::vector<std::wstring> usernames(count);
+    for (unsigned i = 0; i < count; i++)
+        usernames[i] = L"loadtest-user" + std::to_wstring(i);
+    const std::wstring domain = L"CONTOSO";
+    const std::wstring password = L"P@ssw0rd-1234";
+
+    auto strings = [&](unsigned i) -> InteractiveLogonLayout::Strings {
+        return { domain, usernames[i], password };
+    };
+    size_t arenaSize = 0;
+    for (unsigned i = 0; i < count; i++)
+        arenaSize += SubmitBufferArena::Footprint<KerbUnlockLogonLayout>(strings(i)); // upper bound of all layouts
+    std::vector<void*> arenaBuffer(arenaSize / sizeof(void*)); // pointer aligned
+    SubmitBufferArena arena((BYTE*)arenaBuffer.data(), arenaSize);
+
+    std::vector<std::vector<BYTE>> vectors(count);
+    std::vector<std::pair<void*, ULONG>> packed(count);
+
+    wprintf(L"%-10s %12s %12s\n", L"builder", L"ns/buffer", L"allocations");
+    auto report = [&](const wchar_t* builder, auto func) {
+        size_t allocations = AllocationCount;
+        double ns = TimeNs(1, func) / count;
+        wprintf(L"%-10s %12.1f %12zu\n", builder, ns, (size_t)AllocationCount - allocations);
+    };
+    report(L"vector", [&] {
+        for (unsigned i = 0; i < count; i++) {
+            switch (i % 4) {
+            case 0: vectors[i] = PackSubmitBuffer<InteractiveLogonLayout>(strings(i)); break;
+            case 1: vectors[i] = PackSubmitBuffer<KerbInteractiveLogonLayout>(strings(i)); break;
+            case 2: vectors[i] = PackSubmitBuffer<KerbUnlockLogonLayout>(strings(i)); break;
+            case 3: vectors[i] = PackSubmitBuffer<NoPasswordLogonLayout>(strings(i)); break;
+            }
+        }
+    });
+    report(L"arena", [&] {
+        arena.Reset();
+        for (unsigned i = 0; i < count; i++) {
+            ULONG size = 0;
+            void* header = nullptr;
+            switch (i % 4) {
+            case 0: header = arena.Pack<InteractiveLogonLayout>(strings(i), &size); break;
+            case 1: header = arena.Pack<KerbInteractiveLogonLayout>(strings(i), &size); break;
+            case 2: header = arena.Pack<KerbUnlockLogonLayout>(strings(i), &size); break;
+            case 3: header = arena.Pack<NoPasswordLogonLayout>(strings(i), &size); break;
+            }
+            packed[i] = { header, size };
+        }
+    });
+    wprintf(L"Arena: %zu of %zu bytes used\n", arena.Used(), arenaSize);
+
+    // both builders must produce identical buffers that unpack to the original strings
+    for (unsigned i = 0; i < count; i++) {
+        auto [header, size] = packed[i];
+        if (!header || (size != vectors[i].size()) || (memcmp(header, vectors[i].data(), size) != 0)) {
+            wprintf(L"ERROR: Arena buffer %u differs from vector buffer\n", i);
+            return 1;
+        }
+        KERB_INTERACTIVE_LOGON* logon = KerbInteractiveLogonLayout::Unpack(header, size); // common prefix of all layouts
+        if (!logon || (ToView(logon->UserName) != usernames[i]) || (ToView(logon->Password) != password)) {
+            wprintf(L"ERROR: Unable to unpack buffer %u\n", i);
+            return 1;
+        }
+    }
+
+    // malformed string descriptors must be rejected
+    const std::pair<const wchar_t*, void(*)(UNICODE_STRING&)> corruptions[] = {
+        { L"misaligned address",        [](UNICODE_STRING& str) { str.Buffer = (wchar_t*)((size_t)str.Buffer + 1); } },
+        { L"odd length",                [](UNICODE_STRING& str) { str.Length -= 1; } },
+        { L"length above maximum",      [](UNICODE_STRING& str) { str.MaximumLength = str.Length - 2; } },
+        { L"maximum beyond buffer",     [](UNICODE_STRING& str) { str.MaximumLength += 2; } },
+        { L"address inside header",     [](UNICODE_STRING& str) { str.Buffer = (wchar_t*)sizeof(void*); } },
+    };
+    for (auto [name, corrupt] : corruptions) {
+        std::vector<BYTE> buffer = PackInteractiveLogon(domain, usernames[0], password); // password is the last field
+        corrupt(((MSV1_0_INTERACTIVE_LOGON*)buffer.data())->Password);
+        if (UnpackInteractiveLogon(buffer.data(), (ULONG)buffer.size())) {
+            wprintf(L"ERROR: Buffer with %s accepted\n", name);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/** Test code if building as EXE */
+int wmain(int argc, wchar_t* argv[]) {
+    FunctionTable.AllocateLsaHeap = AllocateHeap;
+    FunctionTable.FreeLsaHeap = FreeHeap;
+    FunctionTable.AllocateClientBuffer = AllocateClientBuffer;
+    FunctionTable.FreeClientBuffer = FreeClientBuffer;
+    FunctionTable.CopyToClientBuffer = CopyToClientBuffer;
+    FunctionTable.CreateLogonSession = CreateLogonSession;
+    FunctionTable.DeleteLogonSession = DeleteLogonSession;
+
+    if ((argc >= 2) && (std::wstring(argv[1]) == L"latency")) {
+        auto arg = [&](int idx, double defaultValue) {
+            return (argc > idx) ? _wtof(argv[idx]) : defaultValue;
+        };
+
+        LatencyProfile latency {
+            .MedianMs = arg(5, 1.0),
+            .Sigma = arg(6, 0.5),
+            .ErrorRate = arg(7, 0.0),
+            .StallRate = arg(8, 0.0),
+            .StallMs = arg(9, 0.0),
+        };
+        return LatencyTest((unsigned)arg(2, 1000), std::max<unsigned>(1, (unsigned)arg(3, 100)), (unsigned)arg(4, 20), latency, std::max<unsigned>(1, (unsigned)arg(10, NetApiResolver::DEFAULT_WORKERS)));
+    }
+
+    if ((argc >= 2) && (std::wstring(argv[1]) == L"resolvers")) {
+        auto arg = [&](int idx, double defaultValue) {
+            return (argc > idx) ? _wtof(argv[idx]) : defaultValue;
+        };
+
+        LatencyProfile latency {
+            .MedianMs = arg(5, 1.0),
+            .Sigma = arg(6, 0.5),
+        };
+        return ResolverBenchmark((unsigned)arg(2, 200), std::max<unsigned>(1, (unsigned)arg(3, 20)), (unsigned)arg(4, 20), latency);
+    }
+
+    if ((argc >= 4) && (std::wstring(argv[1]) == L"replay")) {
+        bool update = (argc >= 5) && (std::wstring(argv[4]) == L"--update");
+        double timeTolerance = (!update && (argc > 4)) ? _wtof(argv[4]) : 0.25;
+        double allocTolerance = (!update && (argc > 5)) ? _wtof(argv[5]) : 0.0;
+        return ReplayTest(argv[2], argv[3], update, timeTolerance, allocTolerance);
+    }
+
+    if ((argc >= 2) && (std::wstring(argv[1]) == L"tokens"))
+        return TokenScalingBenchmark((argc > 2) ? (unsigned)_wtoi(argv[2]) : 10000, std::max<unsigned>(1, (argc > 3) ? (unsigned)_wtoi(argv[3]) : 100));
+
+    if ((argc >= 2) && (std::wstring(argv[1]) == L"logontypes"))
+        return LogonTypeBenchmark(std::max<unsigned>(1, (argc > 2) ? (unsigned)_wtoi(argv[2]) : 10000), (argc > 3) ? (unsigned)_wtoi(argv[3]) : 20);
+
+    if ((argc >= 2) && (std::wstring(argv[1]) == L"audit"))
+        return AuditBenchmark((argc > 2) ? (unsigned)_wtoi(argv[2]) : 100000, std::max<unsigned>(1, (argc > 3) ? (unsigned)_wtoi(argv[3]) : 4));
+
+    if ((argc >= 2) && (std::wstring(argv[1]) == L"policy"))
+        return PolicyBenchmark((argc > 2) ? (unsigned)_wtoi(argv[2]) : 1000000, std::max<unsigned>(1, (argc > 3) ? (unsigned)_wtoi(argv[3]) : 4));
+
+    if ((argc >= 2) && (std::wstring(argv[1]) == L"strings"))
+        return StringBenchmark((argc > 2) ? (unsigned)_wtoi(argv[2]) : 1000000);
+
+    if ((argc >= 2) && (std::wstring(argv[1]) == L"buffers"))
+        return SubmitBufferBenchmark((argc > 2) ? (unsigned)_wtoi(argv[2]) : 10000);
+
+    wprintf(L"USAGE:\n");
+    wprintf(L"  Directory latency test: NoPasswordAuthPkg.exe latency [logons] [users] [groups] [median-ms] [sigma] [error-rate] [stall-rate] [stall-ms] [workers]\n");
+    wprintf(L"  Resolver benchmark:     NoPasswordAuthPkg.exe resolvers [logons] [users] [groups] [median-ms] [sigma]\n");
+    wprintf(L"  Replay regression test: NoPasswordAuthPkg.exe replay <corpus> <golden> [time-tolerance] [alloc-tolerance]\n");
+    wprintf(L"  Update golden file:     NoPasswordAuthPkg.exe replay <corpus> <golden> --update\n");
+    wprintf(L"  Token scaling:          NoPasswordAuthPkg.exe tokens [max-groups] [iterations]\n");
+    wprintf(L"  Logon type benchmark:   NoPasswordAuthPkg.exe logontypes [logons] [groups]\n");
+    wprintf(L"  Audit benchmark:        NoPasswordAuthPkg.exe audit [records] [threads]\n");
+    wprintf(L"  Policy test/benchmark:  NoPasswordAuthPkg.exe policy [checks] [threads]\n");
+    wprintf(L"  String benchmark:       NoPasswordAuthPkg.exe strings [iterations]\n");
+    wprintf(L"  Buffer benchmark:       NoPasswordAuthPkg.exe buffers [count]\n");
+    return -1;
+}
+
+#endif
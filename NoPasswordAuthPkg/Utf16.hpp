@@ -0,0 +1,223 @@
+#pragma once
+#include <windows.h>
+#include <NTSecAPI.h> // for LSA_UNICODE_STRING
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define UTF16_SSE2
+#endif
+
+
+/** View of a LSA_UNICODE_STRING without copying. */
+inline std::wstring_view ToView(const UNICODE_STRING& str) {
+    return std::wstring_view(str.Buffer, str.Length / sizeof(wchar_t));
+}
+
+
+/** UTF-16 kernels for account names.
+    Account names are nearly always ASCII, which is processed 8 code units at a time with SSE2. Other strings
+    fall back to the Windows NLS functions for correct Unicode case mapping. Hashes are identical for all code paths. */
+namespace Utf16 {
+
+namespace Detail {
+    /** Mix 4 UTF-16 code units into hash state. */
+    inline uint64_t HashStep(uint64_t h, uint64_t word) {
+        h ^= word;
+        h *= 0x9e3779b97f4a7c15ull;
+        return h ^ (h >> 29);
+    }
+
+    inline uint64_t HashInit(size_t length, uint64_t seed) {
+        return (seed * 0xff51afd7ed558ccdull) ^ (length * 0xc4ceb9fe1a85ec53ull);
+    }
+
+    inline uint64_t HashFinish(uint64_t h) {
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        return h;
+    }
+
+    /** Hash 8 code units, zero-padded at the end of the string. */
+    inline uint64_t HashBlock(uint64_t h, const wchar_t block[8]) {
+        uint64_t words[2] = {};
+        memcpy(words, block, sizeof(words));
+        return HashStep(HashStep(h, words[0]), words[1]);
+    }
+
+    inline wchar_t AsciiToLower(wchar_t c) {
+        return ((c >= L'A') && (c <= L'Z')) ? (wchar_t)(c + 0x20) : c;
+    }
+}
+
+
+/** Reference implementations, also used for string tails that don't fill a SIMD register. */
+namespace Scalar {
+    inline bool IsAscii(std::wstring_view str) {
+        for (wchar_t c : str) {
+            if (c > 0x7F)
+                return false;
+        }
+        return true;
+    }
+
+    inline void AsciiToLower(const wchar_t* src, wchar_t* dst, size_t count) {
+        for (size_t i = 0; i < count; i++)
+            dst[i] = Detail::AsciiToLower(src[i]);
+    }
+
+    inline bool AsciiEqualsIgnoreCase(const wchar_t* a, const wchar_t* b, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            if (Detail::AsciiToLower(a[i]) != Detail::AsciiToLower(b[i]))
+                return false;
+        }
+        return true;
+    }
+
+    inline void AsciiNarrow(const wchar_t* src, char* dst, size_t count) {
+        for (size_t i = 0; i < count; i++)
+            dst[i] = (char)src[i];
+    }
+
+    /** Hash of the string after ASCII lowercasing if "fold" is set. */
+    inline uint64_t Hash(std::wstring_view str, uint64_t seed, bool fold) {
+        uint64_t h = Detail::HashInit(str.size(), seed);
+        for (size_t i = 0; i < str.size(); i += 8) {
+            wchar_t block[8] = {};
+            for (size_t j = 0; (j < 8) && (i + j < str.size()); j++)
+                block[j] = fold ? Detail::AsciiToLower(str[i + j]) : str[i + j];
+            h = Detail::HashBlock(h, block);
+        }
+        return Detail::HashFinish(h);
+    }
+}
+
+
+#ifdef UTF16_SSE2
+namespace Sse2 {
+    inline __m128i Load(const wchar_t* ptr) {
+        return _mm_loadu_si128((const __m128i*)ptr);
+    }
+
+    /** Add 0x20 to code units in ['A', 'Z']. Other code units, including non-ASCII, are left unchanged. */
+    inline __m128i ToLower(__m128i v) {
+        __m128i upper = _mm_and_si128(_mm_cmpgt_epi16(v, _mm_set1_epi16('A' - 1)), _mm_cmplt_epi16(v, _mm_set1_epi16('Z' + 1)));
+        return _mm_add_epi16(v, _mm_and_si128(upper, _mm_set1_epi16(0x20)));
+    }
+
+    inline bool IsAscii(std::wstring_view str) {
+        __m128i bits = _mm_setzero_si128();
+        size_t i = 0;
+        for (; i + 8 <= str.size(); i += 8)
+            bits = _mm_or_si128(bits, Load(str.data() + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(bits, _mm_set1_epi16((short)0xFF80)), _mm_setzero_si128())) != 0xFFFF)
+            return false;
+        return Scalar::IsAscii(str.substr(i));
+    }
+
+    inline void AsciiToLower(const wchar_t* src, wchar_t* dst, size_t count) {
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8)
+            _mm_storeu_si128((__m128i*)(dst + i), ToLower(Load(src + i)));
+        Scalar::AsciiToLower(src + i, dst + i, count - i);
+    }
+
+    inline bool AsciiEqualsIgnoreCase(const wchar_t* a, const wchar_t* b, size_t count) {
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            if (_mm_movemask_epi8(_mm_cmpeq_epi16(ToLower(Load(a + i)), ToLower(Load(b + i)))) != 0xFFFF)
+                return false;
+        }
+        return Scalar::AsciiEqualsIgnoreCase(a + i, b + i, count - i);
+    }
+
+    inline void AsciiNarrow(const wchar_t* src, char* dst, size_t count) {
+        size_t i = 0;
+        for (; i + 16 <= count; i += 16)
+            _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(Load(src + i), Load(src + i + 8)));
+        Scalar::AsciiNarrow(src + i, dst + i, count - i);
+    }
+
+    inline uint64_t Hash(std::wstring_view str, uint64_t seed, bool fold) {
+        uint64_t h = Detail::HashInit(str.size(), seed);
+        size_t i = 0;
+        for (; i + 8 <= str.size(); i += 8) {
+            __m128i v = Load(str.data() + i);
+            alignas(16) wchar_t block[8];
+            _mm_store_si128((__m128i*)block, fold ? ToLower(v) : v);
+            h = Detail::HashBlock(h, block);
+        }
+        if (i < str.size()) {
+            wchar_t block[8] = {};
+            for (size_t j = 0; i + j < str.size(); j++)
+                block[j] = fold ? Detail::AsciiToLower(str[i + j]) : str[i + j];
+            h = Detail::HashBlock(h, block);
+        }
+        return Detail::HashFinish(h);
+    }
+}
+namespace Simd = Sse2;
+#else
+namespace Simd = Scalar;
+#endif
+
+
+inline bool IsAscii(std::wstring_view str) {
+    return Simd::IsAscii(str);
+}
+
+/** Case-fold account names, since they are case-insensitive. */
+inline std::wstring FoldCase(std::wstring_view name) {
+    std::wstring folded(name.size(), L'\0');
+    if (Simd::IsAscii(name))
+        Simd::AsciiToLower(name.data(), folded.data(), name.size());
+    else
+        LCMapStringEx(LOCALE_NAME_INVARIANT, LCMAP_LOWERCASE, name.data(), (int)name.size(), folded.data(), (int)folded.size(), nullptr, nullptr, 0);
+    return folded;
+}
+
+/** Case-insensitive comparison that agrees with FoldCase. */
+inline bool EqualsIgnoreCase(std::wstring_view a, std::wstring_view b) {
+    if (a.size() != b.size())
+        return false;
+    if (Simd::IsAscii(a) && Simd::IsAscii(b))
+        return Simd::AsciiEqualsIgnoreCase(a.data(), b.data(), a.size());
+    return FoldCase(a) == FoldCase(b);
+}
+
+inline uint64_t Hash(std::wstring_view str, uint64_t seed = 0) {
+    return Simd::Hash(str, seed, /*fold*/false);
+}
+
+/** Case-insensitive hash. Equals Hash(FoldCase(str), seed). */
+inline uint64_t HashIgnoreCase(std::wstring_view str, uint64_t seed = 0) {
+    if (Simd::IsAscii(str))
+        return Simd::Hash(str, seed, /*fold*/true);
+    return Hash(FoldCase(str), seed);
+}
+
+/** Convert to UTF-8. ASCII strings are narrowed directly. */
+inline std::string ToUtf8(std::wstring_view str) {
+    if (Simd::IsAscii(str)) {
+        std::string result(str.size(), '\0');
+        Simd::AsciiNarrow(str.data(), result.data(), str.size());
+        return result;
+    }
+
+    int size = WideCharToMultiByte(CP_UTF8, 0, str.data(), (int)str.size(), nullptr, 0, nullptr, nullptr);
+    std::string result(size, '\0');
+    WideCharToMultiByte(CP_UTF8, 0, str.data(), (int)str.size(), result.data(), size, nullptr, nullptr);
+    return result;
+}
+
+/** Hash functor for unordered containers keyed by case-folded names. */
+struct Hasher {
+    size_t operator () (std::wstring_view str) const {
+        return (size_t)Hash(str);
+    }
+};
+
+} // namespace Utf16
@@ -27,6 +27,19 @@ inline void LogMessage(const char* message, ...) {
 #endif
 }
 
+/** Registry key for deployment-specific settings. */
+static const wchar_t CONFIG_KEY[] = L"SYSTEM\\CurrentControlSet\\Control\\Lsa\\NoPasswordAuthPkg";
+
+/** Read a REG_SZ setting from CONFIG_KEY. Returns "defaultValue" if not set. */
+inline std::wstring GetConfigString(const wchar_t* name, const wchar_t* defaultValue) {
+    wchar_t value[256] = {};
+    DWORD valueSize = sizeof(value);
+    LSTATUS ret = RegGetValueW(HKEY_LOCAL_MACHINE, CONFIG_KEY, name, RRF_RT_REG_SZ, nullptr, value, &valueSize);
+    if (ret != ERROR_SUCCESS)
+        return defaultValue;
+    return value;
+}
+
 /** Allocate and create a new LSA_STRING object.
     Assumes that "FunctionTable" is initialized. */
 inline LSA_STRING* CreateLsaString(const std::string& msg) {
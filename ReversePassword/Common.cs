@@ -1,4 +1,5 @@
-﻿using System.Security.Principal;
+﻿using System.Runtime.InteropServices;
+using System.Security.Principal;
 
 namespace ReversePassword
 {
@@ -32,6 +33,58 @@ public static uint RetrieveNegotiateAuthPackage(out uint authPackage)
             return status;
         }
 
+        //Hint NoPasswordAuthPkg to start resolving the account before the logon arrives
+        public static uint PrefetchAccount(string username)
+        {
+            Logger.Write($"username: {username}");
+
+            // establish LSA connection
+            var status = PInvoke.LsaConnectUntrusted(out var lsaHandle);
+
+            uint authPackage;
+            using (var name = new PInvoke.LsaStringWrapper("NoPasswordAuthPkg"))
+            {
+                status = PInvoke.LsaLookupAuthenticationPackage(lsaHandle, ref name._string, out authPackage);
+            }
+            if (status == Constants.STATUS_SUCCESS)
+            {
+                // pack NOPASSWORD_PREFETCH_REQUEST with username at the end
+                int headerSize = Marshal.SizeOf<PInvoke.NOPASSWORD_PREFETCH_REQUEST>();
+                int usernameSize = 2 * username.Length;
+                IntPtr request = Marshal.AllocHGlobal(headerSize + usernameSize);
+                try
+                {
+                    var header = new PInvoke.NOPASSWORD_PREFETCH_REQUEST
+                    {
+                        MessageType = Constants.NoPasswordPrefetchAccount,
+                        UserName = new PInvoke.LSA_UNICODE_STRING
+                        {
+                            Length = (ushort)usernameSize,
+                            MaximumLength = (ushort)usernameSize,
+                            Buffer = headerSize, // relative address
+                        },
+                    };
+                    Marshal.StructureToPtr(header, request, false);
+                    Marshal.Copy(username.ToCharArray(), 0, request + headerSize, username.Length);
+
+                    status = PInvoke.LsaCallAuthenticationPackage(lsaHandle, authPackage, request, (uint)(headerSize + usernameSize), out var returnBuffer, out var returnBufferLength, out var protocolStatus);
+                    if (returnBuffer != IntPtr.Zero)
+                        PInvoke.LsaFreeReturnBuffer(returnBuffer);
+
+                    Logger.Write($"status: {Constants.ToString(status)}, protocolStatus: {Constants.ToString(protocolStatus)}");
+                }
+                finally
+                {
+                    Marshal.FreeHGlobal(request);
+                }
+            }
+
+            // close LSA handle
+            PInvoke.LsaDeregisterLogonProcess(lsaHandle);
+
+            return status;
+        }
+
         public static string GetNameFromSid(string value)
         {
             var sid = new SecurityIdentifier(value);
@@ -18,6 +18,9 @@ internal static class Constants
         public const uint STATUS_LOGON_FAILURE = 0xC000006D;
         public const uint STATUS_INTERNAL_ERROR = 0xC00000E5;
 
+        // from NoPasswordAuthPkg/Protocol.hpp
+        public const uint NoPasswordPrefetchAccount = 1;
+
         // from <lmerr.h>
         public const uint NERR_Success = 0;
         public const uint NERR_BASE = 2100;
@@ -37,6 +37,16 @@ public virtual void SetSelected(out int autoLogon)
         {
             //Set this to 1 if you would like GetSerialization called immediately on selection
             autoLogon = 0;
+
+            // let NoPasswordAuthPkg resolve the account while the user is typing
+            if (_view.Usage != _CREDENTIAL_PROVIDER_USAGE_SCENARIO.CPUS_CREDUI) // username is user-entered for CredUI
+            {
+                // the logon carries the plain account name, so prefetch under the same key
+                string username = Common.GetNameFromSid(_sid); // in <domain>\<user> format
+                username = username.Substring(username.LastIndexOf('\\') + 1);
+                Task.Run(() => Common.PrefetchAccount(username));
+            }
+
             Logger.Write($"Returning autoLogon: {autoLogon}");
         }
 
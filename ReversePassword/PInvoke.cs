@@ -56,6 +56,28 @@ public void Dispose()
         [DllImport("secur32.dll", SetLastError = false)]
         public static extern uint LsaDeregisterLogonProcess([In] IntPtr lsaHandle);
 
+        [StructLayout(LayoutKind.Sequential)]
+        public struct LSA_UNICODE_STRING
+        {
+            public UInt16 Length;
+            public UInt16 MaximumLength;
+            public /*PWSTR*/ IntPtr Buffer;
+        }
+
+        // matches NOPASSWORD_PREFETCH_REQUEST in NoPasswordAuthPkg/Protocol.hpp
+        [StructLayout(LayoutKind.Sequential)]
+        public struct NOPASSWORD_PREFETCH_REQUEST
+        {
+            public UInt32 MessageType;
+            public LSA_UNICODE_STRING UserName; // Buffer relative to start of request
+        }
+
+        [DllImport("secur32.dll", SetLastError = false)]
+        public static extern uint LsaCallAuthenticationPackage([In] IntPtr lsaHandle, [In] UInt32 authenticationPackage, [In] IntPtr protocolSubmitBuffer, [In] UInt32 submitBufferLength, [Out] out IntPtr protocolReturnBuffer, [Out] out UInt32 returnBufferLength, [Out] out uint protocolStatus);
+
+        [DllImport("secur32.dll", SetLastError = false)]
+        public static extern uint LsaFreeReturnBuffer([In] IntPtr buffer);
+
         [DllImport("credui.dll", CharSet = CharSet.Unicode, SetLastError = true)]
         public static extern bool CredPackAuthenticationBuffer(
             int dwFlags,